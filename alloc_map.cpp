@@ -0,0 +1,175 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <sstream>
+#include <iomanip>
+#include "alloc_map.h"
+#include "json.h"
+
+AllocMap::AllocMap() :
+    mTotalBlocks(0), mAllBlocks(0), mUsed(0), mClaimed(0), mOverlap(0)
+{
+}
+
+void AllocMap::reset(const uint32_t totalBlocks, const uint64_t usedMask)
+{
+    mTotalBlocks = totalBlocks;
+    mAllBlocks = (totalBlocks >= 64) ? ~(uint64_t)0 :
+        (((uint64_t)1 << totalBlocks) - 1);
+    mUsed = usedMask & mAllBlocks;
+    mClaimed = 0;
+    mOverlap = 0;
+    mContents.clear();
+}
+
+void AllocMap::addContent(const uint64_t mask)
+{
+    /* Bits past the end of the pack can't be owned by anyone */
+    const uint64_t owned = mask & mAllBlocks;
+
+    /* Anything already claimed that this content also wants overlaps */
+    mOverlap |= (mClaimed & owned);
+    mClaimed |= owned;
+    mContents.push_back(owned);
+}
+
+uint32_t AllocMap::popcount(const uint64_t mask)
+{
+    return __builtin_popcountll(mask);
+}
+
+uint32_t AllocMap::extents(const uint64_t mask)
+{
+    /* Count the first bit of every run of set bits */
+    return popcount(mask & ~(mask << 1));
+}
+
+uint32_t AllocMap::fragmentedContents(void) const
+{
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < mContents.size(); i++)
+        if (extents(mContents[i]) > 1)
+            count++;
+
+    return count;
+}
+
+uint32_t AllocMap::largestFreeExtent(void) const
+{
+    uint64_t runs = freeMask();
+    uint32_t length = 0;
+
+    /* Each step shortens every run by one; count steps until empty */
+    while (runs)
+    {
+        runs &= (runs >> 1);
+        length++;
+    } /* End while */
+
+    return length;
+}
+
+double AllocMap::utilization(void) const
+{
+    if (mTotalBlocks == 0) return 0.0;
+    return (100.0 * claimedBlocks()) / mTotalBlocks;
+}
+
+bool AllocMap::hasProblems(void) const
+{
+    return (mOverlap != 0) || (claimedErasedMask() != 0) ||
+        (unclaimedUsedMask() != 0);
+}
+
+AllocSummary::AllocSummary() :
+    mPacks(0), mContents(0), mBlocks(0), mClaimed(0), mOverlapping(0),
+    mUnclaimedUsed(0), mClaimedErased(0), mFragmented(0)
+{
+}
+
+void AllocSummary::add(const std::string &name, const AllocMap &map)
+{
+    mPacks++;
+    mContents += map.contentCount();
+    mBlocks += map.totalBlocks();
+    mClaimed += map.claimedBlocks();
+    mOverlapping += AllocMap::popcount(map.overlapMask());
+    mUnclaimedUsed += AllocMap::popcount(map.unclaimedUsedMask());
+    mClaimedErased += AllocMap::popcount(map.claimedErasedMask());
+    mFragmented += map.fragmentedContents();
+
+    if (map.hasProblems())
+        mFlagged.push_back(name);
+}
+
+std::string AllocSummary::generateReport(const bool color)
+{
+    std::stringstream report;
+    std::string colorReset = "";
+    std::string colorLabel = "";
+    std::string colorBad = "";
+    uint32_t i = 0;
+
+    if (color)
+    {
+        colorReset = "\u001b[0m";
+        colorLabel = "\u001b[33m"; /* Yellow */
+        colorBad = "\u001b[31m";   /* Red */
+    }
+
+    report << colorLabel << "CORPUS ALLOCATION SUMMARY:" << colorReset;
+    report << std::endl;
+    report << colorLabel << "    PACKS SCANNED:" << colorReset;
+    report << "        " << mPacks << " (" << mContents << " contents)";
+    report << std::endl;
+    report << colorLabel << "    BLOCKS CLAIMED:" << colorReset;
+    report << "       " << mClaimed << " of " << mBlocks << " (";
+    report << std::fixed << std::setprecision(1);
+    report << (mBlocks ? ((100.0 * mClaimed) / mBlocks) : 0.0) << "%)";
+    report << std::endl;
+    report << colorLabel << "    OVERLAPPING BLOCKS:" << colorReset;
+    report << "   " << mOverlapping << std::endl;
+    report << colorLabel << "    UNCLAIMED W/ DATA:" << colorReset;
+    report << "    " << mUnclaimedUsed << std::endl;
+    report << colorLabel << "    CLAIMED BUT ERASED:" << colorReset;
+    report << "   " << mClaimedErased << std::endl;
+    report << colorLabel << "    FRAGMENTED CONTENTS:" << colorReset;
+    report << "  " << mFragmented << std::endl;
+    report << colorLabel << "    SUSPECT PACKS:" << colorReset;
+    report << "        " << mFlagged.size() << std::endl;
+
+    for (i = 0; i < mFlagged.size(); i++)
+        report << "        " << colorBad << mFlagged[i] << colorReset << std::endl;
+
+    return report.str();
+}
+
+std::string AllocSummary::generateJSON(void)
+{
+    std::stringstream json;
+    uint32_t i = 0;
+
+    json << "{\"summary\":{\"packs\":" << mPacks;
+    json << ",\"contents\":" << mContents;
+    json << ",\"blocks\":" << mBlocks;
+    json << ",\"claimed\":" << mClaimed;
+    json << ",\"overlapping\":" << mOverlapping;
+    json << ",\"unclaimedUsed\":" << mUnclaimedUsed;
+    json << ",\"claimedErased\":" << mClaimedErased;
+    json << ",\"fragmented\":" << mFragmented;
+    json << ",\"suspect\":[";
+    for (i = 0; i < mFlagged.size(); i++)
+        json << (i ? "," : "") << jsonString(mFlagged[i]);
+    json << "]}}" << std::endl;
+
+    return json.str();
+}
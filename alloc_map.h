@@ -0,0 +1,76 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __ALLOC_MAP_H__
+#define __ALLOC_MAP_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* Block ownership for one pack. Every content's blockAlloc is kept as
+ * a 64-bit bitset (bit N = block N), so overlap, coverage and
+ * fragmentation checks are a handful of AND/OR/popcount operations no
+ * matter how many headers a pack has. */
+class AllocMap {
+public:
+    AllocMap();
+    void reset(const uint32_t totalBlocks, const uint64_t usedMask);
+    void addContent(const uint64_t mask);
+
+    uint32_t totalBlocks(void) const { return mTotalBlocks; }
+    uint32_t contentCount(void) const { return mContents.size(); }
+    uint64_t claimedMask(void) const { return mClaimed; }
+    uint64_t overlapMask(void) const { return mOverlap; }
+    uint64_t unclaimedUsedMask(void) const { return mUsed & ~mClaimed; }
+    uint64_t claimedErasedMask(void) const { return mClaimed & ~mUsed; }
+    uint32_t claimedBlocks(void) const { return popcount(mClaimed); }
+    uint32_t fragmentedContents(void) const;
+    uint32_t freeExtents(void) const { return extents(freeMask()); }
+    uint32_t largestFreeExtent(void) const;
+    double utilization(void) const;
+    bool hasProblems(void) const;
+
+    static uint32_t popcount(const uint64_t mask);
+    static uint32_t extents(const uint64_t mask);
+
+private:
+    uint64_t freeMask(void) const { return mAllBlocks & ~mClaimed; }
+
+    uint32_t mTotalBlocks;
+    uint64_t mAllBlocks;    /* One bit per block in the pack */
+    uint64_t mUsed;         /* Blocks that are not fully erased */
+    uint64_t mClaimed;      /* Union of all content masks */
+    uint64_t mOverlap;      /* Blocks claimed by two or more contents */
+    std::vector<uint64_t> mContents;
+};
+
+/* Corpus-wide totals gathered from the AllocMap of every pack scanned
+ * in batch mode, plus the names of packs whose tables look corrupt. */
+class AllocSummary {
+public:
+    AllocSummary();
+    void add(const std::string &name, const AllocMap &map);
+    std::string generateReport(const bool color);
+    std::string generateJSON(void);
+
+private:
+    uint64_t mPacks;
+    uint64_t mContents;
+    uint64_t mBlocks;
+    uint64_t mClaimed;
+    uint64_t mOverlapping;
+    uint64_t mUnclaimedUsed;
+    uint64_t mClaimedErased;
+    uint64_t mFragmented;
+    std::vector<std::string> mFlagged;
+};
+
+#endif /* __ALLOC_MAP_H__ */
@@ -0,0 +1,669 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <vector>
+#include "archive.h"
+#include "buffer_pool.h"
+#include "inflate.h"
+#include "hash.h"
+
+#define QUEUE_LIMIT 2               /* Members read ahead of the consumer */
+
+/* ZIP record signatures */
+#define ZIP_LOCAL_HEADER   0x04034B50
+#define ZIP_CENTRAL_HEADER 0x02014B50
+#define ZIP_END            0x06054B50
+#define ZIP64_END          0x06064B50
+#define ZIP64_LOCATOR      0x07064B50
+#define ZIP64_EXTRA        0x0001
+#define ZIP_ENCRYPTED      0x0001
+#define ZIP_STORED         0
+#define ZIP_DEFLATED       8
+
+#define TAR_BLOCK    512
+#define TAR_MAX_META 0x10000        /* Longest GNU long name/pax header kept */
+
+static uint16_t le16(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t le64(const uint8_t *ptr)
+{
+    return le32(ptr) | ((uint64_t)le32(ptr + 4) << 32);
+}
+
+static bool hasSuffix(const std::string &name, const char *suffix)
+{
+    const size_t length = strlen(suffix);
+
+    return (name.size() > length) &&
+        (strcasecmp(name.c_str() + name.size() - length, suffix) == 0);
+}
+
+/* Push-style TAR reader, so plain and gzip compressed archives can be
+ * fed through the same code a piece at a time */
+class ArchiveReader::TarParser {
+public:
+    TarParser(ArchiveReader *reader);
+    ~TarParser();
+    bool feed(const uint8_t *data, size_t length);
+    bool finish(void);
+    bool failed(void) const { return mFailed; }
+
+private:
+    enum State_t { TAR_HEADER, TAR_DATA, TAR_SKIP, TAR_END };
+    enum Kind_t { KIND_DUMP, KIND_LONG_NAME, KIND_PAX, KIND_DISCARD };
+
+    bool header(void);
+    bool complete(void);
+    void parsePax(void);
+    bool fail(const std::string &message);
+    static uint64_t number(const uint8_t *field, const size_t length);
+
+    ArchiveReader *mReader;
+    State_t mState;
+    Kind_t mKind;
+    uint8_t mHeader[TAR_BLOCK];
+    size_t mHave;                   /* Bytes of mHeader filled */
+    std::string mName;              /* Member being read */
+    uint64_t mSize;
+    uint64_t mDone;
+    uint64_t mSkip;                 /* Padding up to the next header */
+    std::vector<uint8_t> mBuffer;   /* Pooled, for KIND_DUMP */
+    std::string mMeta;              /* Long name or pax records */
+    std::string mLongName;          /* Applies to the next member */
+    uint64_t mPaxSize;
+    bool mHasPaxSize;
+    bool mFailed;
+};
+
+ArchiveReader::TarParser::TarParser(ArchiveReader *reader) :
+    mReader(reader), mState(TAR_HEADER), mKind(KIND_DISCARD), mHave(0),
+    mSize(0), mDone(0), mSkip(0), mPaxSize(0), mHasPaxSize(false),
+    mFailed(false)
+{
+}
+
+ArchiveReader::TarParser::~TarParser()
+{
+    if (!mBuffer.empty())
+        BufferPool::release(std::move(mBuffer));
+}
+
+bool ArchiveReader::TarParser::fail(const std::string &message)
+{
+    mFailed = true;
+    mReader->fail(Pack::PACK_ERR_FORMAT, message);
+    return false;
+}
+
+/* Octal, or GNU base-256 when the top bit of the first byte is set */
+uint64_t ArchiveReader::TarParser::number(const uint8_t *field,
+    const size_t length)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x7F;
+        for (i = 1; i < length; i++)
+            value = (value << 8) | field[i];
+        return value;
+    }
+
+    while ((i < length) && ((field[i] == ' ') || (field[i] == '\0')))
+        i++;
+    for (; (i < length) && (field[i] >= '0') && (field[i] <= '7'); i++)
+        value = (value << 3) | (field[i] - '0');
+    return value;
+}
+
+bool ArchiveReader::TarParser::feed(const uint8_t *data, size_t length)
+{
+    size_t take = 0;
+
+    while (length)
+    {
+        switch (mState)
+        {
+            case TAR_HEADER:
+                take = TAR_BLOCK - mHave;
+                if (take > length) take = length;
+                memcpy(&mHeader[mHave], data, take);
+                mHave += take;
+                if ((mHave == TAR_BLOCK) && !header())
+                    return false;
+                break;
+
+            case TAR_DATA:
+                take = (mSize - mDone < length) ? (mSize - mDone) : length;
+                if (mKind == KIND_DUMP)
+                    memcpy(&mBuffer[mDone], data, take);
+                else if ( ((mKind == KIND_LONG_NAME) || (mKind == KIND_PAX)) &&
+                    (mMeta.size() < TAR_MAX_META) )
+                    mMeta.append(reinterpret_cast<const char *>(data), take);
+                mDone += take;
+                if ((mDone == mSize) && !complete())
+                    return false;
+                break;
+
+            case TAR_SKIP:
+                take = (mSkip < length) ? mSkip : length;
+                mSkip -= take;
+                if (mSkip == 0)
+                    mState = TAR_HEADER;
+                break;
+
+            default:
+                /* Past the end-of-archive marker: only padding follows */
+                return true;
+        } /* End switch */
+
+        data += take;
+        length -= take;
+    } /* End while */
+
+    return true;
+}
+
+bool ArchiveReader::TarParser::finish(void)
+{
+    if ((mState == TAR_END) || ((mState == TAR_HEADER) && (mHave == 0)))
+        return true;
+    return fail("Archive '" + mReader->mFilename + "' is truncated");
+}
+
+bool ArchiveReader::TarParser::header(void)
+{
+    uint32_t sum = 0;
+    uint32_t i = 0;
+    char name[101];
+    char prefix[156];
+
+    mHave = 0;
+
+    /* An all-zero block ends the archive */
+    for (i = 0; (i < TAR_BLOCK) && (mHeader[i] == 0); i++);
+    if (i == TAR_BLOCK)
+    {
+        mState = TAR_END;
+        return true;
+    }
+
+    /* Checksum is over the header with its own field read as spaces */
+    for (i = 0; i < TAR_BLOCK; i++)
+        sum += ((i >= 148) && (i < 156)) ? ' ' : mHeader[i];
+    if (sum != number(&mHeader[148], 8))
+        return fail("Archive '" + mReader->mFilename + "' has a corrupt tar header");
+
+    mSize = mHasPaxSize ? mPaxSize : number(&mHeader[124], 12);
+    mDone = 0;
+    mSkip = (TAR_BLOCK - (mSize % TAR_BLOCK)) % TAR_BLOCK;
+
+    /* POSIX ustar splits long paths into a prefix and a name; GNU tar
+     * ("ustar  ") keeps other things there */
+    memcpy(name, &mHeader[0], 100);
+    name[100] = '\0';
+    memcpy(prefix, &mHeader[345], 155);
+    prefix[155] = '\0';
+    if (!mLongName.empty())
+        mName = mLongName;
+    else if ((memcmp(&mHeader[257], "ustar", 6) == 0) && prefix[0])
+        mName = std::string(prefix) + "/" + name;
+    else
+        mName = name;
+
+    switch (mHeader[156])
+    {
+        case 'L': /* GNU long name for the next member */
+            mKind = KIND_LONG_NAME;
+            mMeta.clear();
+            break;
+
+        case 'x': /* pax extended header for the next member */
+            mKind = KIND_PAX;
+            mMeta.clear();
+            break;
+
+        case '0':
+        case '\0':
+        case '7':
+            /* Regular file; anything else can't be a dump */
+            mLongName.clear();
+            mHasPaxSize = false;
+            mKind = KIND_DISCARD;
+            if (!Pack::mayHoldDump(mSize))
+            {
+                if (!mReader->emitMember(mName, NULL, mSize))
+                    return false;
+                break;
+            }
+            mBuffer = BufferPool::acquire(mSize);
+            mKind = KIND_DUMP;
+            break;
+
+        default:
+            /* Directories, links, devices, pax globals */
+            mLongName.clear();
+            mHasPaxSize = false;
+            mKind = KIND_DISCARD;
+    } /* End switch */
+
+    mState = TAR_DATA;
+    if (mSize == 0)
+        return complete();
+    return true;
+}
+
+bool ArchiveReader::TarParser::complete(void)
+{
+    mState = mSkip ? TAR_SKIP : TAR_HEADER;
+
+    switch (mKind)
+    {
+        case KIND_DUMP:
+            mKind = KIND_DISCARD;
+            return mReader->emit(new Pack(std::move(mBuffer), mSize,
+                (mReader->mFilename + ":" + mName).c_str()));
+
+        case KIND_LONG_NAME:
+            mLongName = std::string(mMeta.c_str());
+            break;
+
+        case KIND_PAX:
+            parsePax();
+            break;
+
+        default:
+            break;
+    } /* End switch */
+
+    return true;
+}
+
+/* Records are "<length> <key>=<value>\n"; only path and size matter */
+void ArchiveReader::TarParser::parsePax(void)
+{
+    size_t pos = 0;
+    size_t space = 0;
+    size_t equals = 0;
+    size_t length = 0;
+    std::string key;
+
+    while (pos < mMeta.size())
+    {
+        length = strtoul(mMeta.c_str() + pos, NULL, 10);
+        space = mMeta.find(' ', pos);
+        if ((length == 0) || (space == std::string::npos) ||
+            (pos + length > mMeta.size()))
+            break;
+
+        equals = mMeta.find('=', space);
+        if ((equals != std::string::npos) && (equals < pos + length))
+        {
+            key = mMeta.substr(space + 1, equals - space - 1);
+            if (key == "path")
+                mLongName = mMeta.substr(equals + 1, pos + length - equals - 2);
+            else if (key == "size")
+            {
+                mPaxSize = strtoull(mMeta.c_str() + equals + 1, NULL, 10);
+                mHasPaxSize = true;
+            }
+        }
+        pos += length;
+    } /* End while */
+}
+
+bool ArchiveReader::isArchive(const char *filename)
+{
+    const std::string name(filename);
+
+    return hasSuffix(name, ".zip") || hasSuffix(name, ".tar") ||
+        hasSuffix(name, ".tar.gz") || hasSuffix(name, ".tgz");
+}
+
+ArchiveReader::ArchiveReader(const char *filename) :
+    mFilename(filename), mMap(NULL), mMapSize(0), mDone(false),
+    mStopping(false)
+{
+    struct stat fileStat;
+    void *map = MAP_FAILED;
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if ((fd != -1) && (fstat(fd, &fileStat) == 0) &&
+        ((fileStat.st_mode & S_IFMT) == S_IFREG) && (fileStat.st_size > 0))
+        map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd != -1)
+        close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        fail(Pack::PACK_ERR_IO, "Unable to read archive '" + mFilename + "'");
+        mDone = true;
+        return;
+    }
+
+    mMap = static_cast<const uint8_t *>(map);
+    mMapSize = fileStat.st_size;
+    madvise(map, mMapSize, MADV_SEQUENTIAL);
+    mReader = std::thread(&ArchiveReader::readerMain, this);
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    /* Wake the reader if it's waiting for room, and let it give up */
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStopping = true;
+    }
+    mRoom.notify_all();
+    if (mReader.joinable())
+        mReader.join();
+
+    while (!mQueue.empty())
+    {
+        delete mQueue.front();
+        mQueue.pop_front();
+    }
+    if (mMap)
+        munmap(const_cast<uint8_t *>(mMap), mMapSize);
+}
+
+Pack *ArchiveReader::next(void)
+{
+    std::unique_lock<std::mutex> guard(mLock);
+    Pack *pack = NULL;
+
+    while (mQueue.empty() && !mDone)
+        mReady.wait(guard);
+    if (mQueue.empty())
+        return NULL;
+
+    pack = mQueue.front();
+    mQueue.pop_front();
+    guard.unlock();
+    mRoom.notify_one();
+    return pack;
+}
+
+void ArchiveReader::readerMain(void)
+{
+    if (hasSuffix(mFilename, ".zip"))
+        readZip();
+    else
+        readTar(!hasSuffix(mFilename, ".tar"));
+
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mDone = true;
+    }
+    mReady.notify_all();
+}
+
+/* Hands a pack to next(); false once nobody wants any more */
+bool ArchiveReader::emit(Pack *pack)
+{
+    std::unique_lock<std::mutex> guard(mLock);
+
+    while ((mQueue.size() >= QUEUE_LIMIT) && !mStopping)
+        mRoom.wait(guard);
+    if (mStopping)
+    {
+        delete pack;
+        return false;
+    }
+
+    mQueue.push_back(pack);
+    guard.unlock();
+    mReady.notify_one();
+    return true;
+}
+
+/* A member whose data we already have, or one too big to hold a dump
+ * (data is NULL), which fails to load with the usual size error */
+bool ArchiveReader::emitMember(const std::string &name, const uint8_t *data,
+    const uint64_t size)
+{
+    const std::string label = mFilename + ":" + name;
+    std::vector<uint8_t> buffer;
+
+    if (!data || !Pack::mayHoldDump(size))
+        return emit(new Pack(static_cast<const uint8_t *>(NULL), size,
+            label.c_str()));
+
+    buffer = BufferPool::acquire(size);
+    memcpy(&buffer[0], data, size);
+    return emit(new Pack(std::move(buffer), size, label.c_str()));
+}
+
+bool ArchiveReader::fail(const Pack::PackError_t error,
+    const std::string &message)
+{
+    emit(Pack::fromError(mFilename.c_str(), error, message));
+    return false;
+}
+
+bool ArchiveReader::readZip(void)
+{
+    const uint8_t *end = NULL;
+    const uint8_t *entry = NULL;
+    const uint8_t *extra = NULL;
+    const uint8_t *extraEnd = NULL;
+    const uint8_t *data = NULL;
+    std::vector<uint8_t> buffer;
+    std::string name;
+    std::string label;
+    std::string reason;
+    uint64_t entries = 0;
+    uint64_t directory = 0;
+    uint64_t directorySize = 0;
+    uint64_t compressedSize = 0;
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    uint64_t i = 0;
+    uint32_t crc = 0;
+    uint16_t method = 0;
+    uint16_t flags = 0;
+    size_t produced = 0;
+    size_t pos = 0;
+    bool ok = false;
+
+    /* The end record is last, give or take a comment of up to 64 KB */
+    if (mMapSize < 22)
+        return fail(Pack::PACK_ERR_FORMAT, "Archive '" + mFilename +
+            "' is not a ZIP file");
+    for (pos = mMapSize - 22; ; pos--)
+    {
+        if (le32(&mMap[pos]) == ZIP_END)
+        {
+            end = &mMap[pos];
+            break;
+        }
+        if ((pos == 0) || (mMapSize - pos > 22 + 0xFFFF))
+            break;
+    } /* End for */
+    if (!end)
+        return fail(Pack::PACK_ERR_FORMAT, "Archive '" + mFilename +
+            "' is not a ZIP file");
+
+    entries = le16(end + 10);
+    directorySize = le32(end + 12);
+    directory = le32(end + 16);
+
+    /* ZIP64 keeps the real values in a second end record */
+    if ((pos >= 20) && (le32(end - 20) == ZIP64_LOCATOR))
+    {
+        offset = le64(end - 20 + 8);
+        if ((offset + 56 <= mMapSize) && (le32(&mMap[offset]) == ZIP64_END))
+        {
+            entries = le64(&mMap[offset + 32]);
+            directorySize = le64(&mMap[offset + 40]);
+            directory = le64(&mMap[offset + 48]);
+        }
+    }
+    if ((directory > mMapSize) || (directorySize > mMapSize - directory))
+        return fail(Pack::PACK_ERR_FORMAT, "Archive '" + mFilename +
+            "' has a corrupt central directory");
+
+    entry = &mMap[directory];
+    end = entry + directorySize;
+    for (i = 0; i < entries; i++)
+    {
+        if ((end - entry < 46) || (le32(entry) != ZIP_CENTRAL_HEADER) ||
+            (end - entry < 46 + le16(entry + 28) + le16(entry + 30) +
+            le16(entry + 32)))
+            return fail(Pack::PACK_ERR_FORMAT, "Archive '" + mFilename +
+                "' has a corrupt central directory");
+
+        flags = le16(entry + 8);
+        method = le16(entry + 10);
+        crc = le32(entry + 16);
+        compressedSize = le32(entry + 20);
+        size = le32(entry + 24);
+        offset = le32(entry + 42);
+        name.assign(reinterpret_cast<const char *>(entry + 46), le16(entry + 28));
+        label = mFilename + ":" + name;
+
+        /* ZIP64 extra field: only the values that overflowed, in order */
+        extraEnd = entry + 46 + le16(entry + 28) + le16(entry + 30);
+        for (extra = entry + 46 + le16(entry + 28);
+            (extra + 4 <= extraEnd) && (extra + 4 + le16(extra + 2) <= extraEnd);
+            extra += 4 + le16(extra + 2))
+        {
+            if (le16(extra) != ZIP64_EXTRA)
+                continue;
+            pos = 4;
+            if ((size == 0xFFFFFFFF) && (pos + 8 <= 4U + le16(extra + 2)))
+            {
+                size = le64(extra + pos);
+                pos += 8;
+            }
+            if ((compressedSize == 0xFFFFFFFF) && (pos + 8 <= 4U + le16(extra + 2)))
+            {
+                compressedSize = le64(extra + pos);
+                pos += 8;
+            }
+            if ((offset == 0xFFFFFFFF) && (pos + 8 <= 4U + le16(extra + 2)))
+                offset = le64(extra + pos);
+        } /* End for */
+        entry += 46 + le16(entry + 28) + le16(entry + 30) + le16(entry + 32);
+
+        /* Directories */
+        if (!name.empty() && (name[name.size() - 1] == '/'))
+            continue;
+
+        if (!Pack::mayHoldDump(size))
+        {
+            if (!emitMember(name, NULL, size))
+                return false;
+            continue;
+        }
+
+        /* Find the data behind the local header */
+        if ( (offset + 30 > mMapSize) ||
+            (le32(&mMap[offset]) != ZIP_LOCAL_HEADER) ||
+            (offset + 30 + le16(&mMap[offset + 26]) + le16(&mMap[offset + 28]) +
+            compressedSize > mMapSize) )
+        {
+            if (!emit(Pack::fromError(label.c_str(), Pack::PACK_ERR_FORMAT,
+                "Member '" + label + "' has a corrupt local header")))
+                return false;
+            continue;
+        }
+        data = &mMap[offset + 30 + le16(&mMap[offset + 26]) +
+            le16(&mMap[offset + 28])];
+
+        if (flags & ZIP_ENCRYPTED)
+            reason = "it is encrypted";
+        else if ((method == ZIP_STORED) && (compressedSize == size))
+        {
+            /* Check it in place, then copy it out for the pack */
+            if (crc32(0, data, size) != crc)
+                reason = "its CRC-32 doesn't match";
+            else if (!emitMember(name, data, size))
+                return false;
+            else
+                continue;
+        }
+        else if (method == ZIP_DEFLATED)
+        {
+            buffer = BufferPool::acquire(size);
+            produced = 0;
+            ok = inflateStream(data, compressedSize, COMPRESSION_DEFLATE,
+                [&buffer, &produced, size](const uint8_t *out, const size_t length)
+                {
+                    if (length > size - produced)
+                        return false;
+                    memcpy(&buffer[produced], out, length);
+                    produced += length;
+                    return true;
+                }, &reason);
+
+            if (ok && (produced == size) && (crc32(0, &buffer[0], size) == crc))
+            {
+                if (!emit(new Pack(std::move(buffer), size, label.c_str())))
+                    return false;
+                continue;
+            }
+            BufferPool::release(std::move(buffer));
+            if (ok || (produced > size))
+                reason = "its size or CRC-32 doesn't match";
+            else
+                reason = "its deflate data is corrupt (" + reason + ")";
+        }
+        else
+            reason = "its compression method isn't supported";
+
+        if (!emit(Pack::fromError(label.c_str(), Pack::PACK_ERR_FORMAT,
+            "Unable to read member '" + label + "': " + reason)))
+            return false;
+    } /* End for */
+
+    /* Done! */
+    return true;
+}
+
+bool ArchiveReader::readTar(const bool compressed)
+{
+    TarParser parser(this);
+    std::string reason;
+    bool ok = false;
+
+    if (!compressed)
+        ok = parser.feed(mMap, mMapSize);
+    else
+    {
+        ok = inflateStream(mMap, mMapSize, COMPRESSION_GZIP,
+            std::bind(&TarParser::feed, &parser, std::placeholders::_1,
+            std::placeholders::_2), &reason);
+
+        /* The parser has already said why it stopped, if it did */
+        if (!ok && !parser.failed())
+            return fail(Pack::PACK_ERR_FORMAT, "Archive '" + mFilename +
+                "' is not valid gzip data: " + reason);
+    }
+
+    if (ok)
+        ok = parser.finish();
+    return ok;
+}
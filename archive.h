@@ -0,0 +1,66 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "pack.h"
+
+/* Reads the members of a ZIP (stored or deflated) or TAR (plain or
+ * gzip compressed) archive as packs named "<archive>:<member>", without
+ * extracting anything to disk. Members are read and decompressed on a
+ * background thread, a couple ahead of whoever is analyzing them.
+ * Members may be gzip or zlib compressed dumps themselves. Members that
+ * can't hold a dump come back as packs that failed to load, the same as
+ * such a file would. */
+class ArchiveReader {
+public:
+    /* Going by the file name: .zip, .tar, .tar.gz and .tgz */
+    static bool isArchive(const char *filename);
+
+    ArchiveReader(const char *filename);
+    ~ArchiveReader();
+
+    /* The next member, not yet analyzed, which the caller owns. NULL
+     * after the last one. Problems with the archive itself come back
+     * as a pack that failed to load. */
+    Pack *next(void);
+
+private:
+    class TarParser;
+
+    void readerMain(void);
+    bool readZip(void);
+    bool readTar(const bool compressed);
+    bool emit(Pack *pack);
+    bool emitMember(const std::string &name, const uint8_t *data,
+        const uint64_t size);
+    bool fail(const Pack::PackError_t error, const std::string &message);
+
+    std::string mFilename;
+    const uint8_t *mMap;            /* The whole archive, read-only */
+    uint64_t mMapSize;
+
+    std::thread mReader;
+    std::mutex mLock;
+    std::condition_variable mReady; /* Queue went non-empty, or done */
+    std::condition_variable mRoom;  /* Queue went below its limit */
+    std::deque<Pack *> mQueue;
+    bool mDone;                     /* Reader has queued its last pack */
+    bool mStopping;                 /* Consumer went away */
+};
+
+#endif /* __ARCHIVE_H__ */
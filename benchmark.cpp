@@ -0,0 +1,96 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "benchmark.h"
+
+static void dropCache(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* One timed pass over every file; returns bytes scanned */
+static uint64_t timedPass(char **files, const int count,
+    const ScanConfig_t &config, double *seconds)
+{
+    std::chrono::steady_clock::time_point start;
+    BatchScanner *scanner = NULL;
+    uint64_t bytes = 0;
+    Pack *pack = NULL;
+
+    start = std::chrono::steady_clock::now();
+    scanner = new BatchScanner(files, count, config);
+    while ((pack = scanner->next()) != NULL)
+    {
+        if (pack->isLoaded())
+            bytes += pack->packSize();
+        delete pack;
+    } /* End while */
+    delete scanner;
+    *seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return bytes;
+}
+
+int runBenchmark(char **files, const int count, const ScanConfig_t &config,
+    const bool color)
+{
+    std::string colorReset = "";
+    std::string colorLabel = "";
+    ScanConfig_t pass = config;
+    double seconds = 0.0;
+    uint64_t bytes = 0;
+    int policy = 0;
+    int i = 0;
+
+    if (color)
+    {
+        colorReset = "\u001b[0m";
+        colorLabel = "\u001b[33m"; /* Yellow */
+    }
+
+    /* Results from the cache would say nothing about I/O */
+    pass.cache = NULL;
+
+    std::cout << colorLabel << "I/O POLICY      COLD MB/s    WARM MB/s";
+    std::cout << colorReset << std::endl;
+    for (policy = 0; policy < Pack::IO_POLICY_COUNT; policy++)
+    {
+        pass.io = static_cast<Pack::IoPolicy_t>(policy);
+        std::cout << std::left << std::setw(12);
+        std::cout << Pack::ioPolicyName(pass.io) << std::right;
+        std::cout << std::fixed << std::setprecision(1);
+
+        for (i = 0; i < count; i++)
+            dropCache(files[i]);
+        bytes = timedPass(files, count, pass, &seconds);
+        std::cout << std::setw(13) << ((bytes / 1048576.0) / seconds);
+
+        /* IO_FADVISE and friends drop pages behind them, so warm the
+         * cache with a plain pass before timing the warm run */
+        pass.io = Pack::IO_STREAM;
+        timedPass(files, count, pass, &seconds);
+        pass.io = static_cast<Pack::IoPolicy_t>(policy);
+        bytes = timedPass(files, count, pass, &seconds);
+        std::cout << std::setw(13) << ((bytes / 1048576.0) / seconds);
+        std::cout << std::endl;
+    } /* End for */
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include "scan.h"
+
+/* Scan the same dumps once per I/O policy and report the throughput
+ * of each, from a cold page cache and again from a warm one. The
+ * cold pass drops each dump from the page cache first, which works
+ * without root for files that aren't dirty. */
+extern int runBenchmark(char **files, const int count,
+    const ScanConfig_t &config, const bool color);
+
+#endif /* __BENCHMARK_H__ */
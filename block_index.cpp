@@ -0,0 +1,301 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include "block_index.h"
+#include "util.h"
+
+static const char INDEX_MAGIC[8] = { 'P', 'S', 'B', 'I', 'D', 'X', '0', '1' };
+static const uint32_t BLOOM_BITS_PER_ENTRY = 10;
+static const uint32_t BLOOM_HASHES = 7;
+
+BlockIndex::BlockIndex(const char *filename) :
+    mMap(NULL), mMapSize(0), mHeader(NULL), mBloom(NULL), mSlots(NULL),
+    mContents(NULL), mStrings(NULL), mIsLoaded(false)
+{
+    struct stat fileStat;
+    void *map = NULL;
+    int fd = -1;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        std::cout << "Unable to open block index '" << filename;
+        std::cout << "': " << strerror(errno) << std::endl;
+        return;
+    }
+
+    if ((fstat(fd, &fileStat) == -1) ||
+        ((size_t)fileStat.st_size < sizeof(FileHeader_t)))
+    {
+        std::cout << "Block index '" << filename;
+        std::cout << "' is truncated" << std::endl;
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cout << "Unable to map block index '" << filename;
+        std::cout << "': " << strerror(errno) << std::endl;
+        return;
+    }
+
+    mMap = static_cast<const uint8_t *>(map);
+    mMapSize = fileStat.st_size;
+    mHeader = reinterpret_cast<const FileHeader_t *>(mMap);
+
+    /* Sanity check the layout before trusting any offsets */
+    if ( (memcmp(mHeader->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) ||
+        (mHeader->bloomBits < 8) ||
+        (mHeader->bloomBits & (mHeader->bloomBits - 1)) ||
+        (mHeader->slotCount == 0) ||
+        (mHeader->slotCount & (mHeader->slotCount - 1)) ||
+        (sizeof(FileHeader_t) + (mHeader->bloomBits / 8) > mHeader->slotsOffset) ||
+        (mHeader->slotsOffset + ((uint64_t)mHeader->slotCount * sizeof(Slot_t)) >
+            mHeader->contentsOffset) ||
+        (mHeader->contentsOffset +
+            ((uint64_t)mHeader->contentCount * sizeof(Content_t)) >
+            mHeader->stringsOffset) ||
+        (mHeader->stringsOffset + mHeader->stringsSize > mMapSize) )
+    {
+        std::cout << "Block index '" << filename;
+        std::cout << "' is not a valid index file" << std::endl;
+        return;
+    }
+
+    mBloom = mMap + sizeof(FileHeader_t);
+    mSlots = reinterpret_cast<const Slot_t *>(mMap + mHeader->slotsOffset);
+    mContents = reinterpret_cast<const Content_t *>(mMap + mHeader->contentsOffset);
+    mStrings = reinterpret_cast<const char *>(mMap + mHeader->stringsOffset);
+
+    /* The slot table is only touched on Bloom filter hits */
+    madvise(const_cast<uint8_t *>(mMap) + mHeader->slotsOffset,
+        (size_t)mHeader->slotCount * sizeof(Slot_t), MADV_RANDOM);
+
+    /* Done! */
+    mIsLoaded = true;
+}
+
+BlockIndex::~BlockIndex()
+{
+    if (mMap) munmap(const_cast<uint8_t *>(mMap), mMapSize);
+}
+
+bool BlockIndex::bloomTest(const uint8_t *bits, const uint32_t bloomBits,
+    const uint32_t bloomHashes, const uint64_t key)
+{
+    uint32_t h1 = (uint32_t)key;
+    uint32_t h2 = (uint32_t)(key >> 32) | 1;
+    uint32_t bit = 0;
+    uint32_t i = 0;
+
+    /* Kirsch-Mitzenmacher double hashing */
+    for (i = 0; i < bloomHashes; i++)
+    {
+        bit = (h1 + (i * h2)) & (bloomBits - 1);
+        if (!(bits[bit >> 3] & (1 << (bit & 7))))
+            return false;
+    } /* End for */
+
+    return true;
+}
+
+bool BlockIndex::lookup(const uint64_t key, Match_t *match) const
+{
+    uint32_t mask = 0;
+    uint32_t slot = 0;
+    uint32_t i = 0;
+
+    if (!mIsLoaded) return false;
+    if (!bloomTest(mBloom, mHeader->bloomBits, mHeader->bloomHashes, key))
+        return false;
+
+    mask = mHeader->slotCount - 1;
+    slot = (uint32_t)(key ^ (key >> 32)) & mask;
+
+    /* Linear probe until we hit the key or an empty slot */
+    for (i = 0; i <= mask; i++)
+    {
+        const Slot_t *entry = &mSlots[(slot + i) & mask];
+        const Content_t *content = NULL;
+
+        if (entry->content == 0)
+            return false;
+        if (entry->key != key)
+            continue;
+
+        /* Content IDs are stored one-based so zero marks an empty slot */
+        if (entry->content > mHeader->contentCount)
+            return false;
+        content = &mContents[entry->content - 1];
+        if ((uint64_t)content->labelOffset + content->labelLength >
+            mHeader->stringsSize)
+            return false;
+
+        if (match)
+        {
+            match->label.assign(mStrings + content->labelOffset,
+                content->labelLength);
+            match->position = entry->position;
+            match->blockCount = content->blockCount;
+            match->page = entry->page;
+        }
+        return true;
+    } /* End for */
+
+    return false;
+}
+
+bool BlockIndex::lookupBlock(const uint64_t hash, Match_t *match) const
+{
+    return lookup(hash, match);
+}
+
+bool BlockIndex::lookupPage(const uint64_t hash, Match_t *match) const
+{
+    return lookup(hash ^ PAGE_SALT, match);
+}
+
+BlockIndex::Builder::Builder()
+{
+}
+
+uint32_t BlockIndex::Builder::addContent(const std::string &label,
+    const uint32_t blockCount)
+{
+    Content_t content;
+
+    content.labelOffset = mStrings.size();
+    content.labelLength = label.size();
+    content.blockCount = blockCount;
+    mStrings += label;
+    mContents.push_back(content);
+
+    /* One-based, see lookup() */
+    return mContents.size();
+}
+
+void BlockIndex::Builder::addBlock(const uint64_t hash, const uint32_t content,
+    const uint32_t position)
+{
+    Entry_t entry;
+
+    entry.key = hash;
+    entry.content = content;
+    entry.position = position;
+    entry.page = NO_PAGE;
+    mEntries.push_back(entry);
+}
+
+void BlockIndex::Builder::addPage(const uint64_t hash, const uint32_t content,
+    const uint32_t position, const uint32_t page)
+{
+    Entry_t entry;
+
+    entry.key = hash ^ PAGE_SALT;
+    entry.content = content;
+    entry.position = position;
+    entry.page = page;
+    mEntries.push_back(entry);
+}
+
+bool BlockIndex::Builder::write(const char *filename)
+{
+    std::vector<uint8_t> bloom;
+    std::vector<Slot_t> slots;
+    std::vector<uint8_t> image;
+    FileHeader_t header;
+    uint32_t bloomBits = 64;
+    uint32_t slotCount = 1;
+    uint32_t entries = 0;
+    uint32_t mask = 0;
+    uint32_t bit = 0;
+    uint32_t i = 0;
+    uint32_t x = 0;
+
+    /* Size the filter for ~1% false positives and the table for a load
+     * factor of at most 0.5 */
+    while (bloomBits < (mEntries.size() * BLOOM_BITS_PER_ENTRY)) bloomBits <<= 1;
+    while (slotCount < (mEntries.size() * 2)) slotCount <<= 1;
+    bloom.assign(bloomBits / 8, 0);
+    slots.resize(slotCount);
+    memset(&slots[0], 0, slots.size() * sizeof(Slot_t));
+    mask = slotCount - 1;
+
+    for (i = 0; i < mEntries.size(); i++)
+    {
+        const Entry_t *entry = &mEntries[i];
+        uint32_t h1 = (uint32_t)entry->key;
+        uint32_t h2 = (uint32_t)(entry->key >> 32) | 1;
+        uint32_t slot = (uint32_t)(entry->key ^ (entry->key >> 32)) & mask;
+
+        for (x = 0; x < BLOOM_HASHES; x++)
+        {
+            bit = (h1 + (x * h2)) & (bloomBits - 1);
+            bloom[bit >> 3] |= (1 << (bit & 7));
+        } /* End for */
+
+        /* The first content seen for a hash keeps it; identical blocks
+         * shared between contents (padding, common engines) are
+         * attributed to whichever was indexed first */
+        while ((slots[slot].content != 0) && (slots[slot].key != entry->key))
+            slot = (slot + 1) & mask;
+        if (slots[slot].content != 0)
+            continue;
+
+        slots[slot].key = entry->key;
+        slots[slot].content = entry->content;
+        slots[slot].position = entry->position;
+        slots[slot].page = entry->page;
+        entries++;
+    } /* End for */
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.bloomBits = bloomBits;
+    header.bloomHashes = BLOOM_HASHES;
+    header.slotCount = slotCount;
+    header.entryCount = entries;
+    header.contentCount = mContents.size();
+    header.slotsOffset = sizeof(header) + bloom.size();
+    header.contentsOffset = header.slotsOffset + (slots.size() * sizeof(Slot_t));
+    header.stringsOffset = header.contentsOffset +
+        (mContents.size() * sizeof(Content_t));
+    header.stringsSize = mStrings.size();
+
+    /* Written whole via a temporary file, so readers never map a
+     * half-written index */
+    image.reserve(header.stringsOffset + mStrings.size());
+    image.insert(image.end(), reinterpret_cast<const uint8_t *>(&header),
+        reinterpret_cast<const uint8_t *>(&header) + sizeof(header));
+    image.insert(image.end(), bloom.begin(), bloom.end());
+    image.insert(image.end(), reinterpret_cast<const uint8_t *>(slots.data()),
+        reinterpret_cast<const uint8_t *>(slots.data() + slots.size()));
+    image.insert(image.end(),
+        reinterpret_cast<const uint8_t *>(mContents.data()),
+        reinterpret_cast<const uint8_t *>(mContents.data() + mContents.size()));
+    image.insert(image.end(), mStrings.begin(), mStrings.end());
+    if (!writeImageFile(filename, &image[0], image.size()))
+        return false;
+
+    std::cout << "Wrote " << entries << " hashes from " << mContents.size();
+    std::cout << " contents to block index '" << filename << "'" << std::endl;
+    return true;
+}
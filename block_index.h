@@ -0,0 +1,110 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __BLOCK_INDEX_H__
+#define __BLOCK_INDEX_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* Memory-mapped index from 128 KB block (and optionally 4 KB page)
+ * hashes of known-good contents to the content and position they came
+ * from. The file starts with a Bloom filter so that misses, which are
+ * the common case when scanning orphaned data, only touch a small and
+ * usually cached bit array instead of the (possibly huge) slot table. */
+class BlockIndex {
+public:
+    typedef struct {
+        std::string label;      /* Content the data belongs to */
+        uint32_t position;      /* Block number within the content */
+        uint32_t blockCount;    /* Blocks allocated to the content */
+        uint32_t page;          /* Page within the block, if a page hit */
+    } Match_t;
+
+    static const uint16_t NO_PAGE = 0xFFFF;
+
+    BlockIndex(const char *filename);
+    ~BlockIndex();
+    bool isLoaded(void) const { return mIsLoaded; }
+    bool lookupBlock(const uint64_t hash, Match_t *match) const;
+    bool lookupPage(const uint64_t hash, Match_t *match) const;
+
+private:
+    struct Content_t {
+        uint32_t labelOffset;
+        uint32_t labelLength;
+        uint32_t blockCount;
+    };
+
+public:
+    /* Collects hashes from known-good contents, then writes the index */
+    class Builder {
+    public:
+        Builder();
+        uint32_t addContent(const std::string &label, const uint32_t blockCount);
+        void addBlock(const uint64_t hash, const uint32_t content,
+            const uint32_t position);
+        void addPage(const uint64_t hash, const uint32_t content,
+            const uint32_t position, const uint32_t page);
+        bool write(const char *filename);
+
+    private:
+        typedef struct {
+            uint64_t key;
+            uint32_t content;
+            uint16_t position;
+            uint16_t page;
+        } Entry_t;
+
+        std::vector<Entry_t> mEntries;
+        std::vector<Content_t> mContents;
+        std::string mStrings;
+    };
+
+private:
+    typedef struct {
+        char magic[8];          /* "PSBIDX01" */
+        uint32_t bloomBits;     /* Power of two */
+        uint32_t bloomHashes;
+        uint32_t slotCount;     /* Power of two */
+        uint32_t entryCount;
+        uint32_t contentCount;
+        uint32_t reserved;
+        uint64_t slotsOffset;
+        uint64_t contentsOffset;
+        uint64_t stringsOffset;
+        uint64_t stringsSize;
+    } FileHeader_t;
+
+    typedef struct {
+        uint64_t key;           /* Block hash, or salted page hash */
+        uint32_t content;       /* Index into the content table */
+        uint16_t position;      /* Block number within the content */
+        uint16_t page;          /* NO_PAGE for whole-block entries */
+    } Slot_t;
+
+    static const uint64_t PAGE_SALT = 0x9E3779B97F4A7C15ULL;
+
+    bool lookup(const uint64_t key, Match_t *match) const;
+    static bool bloomTest(const uint8_t *bits, const uint32_t bloomBits,
+        const uint32_t bloomHashes, const uint64_t key);
+
+    const uint8_t *mMap;
+    size_t mMapSize;
+    const FileHeader_t *mHeader;
+    const uint8_t *mBloom;
+    const Slot_t *mSlots;
+    const Content_t *mContents;
+    const char *mStrings;
+    bool mIsLoaded;
+};
+
+#endif /* __BLOCK_INDEX_H__ */
@@ -0,0 +1,89 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <utility>
+#include <mutex>
+#include <sys/mman.h>
+#include "buffer_pool.h"
+
+#define HUGE_PAGE_SIZE     0x200000
+
+static std::mutex poolLock;
+static std::vector<std::vector<uint8_t> > freeBuffers;
+static size_t outstanding = 0;      /* Acquired, not yet released */
+static size_t peak = 0;             /* Most ever outstanding at once */
+
+/* Only whole, aligned huge pages inside the buffer can be backed by one */
+static void adviseHugePages(uint8_t *data, const size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    uintptr_t start = ((uintptr_t)data + HUGE_PAGE_SIZE - 1) &
+        ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)data + size) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+
+    if (end > start)
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+std::vector<uint8_t> BufferPool::acquire(const size_t size,
+    const bool hugePages)
+{
+    std::vector<uint8_t> buffer;
+    size_t best = 0;
+    size_t i = 0;
+
+    std::unique_lock<std::mutex> guard(poolLock);
+    if (++outstanding > peak) peak = outstanding;
+
+    /* Prefer the smallest buffer that's big enough, else the biggest */
+    if (!freeBuffers.empty())
+    {
+        for (i = 1; i < freeBuffers.size(); i++)
+        {
+            if (freeBuffers[best].size() >= size)
+            {
+                if ( (freeBuffers[i].size() >= size) &&
+                    (freeBuffers[i].size() < freeBuffers[best].size()) )
+                    best = i;
+            }
+            else if (freeBuffers[i].size() > freeBuffers[best].size())
+                best = i;
+        } /* End for */
+        buffer = std::move(freeBuffers[best]);
+        freeBuffers.erase(freeBuffers.begin() + best);
+    }
+    guard.unlock();
+
+    /* Never shrink: growing back later would zero the tail again */
+    if (buffer.size() < size)
+    {
+        buffer.reserve(size);
+        if (hugePages)
+            adviseHugePages(buffer.data(), buffer.capacity());
+        buffer.resize(size);
+    }
+    return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t> &&buffer)
+{
+    std::lock_guard<std::mutex> guard(poolLock);
+
+    /* Keep no more buffers than were ever in use at once */
+    outstanding--;
+    if (buffer.empty() || ((freeBuffers.size() + outstanding) >= peak))
+        return;
+
+    freeBuffers.push_back(std::move(buffer));
+}
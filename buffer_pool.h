@@ -0,0 +1,36 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/* Free list of dump buffers. Scanning one dump after another (batch
+ * mode, or a daemon/watch worker) gets an already-faulted-in buffer
+ * back each time instead of allocating and zeroing a fresh 4 MB
+ * vector. The list is shared so a buffer filled on a reader thread can
+ * be released by whichever thread finishes with the pack, and it never
+ * holds more buffers than were once in use at the same time. */
+class BufferPool {
+public:
+    /* A buffer of at least size bytes. Contents are unspecified. With
+     * hugePages, newly allocated memory is marked MADV_HUGEPAGE before
+     * it is first touched, so long scans over it miss the TLB less. */
+    static std::vector<uint8_t> acquire(const size_t size,
+        const bool hugePages = false);
+
+    /* Hand back a buffer that came from acquire() */
+    static void release(std::vector<uint8_t> &&buffer);
+};
+
+#endif /* __BUFFER_POOL_H__ */
@@ -0,0 +1,232 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "content_index.h"
+#include "util.h"
+
+static const char INDEX_MAGIC[8] = { 'P', 'S', 'C', 'I', 'D', 'X', '0', '1' };
+
+ContentIndex::ContentIndex(const char *filename) :
+    mMap(NULL), mMapSize(0), mHeader(NULL), mSlots(NULL), mStrings(NULL),
+    mIsLoaded(false)
+{
+    struct stat fileStat;
+    void *map = NULL;
+    uint64_t slotBytes = 0;
+    int fd = -1;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        std::cout << "Unable to open content index '" << filename;
+        std::cout << "': " << strerror(errno) << std::endl;
+        return;
+    }
+
+    if ((fstat(fd, &fileStat) == -1) ||
+        ((size_t)fileStat.st_size < sizeof(FileHeader_t)))
+    {
+        std::cout << "Content index '" << filename;
+        std::cout << "' is truncated" << std::endl;
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cout << "Unable to map content index '" << filename;
+        std::cout << "': " << strerror(errno) << std::endl;
+        return;
+    }
+
+    mMap = static_cast<const uint8_t *>(map);
+    mMapSize = fileStat.st_size;
+    mHeader = reinterpret_cast<const FileHeader_t *>(mMap);
+
+    /* Sanity check the layout before trusting any offsets */
+    slotBytes = (uint64_t)mHeader->slotCount * sizeof(Slot_t);
+    if ( (memcmp(mHeader->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) ||
+        (mHeader->slotCount == 0) ||
+        (mHeader->slotCount & (mHeader->slotCount - 1)) ||
+        (sizeof(FileHeader_t) + slotBytes > mHeader->stringsOffset) ||
+        (mHeader->stringsOffset + mHeader->stringsSize > mMapSize) )
+    {
+        std::cout << "Content index '" << filename;
+        std::cout << "' is not a valid index file" << std::endl;
+        return;
+    }
+
+    mSlots = reinterpret_cast<const Slot_t *>(mMap + sizeof(FileHeader_t));
+    mStrings = reinterpret_cast<const char *>(mMap + mHeader->stringsOffset);
+
+    /* Done! */
+    mIsLoaded = true;
+}
+
+ContentIndex::~ContentIndex()
+{
+    if (mMap) munmap(const_cast<uint8_t *>(mMap), mMapSize);
+}
+
+uint32_t ContentIndex::entryCount(void) const
+{
+    return mIsLoaded ? mHeader->entryCount : 0;
+}
+
+bool ContentIndex::lookup(const uint64_t digest, std::string *label) const
+{
+    uint32_t mask = 0;
+    uint32_t slot = 0;
+    uint32_t i = 0;
+
+    if (!mIsLoaded) return false;
+
+    mask = mHeader->slotCount - 1;
+    slot = (uint32_t)(digest ^ (digest >> 32)) & mask;
+
+    /* Linear probe until we hit the digest or an empty slot */
+    for (i = 0; i <= mask; i++)
+    {
+        const Slot_t *entry = &mSlots[(slot + i) & mask];
+
+        if (entry->labelLength == 0)
+            return false;
+
+        if (entry->digest == digest)
+        {
+            if ((uint64_t)entry->labelOffset + entry->labelLength >
+                mHeader->stringsSize)
+                return false;
+
+            if (label)
+                label->assign(mStrings + entry->labelOffset, entry->labelLength);
+            return true;
+        }
+    } /* End for */
+
+    return false;
+}
+
+bool ContentIndex::build(const char *catalogFile, const char *indexFile)
+{
+    std::ifstream catalog(catalogFile);
+    std::vector<Slot_t> slots;
+    std::string strings;
+    std::string line;
+    std::vector<uint8_t> image;
+    FileHeader_t header;
+    uint32_t lineNum = 0;
+    uint32_t entries = 0;
+    uint32_t slotCount = 1;
+    uint32_t mask = 0;
+    uint32_t i = 0;
+
+    struct Entry_t {
+        uint64_t digest;
+        uint32_t offset;
+        uint32_t length;
+    };
+    std::vector<Entry_t> parsed;
+
+    if (!catalog)
+    {
+        std::cout << "Unable to open catalog '" << catalogFile << "'";
+        std::cout << std::endl;
+        return false;
+    }
+
+    /* Parse "DIGEST LABEL" lines into a flat string table */
+    while (std::getline(catalog, line))
+    {
+        Entry_t entry;
+        char *end = NULL;
+        size_t labelStart = 0;
+
+        lineNum++;
+        if (!line.empty() && (line[line.size() - 1] == '\r'))
+            line.erase(line.size() - 1);
+        if (line.empty() || (line[0] == '#'))
+            continue;
+
+        entry.digest = strtoull(line.c_str(), &end, 16);
+        labelStart = line.find_first_not_of(" \t", end - line.c_str());
+        if ((end == line.c_str()) || ((*end != ' ') && (*end != '\t')) ||
+            (labelStart == std::string::npos))
+        {
+            std::cout << "Catalog '" << catalogFile << "' line " << lineNum;
+            std::cout << ": expected a hex digest followed by a label";
+            std::cout << std::endl;
+            return false;
+        }
+
+        entry.offset = strings.size();
+        entry.length = line.size() - labelStart;
+        strings.append(line, labelStart, std::string::npos);
+        parsed.push_back(entry);
+    } /* End while */
+
+    /* Size the table for a load factor of at most 0.5 */
+    while (slotCount < (parsed.size() * 2)) slotCount <<= 1;
+    mask = slotCount - 1;
+    slots.resize(slotCount);
+    memset(&slots[0], 0, slots.size() * sizeof(Slot_t));
+
+    for (i = 0; i < parsed.size(); i++)
+    {
+        uint64_t digest = parsed[i].digest;
+        uint32_t slot = (uint32_t)(digest ^ (digest >> 32)) & mask;
+
+        /* Later duplicates replace earlier ones */
+        while ((slots[slot].labelLength != 0) &&
+            (slots[slot].digest != digest))
+            slot = (slot + 1) & mask;
+
+        if (slots[slot].labelLength == 0) entries++;
+        slots[slot].digest = digest;
+        slots[slot].labelOffset = parsed[i].offset;
+        slots[slot].labelLength = parsed[i].length;
+    } /* End for */
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.slotCount = slotCount;
+    header.entryCount = entries;
+    header.stringsOffset = sizeof(header) + (slots.size() * sizeof(Slot_t));
+    header.stringsSize = strings.size();
+
+    /* Written whole via a temporary file, so readers never map a
+     * half-written index */
+    image.reserve(header.stringsOffset + strings.size());
+    image.insert(image.end(), reinterpret_cast<const uint8_t *>(&header),
+        reinterpret_cast<const uint8_t *>(&header) + sizeof(header));
+    image.insert(image.end(), reinterpret_cast<const uint8_t *>(&slots[0]),
+        reinterpret_cast<const uint8_t *>(&slots[0]) +
+        (slots.size() * sizeof(Slot_t)));
+    image.insert(image.end(), strings.begin(), strings.end());
+    if (!writeImageFile(indexFile, &image[0], image.size()))
+        return false;
+
+    std::cout << "Wrote " << entries << " entries to content index '";
+    std::cout << indexFile << "'" << std::endl;
+    return true;
+}
@@ -0,0 +1,58 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __CONTENT_INDEX_H__
+#define __CONTENT_INDEX_H__
+
+#include <string>
+#include <cstdint>
+
+/* Read-only, memory-mapped index from content digest to catalog
+ * entry. The file is an open-addressed hash table (linear probing,
+ * power-of-two slot count, load factor <= 0.5) followed by a string
+ * table holding the catalog labels. Opening it is a single mmap(), so
+ * nothing is parsed at startup no matter how many entries it holds. */
+class ContentIndex {
+public:
+    ContentIndex(const char *filename);
+    ~ContentIndex();
+    bool isLoaded(void) const { return mIsLoaded; }
+    uint32_t entryCount(void) const;
+    bool lookup(const uint64_t digest, std::string *label) const;
+
+    /* Build an index file from a text catalog. Each catalog line is a
+     * hex content digest, whitespace, then the label. Blank lines and
+     * lines starting with '#' are ignored. */
+    static bool build(const char *catalogFile, const char *indexFile);
+
+private:
+    typedef struct {
+        char magic[8];          /* "PSCIDX01" */
+        uint32_t slotCount;     /* Power of two */
+        uint32_t entryCount;
+        uint64_t stringsOffset; /* File offset of the string table */
+        uint64_t stringsSize;
+    } FileHeader_t;
+
+    typedef struct {
+        uint64_t digest;
+        uint32_t labelOffset;   /* Relative to the string table */
+        uint32_t labelLength;   /* Zero marks an empty slot */
+    } Slot_t;
+
+    const uint8_t *mMap;
+    size_t mMapSize;
+    const FileHeader_t *mHeader;
+    const Slot_t *mSlots;
+    const char *mStrings;
+    bool mIsLoaded;
+};
+
+#endif /* __CONTENT_INDEX_H__ */
@@ -0,0 +1,365 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <deque>
+#include <thread>
+#include <iostream>
+#include "daemon.h"
+#include "json.h"
+#include "metrics.h"
+#include "buffer_pool.h"
+
+#define MAX_PASSED_FDS 16
+#define MAX_REQUEST_LINE (PATH_MAX + 256) /* A path plus command and id */
+
+struct ScanDaemon::Connection_t {
+    int fd;
+    std::mutex writeLock;           /* One response line at a time */
+    std::deque<int> passedFds;      /* Received, not yet claimed by SCANFD.
+                                     * Only touched by the reader thread. */
+
+    Connection_t(const int sock) : fd(sock) {}
+    ~Connection_t()
+    {
+        /* Last reference gone: reader finished and no jobs in flight */
+        while (!passedFds.empty())
+        {
+            close(passedFds.front());
+            passedFds.pop_front();
+        }
+        close(fd);
+    }
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void stopHandler(int signum)
+{
+    (void)signum;
+    stopRequested = 1;
+}
+
+ScanDaemon::ScanDaemon(const ScanConfig_t &config, const unsigned int threads) :
+    mConfig(config), mPool(threads), mConnThreads(0)
+{
+}
+
+ScanDaemon::~ScanDaemon()
+{
+}
+
+int ScanDaemon::run(const char *socketPath)
+{
+    struct sockaddr_un addr;
+    struct sigaction action;
+    struct pollfd listener;
+    std::set<int>::iterator it;
+    int listenFd = -1;
+    int clientFd = -1;
+
+    if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+        std::cout << "Socket path '" << socketPath << "' is too long";
+        std::cout << std::endl;
+        return 1;
+    }
+
+    /* Stop cleanly on SIGINT/SIGTERM; a vanished client isn't fatal */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopHandler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    unlink(socketPath);
+
+    if ( (listenFd == -1) ||
+        (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (listen(listenFd, SOMAXCONN) == -1) )
+    {
+        std::cout << "Unable to listen on '" << socketPath << "': ";
+        std::cout << strerror(errno) << std::endl;
+        if (listenFd != -1) close(listenFd);
+        return 1;
+    }
+
+    metricsSetQueueDepthSource(std::bind(&WorkerPool::queueDepth, &mPool));
+    std::cout << "Listening on '" << socketPath << "' with ";
+    std::cout << mPool.threadCount() << " worker threads" << std::endl;
+
+    listener.fd = listenFd;
+    listener.events = POLLIN;
+    while (!stopRequested)
+    {
+        if (poll(&listener, 1, -1) <= 0)
+            continue; /* EINTR, most likely from a stop signal */
+
+        clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientFd == -1)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> guard(mConnLock);
+            mConnections.insert(clientFd);
+            mConnThreads++;
+        }
+        std::thread(&ScanDaemon::serveConnection, this, clientFd).detach();
+    } /* End while */
+
+    close(listenFd);
+    unlink(socketPath);
+
+    /* Wake every connection reader, then wait for them to finish */
+    {
+        std::lock_guard<std::mutex> guard(mConnLock);
+        for (it = mConnections.begin(); it != mConnections.end(); ++it)
+            shutdown(*it, SHUT_RD);
+    }
+    {
+        std::unique_lock<std::mutex> guard(mConnLock);
+        while (mConnThreads)
+            mConnDone.wait(guard);
+    }
+
+    mPool.wait();
+    metricsSetQueueDepthSource(std::function<size_t(void)>());
+    return 0;
+}
+
+void ScanDaemon::serveConnection(const int fd)
+{
+    std::shared_ptr<Connection_t> conn(new Connection_t(fd));
+    char control[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+    char buffer[4096];
+    std::string pending;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg = NULL;
+    size_t newline = 0;
+    ssize_t bytes = 0;
+    size_t i = 0;
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        bytes = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            break;
+
+        /* Queue any descriptors that rode along with this data */
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+                continue;
+
+            for (i = 0; (CMSG_LEN((i + 1) * sizeof(int)) <= cmsg->cmsg_len); i++)
+            {
+                int passed = -1;
+                memcpy(&passed, CMSG_DATA(cmsg) + (i * sizeof(int)), sizeof(int));
+                conn->passedFds.push_back(passed);
+            } /* End for */
+        } /* End for */
+
+        /* Dispatch every complete line */
+        pending.append(buffer, bytes);
+        while ((newline = pending.find('\n')) != std::string::npos)
+        {
+            std::string line;
+
+            if (newline > MAX_REQUEST_LINE)
+                break;
+            line = pending.substr(0, newline);
+
+            pending.erase(0, newline + 1);
+            if (!line.empty() && (line[line.size() - 1] == '\r'))
+                line.erase(line.size() - 1);
+            if (!line.empty())
+                handleRequest(conn, line);
+        } /* End while */
+
+        /* No request is that long, so don't keep buffering for one */
+        if ((newline != std::string::npos) ||
+            (pending.size() > MAX_REQUEST_LINE))
+        {
+            respond(conn, "-", "{\"error\":\"request line too long\"}");
+            shutdown(fd, SHUT_RD);
+            break;
+        }
+    } /* End for */
+
+    /* Jobs still in flight keep the connection open until they answer */
+    {
+        std::lock_guard<std::mutex> guard(mConnLock);
+        mConnections.erase(fd);
+        mConnThreads--;
+    }
+    mConnDone.notify_all();
+}
+
+void ScanDaemon::handleRequest(const std::shared_ptr<Connection_t> &conn,
+    const std::string &line)
+{
+    std::string command;
+    std::string id;
+    std::string argument;
+    size_t space = 0;
+    size_t start = 0;
+    int fd = -1;
+
+    /* <command> <id> [<argument>] */
+    space = line.find(' ');
+    command = line.substr(0, space);
+    if (space != std::string::npos)
+    {
+        start = space + 1;
+        space = line.find(' ', start);
+        id = line.substr(start, space - start);
+        if (space != std::string::npos)
+            argument = line.substr(space + 1);
+    }
+
+    metricAdd(METRIC_REQUESTS, 1);
+    if (id.empty())
+    {
+        respond(conn, "-", "{\"error\":\"missing request id\"}");
+        return;
+    }
+
+    if (command == "PING")
+    {
+        respond(conn, id, "PONG");
+    }
+    else if (command == "SCAN")
+    {
+        if (argument.empty())
+            respond(conn, id, "{\"error\":\"missing path\"}");
+        else
+            mPool.submit(std::bind(&ScanDaemon::scanPath, this, conn, id,
+                argument));
+    }
+    else if (command == "SCANFD")
+    {
+        /* Descriptors are claimed in the order they arrived */
+        if (!conn->passedFds.empty())
+        {
+            fd = conn->passedFds.front();
+            conn->passedFds.pop_front();
+        }
+
+        if (fd == -1)
+            respond(conn, id, "{\"error\":\"no file descriptor passed\"}");
+        else
+            mPool.submit(std::bind(&ScanDaemon::scanFd, this, conn, id, fd,
+                argument.empty() ? std::string("(fd)") : argument));
+    }
+    else
+        respond(conn, id, "{\"error\":\"unknown command\"}");
+}
+
+void ScanDaemon::scanPath(const std::shared_ptr<Connection_t> &conn,
+    const std::string &id, const std::string &path)
+{
+    Pack *pack = scanFile(path.c_str(), mConfig);
+
+    respond(conn, id, pack->generateJSON());
+    delete pack;
+}
+
+void ScanDaemon::scanFd(const std::shared_ptr<Connection_t> &conn,
+    const std::string &id, const int fd, const std::string &name)
+{
+    std::vector<uint8_t> data;
+    struct stat fileStat;
+    ssize_t bytes = 0;
+    size_t wanted = 0;
+    size_t done = 0;
+
+    if ((fstat(fd, &fileStat) == -1) || ((fileStat.st_mode & S_IFMT) != S_IFREG))
+    {
+        close(fd);
+        respond(conn, id, "{\"file\":" + jsonString(name) +
+            ",\"error\":\"not a regular file\"}");
+        return;
+    }
+
+    /* Only read what could possibly be a dump; Pack rejects the rest */
+    if (fileStat.st_size > PACK_MAX_DUMP)
+        wanted = PACK_MAX_DUMP + 1;
+    else
+        wanted = fileStat.st_size;
+    data = BufferPool::acquire(wanted);
+
+    while (done < wanted)
+    {
+        bytes = pread(fd, &data[done], wanted - done, done);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            break;
+        done += bytes;
+    } /* End while */
+    close(fd);
+
+    /* The pack only borrows the buffer; it goes back to the pool after */
+    {
+        Pack pack(data.data(), done, name.c_str());
+
+        if (pack.isLoaded())
+            scanPack(&pack, mConfig);
+        respond(conn, id, pack.generateJSON());
+    }
+    BufferPool::release(std::move(data));
+}
+
+void ScanDaemon::respond(const std::shared_ptr<Connection_t> &conn,
+    const std::string &id, const std::string &body)
+{
+    std::string line = id + " " + body;
+    ssize_t bytes = 0;
+    size_t done = 0;
+
+    if (line[line.size() - 1] != '\n')
+        line += '\n';
+
+    std::lock_guard<std::mutex> guard(conn->writeLock);
+    while (done < line.size())
+    {
+        bytes = send(conn->fd, line.data() + done, line.size() - done,
+            MSG_NOSIGNAL);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            return; /* Client went away */
+        done += bytes;
+    } /* End while */
+}
@@ -0,0 +1,61 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <condition_variable>
+#include "scan.h"
+#include "worker_pool.h"
+
+/* Long-running scanner listening on a Unix domain socket. The protocol
+ * is line based; every request carries a client-chosen ID that is
+ * echoed back, so clients may pipeline requests and receive the
+ * answers in completion order:
+ *
+ *   SCAN <id> <path>      Scan a dump by path
+ *   SCANFD <id> [<name>]  Scan a dump passed as an SCM_RIGHTS fd
+ *   PING <id>             Liveness check, answered with "<id> PONG"
+ *
+ * Scan answers are "<id> <JSON object>" on one line, in the same format
+ * as "packscan -j". The content and block indexes stay mapped and the
+ * worker threads stay up between requests. */
+class ScanDaemon {
+public:
+    ScanDaemon(const ScanConfig_t &config, const unsigned int threads);
+    ~ScanDaemon();
+    int run(const char *socketPath);
+
+private:
+    struct Connection_t;
+
+    void serveConnection(const int fd);
+    void handleRequest(const std::shared_ptr<Connection_t> &conn,
+        const std::string &line);
+    void scanPath(const std::shared_ptr<Connection_t> &conn,
+        const std::string &id, const std::string &path);
+    void scanFd(const std::shared_ptr<Connection_t> &conn,
+        const std::string &id, const int fd, const std::string &name);
+    static void respond(const std::shared_ptr<Connection_t> &conn,
+        const std::string &id, const std::string &body);
+
+    ScanConfig_t mConfig;
+    WorkerPool mPool;
+    std::mutex mConnLock;
+    std::set<int> mConnections;     /* Open client sockets */
+    size_t mConnThreads;            /* Connection threads still running */
+    std::condition_variable mConnDone;
+};
+
+#endif /* __DAEMON_H__ */
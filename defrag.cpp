@@ -0,0 +1,519 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include "defrag.h"
+#include "util.h"
+
+#define NO_COST 0xFFFF
+#define GAP_CHOICE 0xFF
+
+const uint32_t DefragPlanner::NO_BLOCK;
+const uint32_t DefragPlanner::ERASE_BLOCK;
+const uint32_t DefragPlanner::MAX_EXHAUSTIVE;
+
+DefragPlanner::DefragPlanner(const Pack &pack) :
+    mPack(pack), mTotalBlocks(0), mHeaderBlocks(0), mClaimableBlocks(0),
+    mFreeBlocks(0), mBlocksMoved(0)
+{
+}
+
+/* Contents that share a block have to stay together, so each group of
+ * them becomes one unit. A header outside its own blocks brings its
+ * block along too. */
+void DefragPlanner::findUnits(void)
+{
+    std::vector<uint32_t> owner(mTotalBlocks, NO_BLOCK);
+    std::vector<uint32_t> root(mPack.headerCount());
+    std::vector<uint32_t> unitOf(mPack.headerCount(), NO_BLOCK);
+    uint32_t i = 0, x = 0, a = 0, b = 0, mask = 0;
+
+    for (i = 0; i < root.size(); i++)
+        root[i] = i;
+
+    for (i = 0; i < mPack.headerCount(); i++)
+    {
+        mask = mPack.blockMask(&mPack.header(i));
+        for (x = 0; x < mTotalBlocks; x++)
+        {
+            if ( !((mask >> x) & 0x1) &&
+                (x != (mPack.header(i).address / PACK_BLOCK_SIZE)) )
+                continue;
+
+            if (owner[x] == NO_BLOCK)
+            {
+                owner[x] = i;
+                continue;
+            }
+
+            /* Union the two groups, by their lowest header */
+            for (a = i; root[a] != a; a = root[a]);
+            for (b = owner[x]; root[b] != b; b = root[b]);
+            root[std::max(a, b)] = std::min(a, b);
+        } /* End for */
+    } /* End for */
+
+    mUnits.clear();
+    for (x = 0; x < mTotalBlocks; x++)
+    {
+        if (owner[x] == NO_BLOCK)
+            continue;
+
+        for (a = owner[x]; root[a] != a; a = root[a]);
+        if (unitOf[a] == NO_BLOCK)
+        {
+            unitOf[a] = mUnits.size();
+            mUnits.push_back(Unit_t());
+        }
+        mUnits[unitOf[a]].blocks.push_back(x);
+    } /* End for */
+
+    /* Note which of each unit's blocks carry a header or a claim */
+    for (i = 0; i < mUnits.size(); i++)
+    {
+        mUnits[i].headerAt = 0;
+        mUnits[i].claimedAt = 0;
+    } /* End for */
+    for (i = 0; i < mPack.headerCount(); i++)
+    {
+        mask = mPack.blockMask(&mPack.header(i));
+        for (a = 0; a < mUnits.size(); a++)
+        {
+            for (x = 0; x < mUnits[a].blocks.size(); x++)
+            {
+                b = mUnits[a].blocks[x];
+                if (b == (mPack.header(i).address / PACK_BLOCK_SIZE))
+                    mUnits[a].headerAt |= (1u << x);
+                if ((mask >> b) & 0x1)
+                    mUnits[a].claimedAt |= (1u << x);
+            } /* End for */
+        } /* End for */
+    } /* End for */
+}
+
+/* Blocks of a unit that would have to move if it started at start, or
+ * NO_COST if packscan couldn't find its headers there */
+uint32_t DefragPlanner::cost(const uint32_t unit, const uint32_t start) const
+{
+    const Unit_t &u = mUnits[unit];
+    uint32_t k = 0, moved = 0;
+    uint64_t to = 0;
+
+    for (k = 0; k < u.blocks.size(); k++)
+    {
+        to = (uint64_t)1 << (start + k);
+        if ( (((u.headerAt >> k) & 0x1) && !(mHeaderBlocks & to)) ||
+            (((u.claimedAt >> k) & 0x1) && !(mClaimableBlocks & to)) )
+            return NO_COST;
+        if (u.blocks[k] != (start + k))
+            moved++;
+    } /* End for */
+    return moved;
+}
+
+/* Every order of the units, and every place for the free extent, by
+ * dynamic programming over the set of units already laid down: that
+ * set, and whether the gap came yet, fix where the next unit starts.
+ * 2^n * 2 states, each tried with every unit not in the set. */
+bool DefragPlanner::searchExhaustive(std::vector<uint32_t> *order,
+    uint32_t *gapAt)
+{
+    const uint32_t n = mUnits.size();
+    const uint32_t full = (1u << n) - 1;
+    std::vector<uint16_t> best((size_t)2 << n, NO_COST);
+    std::vector<uint8_t> choice((size_t)2 << n, GAP_CHOICE);
+    std::vector<uint16_t> placed((size_t)1 << n, 0);
+    std::vector<uint16_t> table(n * (mTotalBlocks + 1));
+    uint32_t set = 0, gap = 0, u = 0, start = 0, next = 0, total = 0;
+
+    /* Cost of each unit at each start, up front */
+    for (u = 0; u < n; u++)
+        for (start = 0; start <= mTotalBlocks; start++)
+            table[(u * (mTotalBlocks + 1)) + start] = cost(u, start);
+
+    for (set = 1; set <= full; set++)
+        placed[set] = placed[set & (set - 1)] +
+            mUnits[__builtin_ctz(set)].blocks.size();
+
+    best[0] = 0;
+    for (set = 0; set <= full; set++)
+    {
+        for (gap = 0; gap < 2; gap++)
+        {
+            if (best[(set * 2) + gap] == NO_COST)
+                continue;
+
+            /* The free extent goes here */
+            if ( !gap && (best[set * 2] < best[(set * 2) + 1]) )
+            {
+                best[(set * 2) + 1] = best[set * 2];
+                choice[(set * 2) + 1] = GAP_CHOICE;
+            }
+
+            start = placed[set] + (gap ? mFreeBlocks : 0);
+            for (u = 0; u < n; u++)
+            {
+                if ((set >> u) & 0x1)
+                    continue;
+                next = (set | (1u << u)) * 2 + gap;
+                total = best[(set * 2) + gap] + table[(u * (mTotalBlocks + 1)) + start];
+                if (total < best[next])
+                {
+                    best[next] = total;
+                    choice[next] = u;
+                }
+            } /* End for */
+        } /* End for */
+    } /* End for */
+
+    /* Walk the choices back from everything placed, gap included */
+    order->clear();
+    if (best[(full * 2) + 1] == NO_COST)
+        return false;
+    *gapAt = n;
+    for (set = full, gap = 1; set || gap; )
+    {
+        u = choice[(set * 2) + gap];
+        if (gap && (u == GAP_CHOICE))
+        {
+            *gapAt = __builtin_popcount(set);
+            gap = 0;
+            continue;
+        }
+        order->push_back(u);
+        set &= ~(1u << u);
+    } /* End for */
+    std::reverse(order->begin(), order->end());
+    return true;
+}
+
+/* Units in the order they are in now, with the free extent put
+ * wherever it moves the fewest blocks */
+bool DefragPlanner::searchInOrder(std::vector<uint32_t> *order,
+    uint32_t *gapAt)
+{
+    uint32_t gap = 0, i = 0, start = 0, total = 0, moved = 0, best = NO_BLOCK;
+
+    order->clear();
+    for (i = 0; i < mUnits.size(); i++)
+        order->push_back(i);    /* Already sorted by first block */
+
+    for (gap = 0; gap <= mUnits.size(); gap++)
+    {
+        for (i = 0, start = 0, total = 0; i < mUnits.size(); i++)
+        {
+            if (i == gap) start += mFreeBlocks;
+            moved = cost(i, start);
+            total = ((moved == NO_COST) || (total == NO_BLOCK)) ?
+                NO_BLOCK : (total + moved);
+            start += mUnits[i].blocks.size();
+        } /* End for */
+
+        if (total < best)
+        {
+            best = total;
+            *gapAt = gap;
+        }
+    } /* End for */
+    return (best != NO_BLOCK);
+}
+
+/* Turns the new place of every block into moves that never overwrite
+ * data still waiting to move */
+void DefragPlanner::orderMoves(const std::vector<uint32_t> &target)
+{
+    std::vector<Move_t> pending;
+    std::vector<bool> needed(mTotalBlocks, false), final(mTotalBlocks, false);
+    uint32_t x = 0, scratch = 0;
+    Move_t move;
+    size_t i = 0;
+    bool progress = false;
+
+    mMoves.clear();
+    for (x = 0; x < mTotalBlocks; x++)
+    {
+        if (target[x] == NO_BLOCK)
+            continue;
+        final[target[x]] = true;
+        if (target[x] == x)
+            continue;
+
+        move.from = x;
+        move.to = target[x];
+        pending.push_back(move);
+        needed[x] = true;
+    } /* End for */
+    mBlocksMoved = pending.size();
+
+    while (!pending.empty())
+    {
+        progress = false;
+        for (i = 0; i < pending.size(); )
+        {
+            if (needed[pending[i].to])
+            {
+                i++;
+                continue;
+            }
+
+            mMoves.push_back(pending[i]);
+            if (pending[i].from != NO_BLOCK)
+                needed[pending[i].from] = false;
+            pending.erase(pending.begin() + i);
+            progress = true;
+        } /* End for */
+
+        if (progress || pending.empty())
+            continue;
+
+        /* Everything left is in cycles. Park one block on a block that
+         * ends up free, or in host memory if there isn't one. */
+        for (scratch = 0; scratch < mTotalBlocks; scratch++)
+            if (!final[scratch] && !needed[scratch])
+                break;
+        move.from = pending[0].from;
+        move.to = (scratch < mTotalBlocks) ? scratch : NO_BLOCK;
+        mMoves.push_back(move);
+
+        needed[pending[0].from] = false;
+        pending[0].from = move.to;
+        if (move.to != NO_BLOCK)
+            needed[move.to] = true;
+    } /* End while */
+}
+
+bool DefragPlanner::plan(void)
+{
+    std::vector<uint32_t> order, target;
+    uint32_t gapAt = 0, used = 0, position = 0, i = 0, k = 0, x = 0;
+    uint32_t mask = 0, remapped = 0, address = 0;
+    uint8_t *window = NULL;
+
+    if (!mPack.data())
+    {
+        mErrorMessage = "The pack must be loaded to defragment it";
+        return false;
+    }
+
+    mTotalBlocks = mPack.packSize() / PACK_BLOCK_SIZE;
+    mHeaderBlocks = Pack::headerBlocks(mPack.packSize());
+    mClaimableBlocks = Pack::claimableBlocks(mPack.packSize());
+    findUnits();
+    for (i = 0; i < mUnits.size(); i++)
+        used += mUnits[i].blocks.size();
+    mFreeBlocks = mTotalBlocks - used;
+
+    if ( !((mUnits.size() <= MAX_EXHAUSTIVE) ?
+        searchExhaustive(&order, &gapAt) : searchInOrder(&order, &gapAt)) )
+    {
+        mErrorMessage = "No defragmented layout keeps every header where "
+            "packscan looks for it";
+        return false;
+    }
+
+    /* Where every block goes */
+    target.assign(mTotalBlocks, NO_BLOCK);
+    for (i = 0; i < order.size(); i++)
+    {
+        const std::vector<uint32_t> &blocks = mUnits[order[i]].blocks;
+
+        if (i == gapAt) position += mFreeBlocks;
+        for (k = 0; k < blocks.size(); k++)
+            target[blocks[k]] = position++;
+    } /* End for */
+
+    mImage.assign(mPack.packSize(), 0xFF);
+    mWindows.clear();
+    for (x = 0; x < mTotalBlocks; x++)
+        if (target[x] != NO_BLOCK)
+            memcpy(&mImage[target[x] * PACK_BLOCK_SIZE],
+                mPack.data() + (x * PACK_BLOCK_SIZE), PACK_BLOCK_SIZE);
+
+    /* Point each header at its blocks' new homes */
+    for (i = 0; i < mPack.headerCount(); i++)
+    {
+        const Pack::Header_t &header = mPack.header(i);
+
+        address = (target[header.address / PACK_BLOCK_SIZE] * PACK_BLOCK_SIZE) +
+            (header.address % PACK_BLOCK_SIZE);
+        mask = mPack.blockMask(&header);
+        remapped = (mTotalBlocks < 32) ? (mask & ~((1u << mTotalBlocks) - 1)) : 0;
+        for (x = 0; x < mTotalBlocks; x++)
+            if ((mask >> x) & 0x1)
+                remapped |= (1u << target[x]);
+
+        mWindows.push_back(address);
+        window = &mImage[address];
+        window[0x20] = remapped & 0xFF;
+        window[0x21] = (remapped >> 8) & 0xFF;
+        window[0x22] = (remapped >> 16) & 0xFF;
+        window[0x23] = (remapped >> 24) & 0xFF;
+    } /* End for */
+
+    /* Make sure the image reads back with every header */
+    {
+        Pack check(&mImage[0], mImage.size(), mPack.filename().c_str());
+        std::stringstream message;
+
+        check.findHeaders();
+        if (check.headerCount() != mPack.headerCount())
+        {
+            message << "The defragmented image shows " << check.headerCount();
+            message << " headers instead of " << mPack.headerCount();
+            mErrorMessage = message.str();
+            return false;
+        }
+    }
+
+    orderMoves(target);
+
+    /* Blocks that stay put but whose header changed are rewritten in
+     * place, once nothing else needs them */
+    for (i = 0; i < mWindows.size(); i++)
+    {
+        const Pack::Header_t &header = mPack.header(i);
+
+        x = header.address / PACK_BLOCK_SIZE;
+        if ( (target[x] == x) && memcmp(&mImage[mWindows[i]],
+            mPack.data() + header.address, PACK_HEADER_SIZE) )
+        {
+            Move_t move = { x, x };
+            mMoves.push_back(move);
+        }
+    } /* End for */
+
+    /* Blocks nothing lands on are erased, old headers and all, once
+     * everything has been moved out of them. That includes any block a
+     * cycle was parked on. */
+    for (x = 0; x < mTotalBlocks; x++)
+    {
+        if (std::find(target.begin(), target.end(), x) != target.end())
+            continue;
+        for (i = 0; (i < mMoves.size()) && (mMoves[i].to != x); i++);
+        if ( (i < mMoves.size()) || memcmp(mPack.data() + (x * PACK_BLOCK_SIZE),
+            &mImage[x * PACK_BLOCK_SIZE], PACK_BLOCK_SIZE) )
+        {
+            Move_t move = { ERASE_BLOCK, x };
+            mMoves.push_back(move);
+        }
+    } /* End for */
+
+    if (!replayMoves())
+    {
+        mErrorMessage = "The move list doesn't reproduce the defragmented image";
+        return false;
+    }
+
+    /* Done! */
+    return true;
+}
+
+/* Carries out the moves on a copy of the pack, the way a flasher
+ * following the move list would */
+bool DefragPlanner::replayMoves(void) const
+{
+    std::vector<uint8_t> flash(mPack.data(), mPack.data() + mPack.packSize());
+    std::vector<uint8_t> block(PACK_BLOCK_SIZE), host;
+    size_t i = 0, w = 0;
+
+    for (i = 0; i < mMoves.size(); i++)
+    {
+        const Move_t &move = mMoves[i];
+
+        if (move.from == ERASE_BLOCK)
+        {
+            memset(&flash[move.to * PACK_BLOCK_SIZE], 0xFF, PACK_BLOCK_SIZE);
+            continue;
+        }
+        if (move.from == NO_BLOCK)
+        {
+            if (host.empty())
+                return false;
+            block.swap(host);
+            host.clear();
+        }
+        else
+            block.assign(&flash[move.from * PACK_BLOCK_SIZE],
+                &flash[(move.from + 1) * PACK_BLOCK_SIZE]);
+
+        if (move.to == NO_BLOCK)
+        {
+            if (!host.empty())
+                return false;
+            host.swap(block);
+            block.resize(PACK_BLOCK_SIZE);
+            continue;
+        }
+        for (w = 0; w < mWindows.size(); w++)
+            if ((mWindows[w] / PACK_BLOCK_SIZE) == move.to)
+                memcpy(&block[mWindows[w] % PACK_BLOCK_SIZE],
+                    &mImage[mWindows[w]], PACK_HEADER_SIZE);
+        memcpy(&flash[move.to * PACK_BLOCK_SIZE], &block[0], PACK_BLOCK_SIZE);
+    } /* End for */
+
+    return (flash == mImage);
+}
+
+std::string DefragPlanner::moveList(void) const
+{
+    std::stringstream text;
+    size_t i = 0, w = 0;
+    uint32_t b = 0;
+
+    text << "# PackScan defragmentation moves" << std::endl;
+    text << "# FROM " << mPack.filename() << std::endl;
+    text << "# " << mBlocksMoved << " of " << mTotalBlocks;
+    text << " blocks moved" << std::endl;
+
+    text << std::hex << std::uppercase << std::setfill('0');
+    for (i = 0; i < mMoves.size(); i++)
+    {
+        if (mMoves[i].from == ERASE_BLOCK)
+        {
+            text << "ERASE 0x" << (mMoves[i].to * PACK_BLOCK_SIZE) << std::endl;
+            continue;
+        }
+        if (mMoves[i].to == NO_BLOCK)
+            text << "SAVE 0x" << (mMoves[i].from * PACK_BLOCK_SIZE);
+        else if (mMoves[i].from == NO_BLOCK)
+            text << "RESTORE 0x" << (mMoves[i].to * PACK_BLOCK_SIZE);
+        else
+        {
+            text << "MOVE 0x" << (mMoves[i].from * PACK_BLOCK_SIZE);
+            text << " 0x" << (mMoves[i].to * PACK_BLOCK_SIZE);
+        }
+        text << std::endl;
+
+        /* Header windows that belong in the block just written */
+        for (w = 0; (mMoves[i].to != NO_BLOCK) && (w < mWindows.size()); w++)
+        {
+            if ((mWindows[w] / PACK_BLOCK_SIZE) != mMoves[i].to)
+                continue;
+            text << "WINDOW 0x" << mWindows[w] << " ";
+            for (b = 0; b < PACK_HEADER_SIZE; b++)
+                text << std::setw(2) << (uint32_t)mImage[mWindows[w] + b];
+            text << std::endl;
+        } /* End for */
+    } /* End for */
+    text << "END" << std::endl;
+    return text.str();
+}
+
+bool DefragPlanner::write(const char *imageFile) const
+{
+    std::string text = moveList();
+
+    return writeImageFile(imageFile, &mImage[0], mImage.size()) &&
+        writeImageFile(std::string(imageFile) + ".moves",
+            reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
@@ -0,0 +1,98 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __DEFRAG_H__
+#define __DEFRAG_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "pack.h"
+
+/* Rearranges an analyzed pack so every content sits on consecutive
+ * blocks and the free blocks form a single extent, moving as few
+ * blocks as possible. Each content keeps its blocks in allocation
+ * order; contents sharing blocks move together as one unit.
+ *
+ * Moving whole blocks leaves each content's byte sum alone and the
+ * checksum never covers the header window, so only blockAlloc needs
+ * rewriting for the checksums to hold. Free blocks come out erased,
+ * including any unclaimed data they held. Only layouts packscan can
+ * read back are considered: headers stay in the blocks it probes, and
+ * claimed blocks in the ones blockAlloc can claim. */
+class DefragPlanner {
+public:
+    typedef struct {
+        uint32_t from;          /* Block numbers; NO_BLOCK is host memory,
+                                 * ERASE_BLOCK just erases to */
+        uint32_t to;
+    } Move_t;
+
+    static const uint32_t NO_BLOCK = 0xFFFFFFFF;
+    static const uint32_t ERASE_BLOCK = 0xFFFFFFFE;
+
+    /* Orders of units tried exhaustively; more than this and contents
+     * keep their current order, with the free extent put wherever it
+     * costs least */
+    static const uint32_t MAX_EXHAUSTIVE = 20;
+
+    /* The pack must be analyzed, and stay around while planning */
+    DefragPlanner(const Pack &pack);
+    const std::string &errorMessage(void) const { return mErrorMessage; }
+
+    bool plan(void);
+
+    /* The defragmented pack */
+    const std::vector<uint8_t> &image(void) const { return mImage; }
+
+    /* Block moves in an order that can be carried out in place: no
+     * block is overwritten while its data is still to be moved. Cycles
+     * go through a free block, or host memory when there is none.
+     * Blocks whose header changes without moving come next, as moves
+     * onto themselves, then erases of the blocks left free that still
+     * hold anything. */
+    const std::vector<Move_t> &moves(void) const { return mMoves; }
+    uint32_t blocksMoved(void) const { return mBlocksMoved; }
+
+    /* The image to imageFile and the moves to imageFile + ".moves".
+     * Each MOVE (erase the destination, copy the block) is followed by
+     * the header windows, as WINDOW lines of hex bytes, to put in the
+     * block before it is written. ERASE lines erase a block. */
+    bool write(const char *imageFile) const;
+
+private:
+    typedef struct {
+        std::vector<uint32_t> blocks;   /* In allocation order */
+        uint32_t headerAt;              /* Bit K: blocks[K] holds a header */
+        uint32_t claimedAt;             /* Bit K: blockAlloc claims blocks[K] */
+    } Unit_t;
+
+    void findUnits(void);
+    uint32_t cost(const uint32_t unit, const uint32_t start) const;
+    bool searchExhaustive(std::vector<uint32_t> *order, uint32_t *gapAt);
+    bool searchInOrder(std::vector<uint32_t> *order, uint32_t *gapAt);
+    void orderMoves(const std::vector<uint32_t> &target);
+    bool replayMoves(void) const;
+    std::string moveList(void) const;
+
+    const Pack &mPack;
+    uint32_t mTotalBlocks;
+    uint32_t mHeaderBlocks;             /* Where headers can be found */
+    uint32_t mClaimableBlocks;          /* What blockAlloc can claim */
+    uint32_t mFreeBlocks;
+    std::vector<Unit_t> mUnits;
+    std::vector<uint8_t> mImage;
+    std::vector<uint32_t> mWindows;     /* New address of each header */
+    std::vector<Move_t> mMoves;
+    uint32_t mBlocksMoved;
+    std::string mErrorMessage;
+};
+
+#endif /* __DEFRAG_H__ */
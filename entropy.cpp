@@ -0,0 +1,86 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <math.h>
+#include "entropy.h"
+
+void byteHistogram(const uint8_t *data, const size_t len, uint32_t *hist)
+{
+    /* Four interleaved sub-histograms. Runs of the same byte value
+     * (very common in padding and graphics) would otherwise make every
+     * increment wait on the store of the previous one. */
+    uint32_t sub[4][256];
+    uint64_t a = 0, b = 0;
+    size_t i = 0;
+    uint32_t x = 0;
+
+    memset(sub, 0, sizeof(sub));
+
+    for (i = 0; (i + 16) <= len; i += 16)
+    {
+        memcpy(&a, data + i, sizeof(a));
+        memcpy(&b, data + i + 8, sizeof(b));
+
+        for (x = 0; x < 64; x += 16)
+        {
+            sub[0][(a >> x) & 0xFF]++;
+            sub[1][(a >> (x + 8)) & 0xFF]++;
+            sub[2][(b >> x) & 0xFF]++;
+            sub[3][(b >> (x + 8)) & 0xFF]++;
+        } /* End for */
+    } /* End for */
+
+    for (; i < len; i++)
+        sub[0][data[i]]++;
+
+    for (x = 0; x < 256; x++)
+        hist[x] += sub[0][x] + sub[1][x] + sub[2][x] + sub[3][x];
+}
+
+float histogramEntropy(const uint32_t *hist, const uint32_t total)
+{
+    double sum = 0.0;
+    uint32_t x = 0;
+
+    if (total == 0) return 0.0f;
+
+    /* H = log2(N) - (1/N) * sum(c * log2(c)) */
+    for (x = 0; x < 256; x++)
+        if (hist[x] > 1)
+            sum += hist[x] * log2((double)hist[x]);
+
+    return (float)(log2((double)total) - (sum / total));
+}
+
+char classifyPage(const uint32_t *hist, const uint32_t total,
+    const float entropy)
+{
+    uint32_t text = 0;
+    uint32_t x = 0;
+
+    if (hist[0xFF] == total)
+        return PROFILE_ERASED;
+    if (entropy < 1.0f)
+        return PROFILE_PADDING;
+    if (entropy > 7.2f)
+        return PROFILE_COMPRESSED;
+
+    /* Printable ASCII, line breaks and Shift-JIS lead/trail ranges */
+    text = hist[0x0A] + hist[0x0D];
+    for (x = 0x20; x < 0x7F; x++) text += hist[x];
+    for (x = 0x81; x < 0xA0; x++) text += hist[x];
+    for (x = 0xE0; x < 0xF0; x++) text += hist[x];
+
+    if ((text * 10) >= (total * 9))
+        return PROFILE_TEXT;
+
+    return PROFILE_CODE;
+}
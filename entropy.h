@@ -0,0 +1,34 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __ENTROPY_H__
+#define __ENTROPY_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/* Page classes used in the entropy profile */
+#define PROFILE_ERASED     '.'  /* All 0xFF */
+#define PROFILE_PADDING    '_'  /* Almost a single repeated byte */
+#define PROFILE_TEXT       't'  /* Mostly ASCII/Shift-JIS text */
+#define PROFILE_CODE       'c'  /* Code, tables, uncompressed graphics */
+#define PROFILE_COMPRESSED 'Z'  /* Compressed or encrypted data */
+
+/* Add the byte counts of data[0..len) to hist[256]. */
+extern void byteHistogram(const uint8_t *data, const size_t len, uint32_t *hist);
+
+/* Shannon entropy of a histogram, in bits per byte (0.0 to 8.0). */
+extern float histogramEntropy(const uint32_t *hist, const uint32_t total);
+
+/* Classify a page from its histogram and entropy. */
+extern char classifyPage(const uint32_t *hist, const uint32_t total,
+    const float entropy);
+
+#endif /* __ENTROPY_H__ */
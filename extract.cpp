@@ -0,0 +1,275 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <iostream>
+#include "extract.h"
+
+/* Bytes of the dump's name kept in an extracted file's name */
+#define MAX_SOURCE_NAME 128
+
+/* Most copies of one name made before giving up */
+#define MAX_COPIES 1000
+
+/* How copyRun() moves bytes, best first. Each falls back to the next
+ * when the kernel or filesystem won't do it. */
+enum {
+    COPY_RANGE = 0,     /* copy_file_range(), in-kernel or reflinked */
+    COPY_SENDFILE,      /* sendfile(), in-kernel */
+    COPY_WRITE          /* write() from the pack's data */
+};
+
+ContentExtractor::ContentExtractor(const char *directory) :
+    mDirectory(directory), mDirFd(-1)
+{
+    mDirFd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mDirFd == -1)
+    {
+        std::cout << "Unable to open extraction directory '" << directory;
+        std::cout << "': " << strerror(errno) << std::endl;
+    }
+}
+
+ContentExtractor::~ContentExtractor()
+{
+    if (mDirFd != -1) close(mDirFd);
+}
+
+/* Anything that isn't safe or pleasant in a file name becomes '_' */
+static void appendSafe(std::string *name, const char *text, const size_t length)
+{
+    size_t i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        if ( ((uint8_t)text[i] < 0x20) || (text[i] == '/') ||
+            (text[i] == ' ') || (text[i] == ':') || (text[i] == '\\') )
+            name->push_back('_');
+        else
+            name->push_back(text[i]);
+    } /* End for */
+}
+
+std::string ContentExtractor::fileName(const Pack &pack,
+    const Pack::Header_t &header)
+{
+    const std::string &source = pack.filename();
+    size_t start = 0, end = source.size(), member = 0, slash = 0;
+    char title[PACK_TITLE_UTF8];
+    char address[16];
+    std::string name;
+    size_t length = 0;
+
+    /* Drop the directory, but keep "<archive>:<member>" together */
+    member = source.find(':');
+    slash = source.rfind('/', member);
+    if (slash != std::string::npos)
+        start = slash + 1;
+
+    /* ...and the extension of whatever is left */
+    end = source.rfind('.');
+    if ( (end == std::string::npos) || (end <= start) ||
+        (source.find_first_of("/:", end) != std::string::npos) )
+        end = source.size();
+
+    /* Leave room for the rest under NAME_MAX; the end says the most */
+    if ((end - start) > MAX_SOURCE_NAME)
+    {
+        start = end - MAX_SOURCE_NAME;
+        while ((start < end) && (((uint8_t)source[start] & 0xC0) == 0x80))
+            start++;
+    }
+    appendSafe(&name, source.data() + start, end - start);
+
+    snprintf(address, sizeof(address), "_%06X_", header.address);
+    name += address;
+
+    /* Titles are space padded */
+    Pack::decodeTitle(&header, title);
+    length = strlen(title);
+    while (length && (title[length - 1] == ' '))
+        length--;
+    if (length)
+        appendSafe(&name, title, length);
+    else
+        name += "untitled";
+
+    return name + ".bs";
+}
+
+/* Dumps in different directories, or the same dump extracted twice,
+ * can want the same name; nothing already there is ever overwritten. A
+ * name that is taken gets "-2", "-3" and so on before the extension. */
+int ContentExtractor::createUnique(std::string *name) const
+{
+    const std::string stem = name->substr(0, name->size() - 3);
+    char suffix[16];
+    uint32_t copy = 1;
+    int fd = -1;
+
+    for (;;)
+    {
+        fd = openat(mDirFd, name->c_str(),
+            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if ((fd != -1) || (errno != EEXIST) || (copy >= MAX_COPIES))
+            return fd;
+
+        snprintf(suffix, sizeof(suffix), "-%u.bs", ++copy);
+        *name = stem + suffix;
+    } /* End for */
+}
+
+bool ContentExtractor::copyRun(const int source, const int target,
+    const uint8_t *data, uint64_t offset, uint64_t length, int *method) const
+{
+    off64_t from = 0;
+    off_t sendFrom = 0;
+    ssize_t bytes = 0;
+
+    while (length)
+    {
+        switch (*method)
+        {
+            case COPY_RANGE:
+                from = offset;
+                bytes = copy_file_range(source, &from, target, NULL, length, 0);
+                break;
+
+            case COPY_SENDFILE:
+                sendFrom = offset;
+                bytes = sendfile(target, source, &sendFrom, length);
+                break;
+
+            default:
+                if (!data)
+                {
+                    errno = ENODATA;
+                    return false;
+                }
+                bytes = write(target, data + offset, length);
+        } /* End switch */
+
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+
+        /* Not supported here; try the next way down */
+        if ( (bytes == -1) && (*method != COPY_WRITE) &&
+            ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) ||
+            (errno == EOPNOTSUPP) || (errno == EBADF)) )
+        {
+            (*method)++;
+            continue;
+        }
+
+        if (bytes <= 0)
+        {
+            /* The file got shorter; it isn't the dump we analyzed */
+            if (bytes == 0) errno = EIO;
+            return false;
+        }
+
+        offset += bytes;
+        length -= bytes;
+    } /* End while */
+
+    return true;
+}
+
+uint32_t ContentExtractor::extract(const Pack &pack) const
+{
+    uint32_t totalBlocks = pack.packSize() / PACK_BLOCK_SIZE;
+    uint32_t i = 0, x = 0, run = 0, bitmask = 0, extracted = 0;
+    int source = -1, target = -1;
+    int method = COPY_WRITE;
+    struct stat sourceStat;
+    std::string name;
+    bool ok = true;
+
+    if ((mDirFd == -1) || !pack.isLoaded() || !pack.headerCount())
+        return 0;
+
+    /* Copy from the dump itself when it is the pack byte for byte */
+    source = open(pack.filename().c_str(), O_RDONLY | O_CLOEXEC);
+    if (source != -1)
+    {
+        if ( (fstat(source, &sourceStat) == 0) && S_ISREG(sourceStat.st_mode) &&
+            ((uint64_t)sourceStat.st_size == (uint64_t)pack.packSize()) )
+            method = COPY_RANGE;
+        else
+        {
+            close(source);
+            source = -1;
+        }
+    }
+
+    if ((source == -1) && !pack.data())
+    {
+        std::cout << "Unable to extract from '" << pack.filename();
+        std::cout << "': its data isn't available" << std::endl;
+        return 0;
+    }
+
+    for (i = 0; i < pack.headerCount(); i++)
+    {
+        const Pack::Header_t &header = pack.header(i);
+
+        name = fileName(pack, header);
+        target = createUnique(&name);
+        if (target == -1)
+        {
+            std::cout << "Unable to create '" << mDirectory << "/" << name;
+            std::cout << "': " << strerror(errno) << std::endl;
+            continue;
+        }
+
+        /* Consecutive allocated blocks go over in one call */
+        bitmask = pack.blockMask(&header);
+        ok = true;
+        for (x = 0; ok && (x < totalBlocks); x += run)
+        {
+            run = 1;
+            if ( !((bitmask >> x) & 0x1) )
+                continue;
+            while ( ((x + run) < totalBlocks) && ((bitmask >> (x + run)) & 0x1) )
+                run++;
+
+            ok = copyRun(source, target, pack.data(),
+                (uint64_t)x * PACK_BLOCK_SIZE, (uint64_t)run * PACK_BLOCK_SIZE,
+                &method);
+        } /* End for */
+
+        /* The descriptor is gone after close() even when it fails */
+        if (ok)
+        {
+            ok = (close(target) == 0);
+            target = -1;
+        }
+
+        if (!ok)
+        {
+            std::cout << "Unable to write '" << mDirectory << "/" << name;
+            std::cout << "': " << strerror(errno) << std::endl;
+            if (target != -1) close(target);
+            unlinkat(mDirFd, name.c_str(), 0);
+            continue;
+        }
+        extracted++;
+    } /* End for */
+
+    /* Done! */
+    if (source != -1) close(source);
+    return extracted;
+}
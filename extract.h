@@ -0,0 +1,51 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __EXTRACT_H__
+#define __EXTRACT_H__
+
+#include <string>
+#include <cstdint>
+#include "pack.h"
+
+/* Writes each content of a pack to its own .bs file: the content's
+ * allocated blocks, in block order, with nothing in between. Files are
+ * named "<dump>_<header address>_<title>.bs" so a whole corpus can
+ * share one directory. Files are always created new: a name that is
+ * already taken gets "-2", "-3" and so on before the extension.
+ *
+ * When the dump is a plain file on disk, runs of consecutive blocks are
+ * copied from it by the kernel (copy_file_range(), which can share the
+ * extents outright on reflink filesystems, or sendfile()), so nothing
+ * passes through user space. Compressed dumps and archive members are
+ * written from the pack's data instead. Safe to use from several
+ * threads at once. */
+class ContentExtractor {
+public:
+    ContentExtractor(const char *directory);
+    ~ContentExtractor();
+    bool isLoaded(void) const { return (mDirFd != -1); }
+
+    /* Number of contents written. Problems are printed. */
+    uint32_t extract(const Pack &pack) const;
+
+    /* Title and dump name reduced to something safe in a file name */
+    static std::string fileName(const Pack &pack, const Pack::Header_t &header);
+
+private:
+    int createUnique(std::string *name) const;
+    bool copyRun(const int source, const int target, const uint8_t *data,
+        uint64_t offset, uint64_t length, int *method) const;
+
+    std::string mDirectory;
+    int mDirFd;
+};
+
+#endif /* __EXTRACT_H__ */
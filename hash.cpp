@@ -0,0 +1,87 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include "hash.h"
+
+uint64_t hash64(const void *data, const size_t len, const uint64_t seed)
+{
+    const uint64_t m = 0xC6A4A7935BD1E995ULL;
+    const int r = 47;
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    const uint8_t *end = ptr + (len & ~(size_t)7);
+    uint64_t h = seed ^ (len * m);
+    uint64_t k = 0;
+
+    /* Mix in eight bytes at a time */
+    while (ptr != end)
+    {
+        memcpy(&k, ptr, sizeof(k));
+        ptr += sizeof(k);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    } /* End while */
+
+    /* Mix in the remaining tail bytes */
+    switch (len & 7)
+    {
+        case 7: h ^= (uint64_t)ptr[6] << 48; /* Fall through */
+        case 6: h ^= (uint64_t)ptr[5] << 40; /* Fall through */
+        case 5: h ^= (uint64_t)ptr[4] << 32; /* Fall through */
+        case 4: h ^= (uint64_t)ptr[3] << 24; /* Fall through */
+        case 3: h ^= (uint64_t)ptr[2] << 16; /* Fall through */
+        case 2: h ^= (uint64_t)ptr[1] << 8;  /* Fall through */
+        case 1: h ^= (uint64_t)ptr[0];
+                h *= m;
+        default:
+                break;
+    } /* End switch */
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/* Reflected polynomial 0xEDB88320, one table lookup per byte */
+class Crc32Table {
+public:
+    Crc32Table(void)
+    {
+        uint32_t i = 0, bit = 0, value = 0;
+
+        for (i = 0; i < 256; i++)
+        {
+            value = i;
+            for (bit = 0; bit < 8; bit++)
+                value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+            entry[i] = value;
+        } /* End for */
+    }
+
+    uint32_t entry[256];
+};
+
+uint32_t crc32(const uint32_t crc, const void *data, const size_t len)
+{
+    static const Crc32Table table;
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    const uint8_t *end = ptr + len;
+    uint32_t value = ~crc;
+
+    while (ptr != end)
+        value = table.entry[(value ^ *ptr++) & 0xFF] ^ (value >> 8);
+    return ~value;
+}
@@ -0,0 +1,26 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/* 64-bit non-cryptographic hash (MurmurHash64A). Used to fingerprint
+ * pages, blocks and whole contents, so it must stay stable across
+ * releases: prebuilt index files depend on it. */
+extern uint64_t hash64(const void *data, const size_t len, const uint64_t seed);
+
+/* CRC-32 as used by gzip and ZIP. Pass 0 to start, then the previous
+ * result to continue over the next piece of the same data. */
+extern uint32_t crc32(const uint32_t crc, const void *data, const size_t len);
+
+#endif /* __HASH_H__ */
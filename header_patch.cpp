@@ -0,0 +1,417 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sstream>
+#include "header_patch.h"
+#include "util.h"
+
+const uint32_t HeaderPatcher::ALL_HEADERS;
+const uint32_t HeaderPatcher::STARTS_UNLIMITED;
+
+static std::string hexAddress(const uint32_t address)
+{
+    std::ostringstream text;
+
+    text << "0x" << std::hex << std::uppercase << address;
+    return text.str();
+}
+
+bool HeaderPatcher::parse(const char *spec, Patch_t *patch, std::string *error)
+{
+    std::string text(spec);
+    std::string name, value;
+    size_t equals = text.find('=');
+    size_t at = std::string::npos;
+    long number = 0;
+    uint32_t i = 0;
+
+    patch->address = ALL_HEADERS;
+    patch->value = 0;
+    patch->bytes.clear();
+    *error = "";
+
+    if (equals == std::string::npos)
+    {
+        *error = "expected FIELD[@ADDRESS]=VALUE";
+        return false;
+    }
+    name = text.substr(0, equals);
+    value = text.substr(equals + 1);
+
+    /* Without an address, every header in the dump is patched */
+    at = name.find('@');
+    if (at != std::string::npos)
+    {
+        if (!parseNumber(name.substr(at + 1), 0, &number) || (number < 0) ||
+            (number >= Pack::SIZE_32M))
+        {
+            *error = "bad address \"" + name.substr(at + 1) + "\"";
+            return false;
+        }
+        patch->address = (uint32_t)number;
+        name = name.substr(0, at);
+    }
+
+    if (name == "title")
+    {
+        patch->field = FIELD_TITLE;
+        if (value.size() > 16)
+            *error = "titles are at most 16 characters";
+        for (i = 0; i < value.size(); i++)
+            if ((value[i] < 0x20) || (value[i] > 0x7E))
+                *error = "titles must be printable ASCII";
+        value.resize(16, ' ');
+        patch->bytes.assign(value.begin(), value.end());
+    }
+    else if (name == "starts")
+    {
+        patch->field = FIELD_STARTS;
+        if (value == "unlimited")
+            patch->value = STARTS_UNLIMITED;
+        else if (!parseNumber(value, 10, &number) || (number < 0) ||
+            (number > 31))
+            *error = "\"starts\" needs 0-31 or \"unlimited\"";
+        else
+            patch->value = number;
+    }
+    else if (name == "intro")
+    {
+        patch->field = FIELD_INTRO;
+        if ((value != "on") && (value != "off"))
+            *error = "\"intro\" needs \"on\" or \"off\"";
+        patch->value = (value == "on");
+    }
+    else if (name == "maker")
+    {
+        patch->field = FIELD_MAKER;
+        if (!parseNumber(value, 16, &number) || ((number != 0x00) &&
+            (number != 0x33) && (number != 0xFF)))
+            *error = "\"maker\" needs 00, 33 or FF";
+        else
+            patch->value = number;
+    }
+    else if (name == "date")
+    {
+        long month = 0;
+        long day = 0;
+        size_t slash = value.find('/');
+
+        patch->field = FIELD_DATE;
+        if ((slash == std::string::npos) ||
+            !parseNumber(value.substr(0, slash), 10, &month) ||
+            !parseNumber(value.substr(slash + 1), 10, &day) ||
+            (month < 1) || (month > 12) || (day < 1) || (day > 31))
+            *error = "\"date\" needs MONTH/DAY";
+        else
+            patch->value = (month << 8) | day;
+    }
+    else if (name == "bytes")
+    {
+        patch->field = FIELD_BYTES;
+        if (patch->address == ALL_HEADERS)
+            *error = "\"bytes\" needs an @ADDRESS";
+        else if (value.empty() || (value.size() % 2))
+            *error = "\"bytes\" needs pairs of hex digits";
+        for (i = 0; error->empty() && (i < value.size()); i += 2)
+        {
+            if (!parseNumber(value.substr(i, 2), 16, &number) ||
+                !isxdigit((unsigned char)value[i]))
+                *error = "\"bytes\" needs pairs of hex digits";
+            else
+                patch->bytes.push_back((uint8_t)number);
+        } /* End for */
+    }
+    else
+        *error = "unknown field \"" + name + "\"";
+
+    return error->empty();
+}
+
+HeaderPatcher::HeaderPatcher(const std::vector<Patch_t> &patches) :
+    mPatches(patches), mBytesChanged(0), mChecksumsUpdated(0)
+{
+}
+
+void HeaderPatcher::applyField(const Patch_t &patch, uint8_t *window)
+{
+    switch (patch.field)
+    {
+        case FIELD_TITLE:
+            memcpy(&window[0x10], &patch.bytes[0], 16);
+            break;
+
+        case FIELD_STARTS:
+            /* Bit 7 limits the starts, bits 2-6 count them down */
+            if (patch.value == STARTS_UNLIMITED)
+                window[0x25] &= 0x7F;
+            else
+                window[0x25] = (window[0x25] & 0x03) | 0x80 |
+                    ((patch.value & 0x1F) << 2);
+            break;
+
+        case FIELD_INTRO:
+            /* The bit is set to skip the intro */
+            if (patch.value)
+                window[0x29] &= 0x7F;
+            else
+                window[0x29] |= 0x80;
+            break;
+
+        case FIELD_MAKER:
+            window[0x2A] = patch.value;
+            break;
+
+        case FIELD_DATE:
+            window[0x26] = (window[0x26] & 0x0F) | ((patch.value >> 8) << 4);
+            window[0x27] = (window[0x27] & 0x07) | ((patch.value & 0x1F) << 3);
+            break;
+
+        default:
+            break;
+    } /* End switch */
+}
+
+bool HeaderPatcher::patch(const char *filename)
+{
+    struct stat info;
+    void *map = NULL;
+    bool result = false;
+    int fd = -1;
+
+    mBytesChanged = 0;
+    mChecksumsUpdated = 0;
+
+    fd = open(filename, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+    {
+        mErrorMessage = "Unable to open '" + std::string(filename) + "': " +
+            strerror(errno);
+        return false;
+    }
+
+    /* Compressed dumps and archive members have nothing to map */
+    if ((fstat(fd, &info) == -1) || !S_ISREG(info.st_mode) ||
+        ((info.st_size != Pack::SIZE_8M) && (info.st_size != Pack::SIZE_32M)))
+    {
+        mErrorMessage = "'" + std::string(filename) +
+            "' is not an uncompressed 8M or 32M dump";
+        close(fd);
+        return false;
+    }
+
+    map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        mErrorMessage = "Unable to map '" + std::string(filename) + "': " +
+            strerror(errno);
+        return false;
+    }
+
+    /* Only the pages that change are dirtied and written back */
+    result = patch(static_cast<uint8_t *>(map), info.st_size, filename);
+    munmap(map, info.st_size);
+    return result;
+}
+
+bool HeaderPatcher::patch(uint8_t *data, const size_t size, const char *name)
+{
+    Pack pack(data, size, name);
+    std::vector<uint8_t> windows;
+    std::vector<uint16_t> deltas;
+    std::vector<uint16_t> windowDeltas;
+    std::vector<std::pair<uint32_t, uint8_t> > undo;
+    uint32_t headerCount = 0;
+    uint32_t address = 0;
+    uint32_t block = 0;
+    uint16_t crc = 0;
+    uint16_t inverse = 0;
+    uint8_t *window = NULL;
+    bool found = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t h = 0;
+    uint32_t g = 0;
+    uint32_t round = 0;
+    uint16_t total = 0;
+    bool settled = false;
+
+    mBytesChanged = 0;
+    mChecksumsUpdated = 0;
+    mErrorMessage = "";
+
+    if (!pack.isLoaded())
+    {
+        mErrorMessage = pack.errorMessage();
+        return false;
+    }
+    pack.findHeaders();
+    headerCount = pack.headerCount();
+
+    /* Check every patch before anything is changed */
+    for (i = 0; i < mPatches.size(); i++)
+    {
+        const Patch_t &patch = mPatches[i];
+
+        if (patch.field == FIELD_BYTES)
+        {
+            if (((uint64_t)patch.address + patch.bytes.size()) > size)
+            {
+                mErrorMessage = "Bytes at " + hexAddress(patch.address) +
+                    " run past the end of '" + pack.filename() + "'";
+                return false;
+            }
+
+            /* Windows have fields of their own, and no place in a sum */
+            for (h = 0; h < headerCount; h++)
+            {
+                address = pack.header(h).address;
+                if ((patch.address < (address + PACK_HEADER_SIZE)) &&
+                    ((patch.address + patch.bytes.size()) > address))
+                {
+                    mErrorMessage = "Bytes at " + hexAddress(patch.address) +
+                        " overlap the header at " + hexAddress(address) +
+                        " in '" + pack.filename() + "'";
+                    return false;
+                }
+            } /* End for */
+        }
+        else if (patch.address != ALL_HEADERS)
+        {
+            found = false;
+            for (h = 0; h < headerCount; h++)
+                if (pack.header(h).address == patch.address)
+                    found = true;
+            if (!found)
+            {
+                mErrorMessage = "No header at " + hexAddress(patch.address) +
+                    " in '" + pack.filename() + "'";
+                return false;
+            }
+        }
+    } /* End for */
+
+    windows.resize(headerCount * PACK_HEADER_SIZE);
+    deltas.assign(headerCount, 0);
+    for (h = 0; h < headerCount; h++)
+        memcpy(&windows[h * PACK_HEADER_SIZE], &data[pack.header(h).address],
+            PACK_HEADER_SIZE);
+
+    for (i = 0; i < mPatches.size(); i++)
+    {
+        const Patch_t &patch = mPatches[i];
+
+        if (patch.field != FIELD_BYTES)
+        {
+            for (h = 0; h < headerCount; h++)
+                if ((patch.address == ALL_HEADERS) ||
+                    (patch.address == pack.header(h).address))
+                    applyField(patch, &windows[h * PACK_HEADER_SIZE]);
+            continue;
+        }
+
+        /* A byte counts toward every content whose blocks hold it */
+        for (j = 0; j < patch.bytes.size(); j++)
+        {
+            address = patch.address + j;
+            if (data[address] == patch.bytes[j])
+                continue;
+
+            block = address / PACK_BLOCK_SIZE;
+            for (h = 0; h < headerCount; h++)
+                if ((pack.blockMask(&pack.header(h)) >> block) & 0x1)
+                    deltas[h] += patch.bytes[j] - data[address];
+            undo.push_back(std::make_pair(address, data[address]));
+            data[address] = patch.bytes[j];
+            mBytesChanged++;
+        } /* End for */
+    } /* End for */
+
+    /* A content's sum leaves out its own window, but not the windows of
+     * others its blocks hold (overlapping allocations). Their changes,
+     * checksums included, count like patched bytes; that settles within
+     * a pass per header unless the windows hold each other's checksums
+     * and those were already off. */
+    windowDeltas.assign(headerCount, 0);
+    for (round = 0, settled = false; !settled; round++)
+    {
+        if (round > headerCount)
+        {
+            for (j = undo.size(); j > 0; j--)
+                data[undo[j - 1].first] = undo[j - 1].second;
+            mBytesChanged = 0;
+            mErrorMessage = "Checksums of the overlapping contents in '" +
+                pack.filename() + "' can't be kept in step";
+            return false;
+        }
+
+        for (g = 0; g < headerCount; g++)
+        {
+            windowDeltas[g] = 0;
+            for (j = 0; j < PACK_HEADER_SIZE; j++)
+                windowDeltas[g] += windows[(g * PACK_HEADER_SIZE) + j] -
+                    data[pack.header(g).address + j];
+        } /* End for */
+
+        settled = true;
+        for (h = 0; h < headerCount; h++)
+        {
+            total = deltas[h];
+            for (g = 0; g < headerCount; g++)
+                if ( (g != h) && ((pack.blockMask(&pack.header(h)) >>
+                    (pack.header(g).address / PACK_BLOCK_SIZE)) & 0x1) )
+                    total += windowDeltas[g];
+
+            /* The checksum and its inverse move the same way as the sum */
+            address = pack.header(h).address;
+            window = &windows[h * PACK_HEADER_SIZE];
+            crc = (data[address + 0x2E] | (data[address + 0x2F] << 8)) + total;
+            inverse = (data[address + 0x2C] | (data[address + 0x2D] << 8)) - total;
+            if ( (window[0x2C] != (inverse & 0xFF)) ||
+                (window[0x2D] != (inverse >> 8)) ||
+                (window[0x2E] != (crc & 0xFF)) || (window[0x2F] != (crc >> 8)) )
+            {
+                window[0x2C] = inverse & 0xFF;
+                window[0x2D] = inverse >> 8;
+                window[0x2E] = crc & 0xFF;
+                window[0x2F] = crc >> 8;
+                settled = false;
+            }
+        } /* End for */
+    } /* End for */
+
+    for (h = 0; h < headerCount; h++)
+    {
+        window = &windows[h * PACK_HEADER_SIZE];
+        address = pack.header(h).address;
+        if (memcmp(&window[0x2C], &data[address + 0x2C], 4))
+            mChecksumsUpdated++;
+
+        for (j = 0; j < PACK_HEADER_SIZE; j++)
+        {
+            if (data[address + j] != window[j])
+            {
+                data[address + j] = window[j];
+                mBytesChanged++;
+            }
+        } /* End for */
+    } /* End for */
+
+    /* Done! */
+    return true;
+}
@@ -0,0 +1,78 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __HEADER_PATCH_H__
+#define __HEADER_PATCH_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "pack.h"
+
+/* Edits header fields (and, if need be, content bytes) of dumps in
+ * place, keeping each content's checksum and inverse in step.
+ *
+ * Only the header windows and the patched bytes are ever read, so a
+ * dump is never summed. A content's checksum leaves out its own header
+ * window, so its own fields don't move it. Patched content bytes move
+ * it by their byte deltas, for every content whose blocks hold them,
+ * and so do changes to another content's window held in its blocks
+ * (overlapping allocations), that window's checksum included. A
+ * checksum that was already off stays off by the same amount. */
+class HeaderPatcher {
+public:
+    enum Field_t {
+        FIELD_TITLE = 0,    /* Up to 16 ASCII characters, space padded */
+        FIELD_STARTS,       /* 0-31 boots, or unlimited */
+        FIELD_INTRO,        /* St. GIGA intro on or off (fileType bit 7) */
+        FIELD_MAKER,        /* 00, 33 or FF */
+        FIELD_DATE,         /* Month/day */
+        FIELD_BYTES         /* Hex bytes at an address outside any window */
+    };
+
+    static const uint32_t ALL_HEADERS = 0xFFFFFFFF;
+    static const uint32_t STARTS_UNLIMITED = 0xFFFFFFFF;
+
+    typedef struct {
+        Field_t field;
+        uint32_t address;           /* Header window, or ALL_HEADERS; the
+                                     * first byte for FIELD_BYTES */
+        uint32_t value;
+        std::vector<uint8_t> bytes; /* FIELD_TITLE and FIELD_BYTES */
+    } Patch_t;
+
+    /* "FIELD[@ADDRESS]=VALUE", as --set takes it */
+    static bool parse(const char *spec, Patch_t *patch, std::string *error);
+
+    HeaderPatcher(const std::vector<Patch_t> &patches);
+    const std::string &errorMessage(void) const { return mErrorMessage; }
+
+    /* Patch an uncompressed dump through a shared writable mapping */
+    bool patch(const char *filename);
+
+    /* Patch a dump in memory. Nothing is changed unless every patch
+     * applies: a header address must hold a header, and FIELD_BYTES
+     * must stay in the pack and out of the header windows. */
+    bool patch(uint8_t *data, const size_t size, const char *name);
+
+    /* Bytes changed and checksums updated by the last patch() */
+    uint32_t bytesChanged(void) const { return mBytesChanged; }
+    uint32_t checksumsUpdated(void) const { return mChecksumsUpdated; }
+
+private:
+    static void applyField(const Patch_t &patch, uint8_t *window);
+
+    std::vector<Patch_t> mPatches;
+    uint32_t mBytesChanged;
+    uint32_t mChecksumsUpdated;
+    std::string mErrorMessage;
+};
+
+#endif /* __HEADER_PATCH_H__ */
@@ -0,0 +1,676 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <vector>
+#include "inflate.h"
+#include "hash.h"
+
+#define WINDOW_SIZE 0x8000  /* Farthest a DEFLATE match can reach back */
+#define FLUSH_SIZE  0x40000 /* Output handed to the sink at a time */
+#define MAX_MATCH   258
+#define MAX_BITS    15      /* Longest Huffman code */
+#define FAST_BITS   10      /* Codes this short decode with one lookup */
+
+/* gzip header flags */
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+static const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577
+};
+static const uint8_t DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* Order in which code length code lengths are sent */
+static const uint8_t CODE_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef struct {
+    uint16_t count[MAX_BITS + 1];   /* Number of codes of each length */
+    uint16_t symbol[288];           /* Symbols in canonical code order */
+    uint16_t fast[1 << FAST_BITS];  /* (length << 9) | symbol, indexed by
+                                     * the next FAST_BITS input bits; 0
+                                     * when the code is longer */
+} Huffman_t;
+
+class Inflater {
+public:
+    Inflater(const uint8_t *data, const size_t length, const InflateSink_t &sink);
+    bool run(const Compression_t format);
+    const std::string &error(void) const { return mError; }
+    size_t consumed(void) const { return mPos; }
+
+private:
+    bool fail(const std::string &reason);
+    void refill(void);
+    uint32_t bits(const uint32_t count);
+    void alignToByte(void);
+    bool truncated(void) const;
+    int decode(const Huffman_t &huffman);
+    static int build(Huffman_t *huffman, const uint8_t *lengths, const uint32_t count);
+    bool room(const size_t length);
+    bool flush(void);
+    bool deflate(void);
+    bool stored(void);
+    bool dynamic(void);
+    bool codes(const Huffman_t &lengthCode, const Huffman_t &distCode);
+    bool gzipMember(void);
+    bool zlibStream(void);
+
+    const uint8_t *mIn;
+    size_t mLength;
+    size_t mPos;                /* Next input byte to load into mBits */
+    size_t mPadding;            /* Zero bytes loaded past the end */
+    uint64_t mBits;             /* Input bits not yet used, LSB first */
+    uint32_t mBitCount;
+    const InflateSink_t &mSink;
+    Compression_t mFormat;
+    std::vector<uint8_t> mOut;  /* Window plus output not yet flushed */
+    size_t mOutPos;
+    size_t mFlushed;
+    uint64_t mProduced;         /* Output of the current stream */
+    uint32_t mCheck;            /* CRC-32 or Adler-32 of that output */
+    Huffman_t mFixedLength;
+    Huffman_t mFixedDist;
+    std::string mError;
+};
+
+Compression_t detectCompression(const uint8_t *data, const size_t length)
+{
+    if (length < 4)
+        return COMPRESSION_NONE;
+
+    if ((data[0] == 0x1F) && (data[1] == 0x8B) && (data[2] == 8))
+        return COMPRESSION_GZIP;
+    if ((data[0] == 0x28) && (data[1] == 0xB5) && (data[2] == 0x2F) &&
+        (data[3] == 0xFD))
+        return COMPRESSION_ZSTD;
+
+    /* Deflate method, 32 KB window or less, header checksum */
+    if (((data[0] & 0x0F) == 8) && ((data[0] >> 4) <= 7) &&
+        ((((data[0] << 8) | data[1]) % 31) == 0))
+        return COMPRESSION_ZLIB;
+
+    return COMPRESSION_NONE;
+}
+
+const char *compressionName(const Compression_t format)
+{
+    switch (format)
+    {
+        case COMPRESSION_DEFLATE: return "deflate";
+        case COMPRESSION_ZLIB:    return "zlib";
+        case COMPRESSION_GZIP:    return "gzip";
+        case COMPRESSION_ZSTD:    return "zstd";
+        default:                  return "none";
+    } /* End switch */
+}
+
+bool inflateStream(const uint8_t *data, const size_t length,
+    const Compression_t format, const InflateSink_t &sink, std::string *error,
+    size_t *consumed)
+{
+    Inflater inflater(data, length, sink);
+    bool ok = inflater.run(format);
+
+    if (!ok && error)
+        *error = inflater.error();
+    if (consumed)
+        *consumed = inflater.consumed();
+    return ok;
+}
+
+static uint32_t adler32(const uint32_t adler, const uint8_t *data, size_t length)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    size_t chunk = 0;
+
+    while (length)
+    {
+        /* Largest run that can't overflow b before the modulo */
+        chunk = (length < 5552) ? length : 5552;
+        length -= chunk;
+        while (chunk--)
+        {
+            a += *data++;
+            b += a;
+        } /* End while */
+        a %= 65521;
+        b %= 65521;
+    } /* End while */
+    return (b << 16) | a;
+}
+
+Inflater::Inflater(const uint8_t *data, const size_t length,
+    const InflateSink_t &sink) :
+    mIn(data), mLength(length), mPos(0), mPadding(0), mBits(0),
+    mBitCount(0), mSink(sink), mFormat(COMPRESSION_DEFLATE),
+    mOut(WINDOW_SIZE + FLUSH_SIZE), mOutPos(0), mFlushed(0), mProduced(0),
+    mCheck(0)
+{
+    uint8_t lengths[288];
+    uint32_t i = 0;
+
+    /* The fixed codes of RFC 1951 section 3.2.6 */
+    for (i = 0; i < 144; i++) lengths[i] = 8;
+    for (; i < 256; i++) lengths[i] = 9;
+    for (; i < 280; i++) lengths[i] = 7;
+    for (; i < 288; i++) lengths[i] = 8;
+    build(&mFixedLength, lengths, 288);
+    for (i = 0; i < 30; i++) lengths[i] = 5;
+    build(&mFixedDist, lengths, 30);
+}
+
+bool Inflater::fail(const std::string &reason)
+{
+    if (mError.empty())
+        mError = reason;
+    return false;
+}
+
+void Inflater::refill(void)
+{
+    /* Past the end, feed zeros and let truncated() notice */
+    while (mBitCount <= 56)
+    {
+        if (mPos < mLength)
+            mBits |= (uint64_t)mIn[mPos] << mBitCount;
+        else
+            mPadding++;
+        mPos++;
+        mBitCount += 8;
+    } /* End while */
+}
+
+uint32_t Inflater::bits(const uint32_t count)
+{
+    uint32_t value = 0;
+
+    if (mBitCount < count)
+        refill();
+    value = (uint32_t)(mBits & ((1U << count) - 1));
+    mBits >>= count;
+    mBitCount -= count;
+    return value;
+}
+
+/* Drop to the next byte boundary and hand whole unused bytes back, so
+ * mPos is the next byte to read directly */
+void Inflater::alignToByte(void)
+{
+    mBits >>= (mBitCount & 7);
+    mBitCount -= (mBitCount & 7);
+    mPos -= (mBitCount >> 3);
+    mPadding -= (mPadding < (mBitCount >> 3)) ? mPadding : (mBitCount >> 3);
+    mBits = 0;
+    mBitCount = 0;
+}
+
+bool Inflater::truncated(void) const
+{
+    /* Bytes still buffered in mBits weren't used yet */
+    return (mPadding > (mBitCount >> 3));
+}
+
+int Inflater::decode(const Huffman_t &huffman)
+{
+    uint32_t entry = 0;
+    uint32_t len = 0;
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    int count = 0;
+
+    if (mBitCount < MAX_BITS)
+        refill();
+
+    entry = huffman.fast[mBits & ((1 << FAST_BITS) - 1)];
+    if (entry)
+    {
+        mBits >>= (entry >> 9);
+        mBitCount -= (entry >> 9);
+        return entry & 0x1FF;
+    }
+
+    /* Longer code: walk the canonical code one bit at a time */
+    for (len = 1; len <= MAX_BITS; len++)
+    {
+        code |= (int)(mBits & 1);
+        mBits >>= 1;
+        mBitCount--;
+        count = huffman.count[len];
+        if (code - count < first)
+            return huffman.symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    } /* End for */
+    return -1;
+}
+
+/* Returns 0 for a complete code, more than 0 for an incomplete one and
+ * less than 0 for an over-subscribed one */
+int Inflater::build(Huffman_t *huffman, const uint8_t *lengths,
+    const uint32_t count)
+{
+    uint16_t offset[MAX_BITS + 1];
+    uint32_t next[MAX_BITS + 1];
+    uint32_t symbol = 0;
+    uint32_t len = 0;
+    uint32_t code = 0;
+    uint32_t reversed = 0;
+    uint32_t i = 0;
+    int left = 1;
+
+    memset(huffman->count, 0, sizeof(huffman->count));
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    for (symbol = 0; symbol < count; symbol++)
+        huffman->count[lengths[symbol]]++;
+    if (huffman->count[0] == count)
+        return 0;
+
+    for (len = 1; len <= MAX_BITS; len++)
+    {
+        left <<= 1;
+        left -= huffman->count[len];
+        if (left < 0)
+            return left;
+    } /* End for */
+
+    /* Canonical order: by length, then by symbol */
+    offset[1] = 0;
+    next[1] = 0;
+    for (len = 1; len < MAX_BITS; len++)
+    {
+        offset[len + 1] = offset[len] + huffman->count[len];
+        next[len + 1] = (next[len] + huffman->count[len]) << 1;
+    } /* End for */
+
+    for (symbol = 0; symbol < count; symbol++)
+    {
+        len = lengths[symbol];
+        if (len == 0)
+            continue;
+        huffman->symbol[offset[len]++] = symbol;
+
+        /* Codes arrive MSB first; the lookup is indexed LSB first */
+        code = next[len]++;
+        if (len > FAST_BITS)
+            continue;
+        for (i = 0, reversed = 0; i < len; i++)
+            reversed |= ((code >> i) & 1) << (len - 1 - i);
+        for (i = reversed; i < (1U << FAST_BITS); i += (1U << len))
+            huffman->fast[i] = (len << 9) | symbol;
+    } /* End for */
+
+    return left;
+}
+
+/* Make room for length more bytes of output */
+bool Inflater::room(const size_t length)
+{
+    size_t keep = 0;
+
+    if (mOutPos + length <= mOut.size())
+        return true;
+
+    /* The zeros fed in past the end decode forever; stop here */
+    if (truncated())
+        return fail("unexpected end of data");
+    if (!flush())
+        return false;
+
+    /* Keep the last window's worth for matches to copy from */
+    keep = (mOutPos < WINDOW_SIZE) ? mOutPos : WINDOW_SIZE;
+    memmove(&mOut[0], &mOut[mOutPos - keep], keep);
+    mOutPos = keep;
+    mFlushed = keep;
+    return true;
+}
+
+bool Inflater::flush(void)
+{
+    const uint8_t *data = &mOut[mFlushed];
+    const size_t length = mOutPos - mFlushed;
+
+    if (length == 0)
+        return true;
+    if (mFormat == COMPRESSION_GZIP)
+        mCheck = crc32(mCheck, data, length);
+    else if (mFormat == COMPRESSION_ZLIB)
+        mCheck = adler32(mCheck, data, length);
+    mFlushed = mOutPos;
+
+    if (!mSink(data, length))
+        return fail("stopped by the reader");
+    return true;
+}
+
+bool Inflater::run(const Compression_t format)
+{
+    bool ok = false;
+
+    mFormat = format;
+    switch (format)
+    {
+        case COMPRESSION_DEFLATE:
+            ok = deflate() && flush();
+            break;
+
+        case COMPRESSION_ZLIB:
+            ok = zlibStream();
+            break;
+
+        case COMPRESSION_GZIP:
+            /* gzip allows members to be concatenated; trailing zeros
+             * from tape or block padding are ignored */
+            ok = gzipMember();
+            while (ok && (mPos < mLength) && (mIn[mPos] == 0x1F))
+                ok = gzipMember();
+            break;
+
+        default:
+            ok = fail(std::string(compressionName(format)) +
+                " data is not supported");
+    } /* End switch */
+
+    return ok;
+}
+
+bool Inflater::deflate(void)
+{
+    uint32_t last = 0;
+    uint32_t type = 0;
+    bool ok = true;
+
+    mProduced = 0;
+    do
+    {
+        last = bits(1);
+        type = bits(2);
+        switch (type)
+        {
+            case 0:  ok = stored(); break;
+            case 1:  ok = codes(mFixedLength, mFixedDist); break;
+            case 2:  ok = dynamic(); break;
+            default: ok = fail("invalid block type");
+        } /* End switch */
+
+        if (ok && truncated())
+            ok = fail("unexpected end of data");
+    } while (ok && !last);
+
+    if (ok)
+        alignToByte();
+    return ok;
+}
+
+bool Inflater::stored(void)
+{
+    uint32_t length = 0;
+    size_t chunk = 0;
+
+    alignToByte();
+    if (mPos + 4 > mLength)
+        return fail("unexpected end of data");
+    length = mIn[mPos] | (mIn[mPos + 1] << 8);
+    if ((mIn[mPos + 2] != (uint8_t)~mIn[mPos]) ||
+        (mIn[mPos + 3] != (uint8_t)~mIn[mPos + 1]))
+        return fail("stored block length check failed");
+    mPos += 4;
+    if (mPos + length > mLength)
+        return fail("unexpected end of data");
+
+    while (length)
+    {
+        chunk = (length < FLUSH_SIZE) ? length : FLUSH_SIZE;
+        if (!room(chunk))
+            return false;
+        memcpy(&mOut[mOutPos], &mIn[mPos], chunk);
+        mOutPos += chunk;
+        mPos += chunk;
+        mProduced += chunk;
+        length -= chunk;
+    } /* End while */
+    return true;
+}
+
+bool Inflater::dynamic(void)
+{
+    Huffman_t lengthCode;
+    Huffman_t distCode;
+    uint8_t lengths[286 + 30];
+    uint32_t nlen = 0;
+    uint32_t ndist = 0;
+    uint32_t ncode = 0;
+    uint32_t index = 0;
+    uint32_t repeat = 0;
+    uint8_t len = 0;
+    int symbol = 0;
+    int left = 0;
+
+    nlen = bits(5) + 257;
+    ndist = bits(5) + 1;
+    ncode = bits(4) + 4;
+    if ((nlen > 286) || (ndist > 30))
+        return fail("too many length or distance codes");
+
+    /* Code lengths for the code length alphabet */
+    memset(lengths, 0, sizeof(lengths));
+    for (index = 0; index < ncode; index++)
+        lengths[CODE_ORDER[index]] = bits(3);
+    if (build(&lengthCode, lengths, 19) != 0)
+        return fail("invalid code length code");
+
+    /* Literal/length and distance code lengths, run-length coded */
+    index = 0;
+    while (index < nlen + ndist)
+    {
+        symbol = decode(lengthCode);
+        if (symbol < 0)
+            return fail("invalid code length");
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        len = 0;
+        if (symbol == 16)
+        {
+            if (index == 0)
+                return fail("repeated length with no first length");
+            len = lengths[index - 1];
+            repeat = 3 + bits(2);
+        }
+        else if (symbol == 17)
+            repeat = 3 + bits(3);
+        else
+            repeat = 11 + bits(7);
+
+        if (index + repeat > nlen + ndist)
+            return fail("too many code lengths");
+        while (repeat--)
+            lengths[index++] = len;
+    } /* End while */
+
+    if (lengths[256] == 0)
+        return fail("no end-of-block code");
+
+    /* Incomplete codes are only allowed with a single symbol */
+    left = build(&lengthCode, lengths, nlen);
+    if ((left < 0) || ((left > 0) && (nlen - lengthCode.count[0] != 1)))
+        return fail("invalid literal/length code");
+    left = build(&distCode, lengths + nlen, ndist);
+    if ((left < 0) || ((left > 0) && (ndist - distCode.count[0] != 1)))
+        return fail("invalid distance code");
+
+    return codes(lengthCode, distCode);
+}
+
+bool Inflater::codes(const Huffman_t &lengthCode, const Huffman_t &distCode)
+{
+    uint8_t *from = NULL;
+    uint8_t *to = NULL;
+    uint32_t length = 0;
+    uint32_t dist = 0;
+    uint32_t i = 0;
+    int symbol = 0;
+
+    for (;;)
+    {
+        symbol = decode(lengthCode);
+        if (symbol < 0)
+            return fail("invalid literal/length code");
+
+        if (symbol < 256)
+        {
+            if ((mOutPos == mOut.size()) && !room(1))
+                return false;
+            mOut[mOutPos++] = (uint8_t)symbol;
+            mProduced++;
+            continue;
+        }
+        if (symbol == 256)
+            return true;
+
+        /* Length/distance pair */
+        symbol -= 257;
+        if (symbol >= 29)
+            return fail("invalid length code");
+        length = LENGTH_BASE[symbol] + bits(LENGTH_EXTRA[symbol]);
+
+        symbol = decode(distCode);
+        if ((symbol < 0) || (symbol >= 30))
+            return fail("invalid distance code");
+        dist = DIST_BASE[symbol] + bits(DIST_EXTRA[symbol]);
+        if (dist > mProduced)
+            return fail("distance too far back");
+
+        if (!room(MAX_MATCH))
+            return false;
+        to = &mOut[mOutPos];
+        from = to - dist;
+        if (dist >= length)
+            memcpy(to, from, length);
+        else
+        {
+            /* Overlapping copy repeats the last dist bytes */
+            for (i = 0; i < length; i++)
+                to[i] = from[i];
+        }
+        mOutPos += length;
+        mProduced += length;
+    } /* End for */
+}
+
+bool Inflater::gzipMember(void)
+{
+    const uint8_t *header = &mIn[mPos];
+    uint32_t trailer[2];
+    uint8_t flags = 0;
+    size_t extra = 0;
+
+    if ((mPos + 10 > mLength) || (header[0] != 0x1F) || (header[1] != 0x8B))
+        return fail("not a gzip stream");
+    if (header[2] != 8)
+        return fail("unknown gzip compression method");
+    flags = header[3];
+    mPos += 10;
+
+    /* Skip the optional fields */
+    if (flags & GZIP_FEXTRA)
+    {
+        if (mPos + 2 > mLength)
+            return fail("unexpected end of data");
+        extra = mIn[mPos] | (mIn[mPos + 1] << 8);
+        mPos += 2 + extra;
+    }
+    if (flags & GZIP_FNAME)
+    {
+        while ((mPos < mLength) && mIn[mPos]) mPos++;
+        mPos++;
+    }
+    if (flags & GZIP_FCOMMENT)
+    {
+        while ((mPos < mLength) && mIn[mPos]) mPos++;
+        mPos++;
+    }
+    if (flags & GZIP_FHCRC)
+        mPos += 2;
+    if (mPos > mLength)
+        return fail("unexpected end of data");
+
+    mCheck = 0;
+    if (!deflate() || !flush())
+        return false;
+
+    /* CRC-32 and size (mod 2^32) of the member, little endian */
+    if (mPos + 8 > mLength)
+        return fail("unexpected end of data");
+    trailer[0] = mIn[mPos] | (mIn[mPos + 1] << 8) | (mIn[mPos + 2] << 16) |
+        ((uint32_t)mIn[mPos + 3] << 24);
+    trailer[1] = mIn[mPos + 4] | (mIn[mPos + 5] << 8) |
+        (mIn[mPos + 6] << 16) | ((uint32_t)mIn[mPos + 7] << 24);
+    mPos += 8;
+    if (trailer[0] != mCheck)
+        return fail("CRC-32 mismatch");
+    if (trailer[1] != (uint32_t)mProduced)
+        return fail("length mismatch");
+
+    /* Done! */
+    return true;
+}
+
+bool Inflater::zlibStream(void)
+{
+    uint32_t adler = 0;
+
+    if ((mPos + 2 > mLength) || ((mIn[mPos] & 0x0F) != 8) ||
+        ((((mIn[mPos] << 8) | mIn[mPos + 1]) % 31) != 0))
+        return fail("not a zlib stream");
+    if (mIn[mPos + 1] & 0x20)
+        return fail("zlib preset dictionaries are not supported");
+    mPos += 2;
+
+    mCheck = 1;
+    if (!deflate() || !flush())
+        return false;
+
+    /* Adler-32, big endian */
+    if (mPos + 4 > mLength)
+        return fail("unexpected end of data");
+    adler = ((uint32_t)mIn[mPos] << 24) | (mIn[mPos + 1] << 16) |
+        (mIn[mPos + 2] << 8) | mIn[mPos + 3];
+    mPos += 4;
+    if (adler != mCheck)
+        return fail("Adler-32 mismatch");
+
+    /* Done! */
+    return true;
+}
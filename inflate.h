@@ -0,0 +1,46 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __INFLATE_H__
+#define __INFLATE_H__
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/* Compressed formats, as told apart by their leading magic bytes */
+enum Compression_t {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_DEFLATE,    /* Raw DEFLATE (RFC 1951), no framing */
+    COMPRESSION_ZLIB,       /* RFC 1950 */
+    COMPRESSION_GZIP,       /* RFC 1952, members may be concatenated */
+    COMPRESSION_ZSTD        /* Recognized, but not decoded */
+};
+
+/* Never reports COMPRESSION_DEFLATE; raw streams carry no magic. */
+extern Compression_t detectCompression(const uint8_t *data, const size_t length);
+extern const char *compressionName(const Compression_t format);
+
+/* Receives decompressed output in order, a few hundred KB at a time,
+ * while the rest of the input is still being decoded. Return false to
+ * stop decoding early. */
+typedef std::function<bool(const uint8_t *data, const size_t length)> InflateSink_t;
+
+/* Decompress a whole in-memory stream into the sink, checking the
+ * gzip/zlib trailers. Returns false with a reason in *error if the
+ * stream is corrupt or truncated or the sink stopped it. If consumed
+ * isn't NULL it gets the number of input bytes the stream used, which
+ * matters for raw DEFLATE data followed by something else. */
+extern bool inflateStream(const uint8_t *data, const size_t length,
+    const Compression_t format, const InflateSink_t &sink, std::string *error,
+    size_t *consumed = NULL);
+
+#endif /* __INFLATE_H__ */
@@ -0,0 +1,45 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <sstream>
+#include <iomanip>
+#include "json.h"
+
+std::string jsonString(const std::string &value)
+{
+    std::stringstream out;
+    size_t i = 0;
+
+    out << '"';
+    for (i = 0; i < value.size(); i++)
+    {
+        unsigned char ch = value[i];
+
+        switch (ch)
+        {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+
+            default:
+                if (ch < 0x20)
+                    out << "\\u" << std::hex << std::setfill('0') <<
+                        std::setw(4) << (int)ch << std::dec;
+                else
+                    out << value[i];
+                break;
+        } /* End switch */
+    } /* End for */
+    out << '"';
+
+    return out.str();
+}
@@ -0,0 +1,19 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <string>
+
+/* Quote and escape a UTF-8 string for use as a JSON value. */
+extern std::string jsonString(const std::string &value);
+
+#endif /* __JSON_H__ */
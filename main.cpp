@@ -11,9 +11,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include "version.h"
 #include "pack.h"
+#include "content_index.h"
+#include "block_index.h"
+#include "scan.h"
+#include "extract.h"
+#include "pack_builder.h"
+#include "update_plan.h"
+#include "defrag.h"
+#include "header_patch.h"
+#include "daemon.h"
+#include "watch.h"
+#include "benchmark.h"
+#include "worker_pool.h"
+#include "scan_cache.h"
+#include "metrics.h"
 
 static void showVersion(void)
 {
@@ -29,22 +47,381 @@ static void showVersion(void)
 static void showHelp(const char *programName) 
 {
     std::cout << "Usage:" << std::endl << std::endl << "  " << programName;
-    std::cout << " [options] [Memory pack dump filename]" << std::endl;
+    std::cout << " [options] [Memory pack dump filename(s)]" << std::endl;
+    std::cout << std::endl << "Dumps may be gzip or zlib compressed. Every member";
+    std::cout << " of a .zip, .tar," << std::endl << ".tar.gz or .tgz archive is";
+    std::cout << " scanned as <archive>:<member>." << std::endl;
     std::cout << std::endl << "Options:" << std::endl;
-    std::cout << "  -n   No color codes in report" << std::endl;
-    std::cout << "  -v   Display version" << std::endl;
-    std::cout << "  -h   Display this help" << std::endl;
+    std::cout << "  -n                      No color codes in report" << std::endl;
+    std::cout << "  -m, --page-map          Show which 4 KB pages of each block hold";
+    std::cout << std::endl;
+    std::cout << "                          data" << std::endl;
+    std::cout << "  -e, --entropy           Profile the entropy and byte histogram";
+    std::cout << std::endl;
+    std::cout << "                          of every 4 KB page" << std::endl;
+    std::cout << "      --diagnose          Find which checksum rule variant explains";
+    std::cout << std::endl;
+    std::cout << "                          each mismatching checksum" << std::endl;
+    std::cout << "  -x, --extract DIR       Write each content's allocated blocks to";
+    std::cout << std::endl;
+    std::cout << "                          its own .bs file in a directory";
+    std::cout << std::endl;
+    std::cout << "  -j, --json              Print one JSON object per pack instead";
+    std::cout << std::endl;
+    std::cout << "                          of the text report" << std::endl;
+    std::cout << "  -q, --quiet             Only print the corpus allocation summary";
+    std::cout << std::endl;
+    std::cout << "                          when scanning several dumps" << std::endl;
+    std::cout << "  -i, --index FILE        Identify contents using a content index";
+    std::cout << std::endl;
+    std::cout << "  -b, --build-index FILE  Build a content index from the text";
+    std::cout << std::endl;
+    std::cout << "                          catalog given in place of the dump";
+    std::cout << std::endl;
+    std::cout << "  -o, --block-index FILE  Attribute orphaned blocks using a block";
+    std::cout << std::endl;
+    std::cout << "                          index" << std::endl;
+    std::cout << "  -p, --pages             Also match 4 KB pages of orphaned blocks";
+    std::cout << std::endl;
+    std::cout << "  -B, --build-block-index FILE" << std::endl;
+    std::cout << "                          Build a block index from the known-good";
+    std::cout << std::endl;
+    std::cout << "                          contents of one or more dumps";
+    std::cout << std::endl;
+    std::cout << "      --build-pack SPEC   Compose memory pack images from the";
+    std::cout << std::endl;
+    std::cout << "                          content images a pack spec lists";
+    std::cout << std::endl;
+    std::cout << "      --plan SCRIPT       Plan the erases and writes that turn the";
+    std::cout << std::endl;
+    std::cout << "                          first dump given into the second" << std::endl;
+    std::cout << "      --relocate          Let the plan move contents to blocks that";
+    std::cout << std::endl;
+    std::cout << "                          already hold them" << std::endl;
+    std::cout << "      --defrag IMAGE      Write a defragmented copy of the dump and";
+    std::cout << std::endl;
+    std::cout << "                          the block moves that produce it" << std::endl;
+    std::cout << "      --set FIELD[@ADDRESS]=VALUE" << std::endl;
+    std::cout << "                          Patch title, starts, intro, maker, date";
+    std::cout << std::endl;
+    std::cout << "                          or bytes in the dumps in place, keeping";
+    std::cout << std::endl;
+    std::cout << "                          checksums in step (may be repeated)";
+    std::cout << std::endl;
+    std::cout << "      --offset N          Scan the pack at byte N of each file";
+    std::cout << std::endl;
+    std::cout << "      --length N          Size of that window (default: the rest";
+    std::cout << std::endl;
+    std::cout << "                          of the file)" << std::endl;
+    std::cout << "      --regions LIST      Scan the windows a list gives, one";
+    std::cout << std::endl;
+    std::cout << "                          \"FILE OFFSET [LENGTH]\" per line";
+    std::cout << std::endl;
+    std::cout << "  -d, --daemon SOCKET     Serve scan requests on a Unix socket";
+    std::cout << std::endl;
+    std::cout << "  -w, --watch DIR         Scan dumps as they are written into a";
+    std::cout << std::endl;
+    std::cout << "                          directory, printing JSON results" << std::endl;
+    std::cout << "  -t, --threads N         Worker threads for daemon and watch modes";
+    std::cout << std::endl;
+    std::cout << "      --queue-limit N     Dumps waiting for a worker in watch mode";
+    std::cout << std::endl;
+    std::cout << "      --metrics-socket SOCKET" << std::endl;
+    std::cout << "                          Serve Prometheus metrics on a Unix socket";
+    std::cout << std::endl;
+    std::cout << "      --metrics-file FILE Write Prometheus metrics to a file" << std::endl;
+    std::cout << "      --metrics-interval SECONDS" << std::endl;
+    std::cout << "                          How often to rewrite the metrics file";
+    std::cout << std::endl;
+    std::cout << "      --io POLICY         How dumps are read: stream (default),";
+    std::cout << std::endl;
+    std::cout << "                          fadvise, hugepage, mmap, direct or uring";
+    std::cout << std::endl;
+    std::cout << "      --io-depth N        Dumps kept in flight by \"--io uring\"";
+    std::cout << std::endl;
+    std::cout << "      --benchmark         Time a scan of the given dumps under each";
+    std::cout << std::endl;
+    std::cout << "                          I/O policy" << std::endl;
+    std::cout << "  -c, --cache FILE        Reuse results for unchanged dumps from a";
+    std::cout << std::endl;
+    std::cout << "                          scan cache, adding new ones to it";
+    std::cout << std::endl;
+    std::cout << "      --cache-verify      Hash each dump before trusting its cached";
+    std::cout << std::endl;
+    std::cout << "                          result" << std::endl;
+    std::cout << "  -v, --version           Display version" << std::endl;
+    std::cout << "  -h, --help              Display this help" << std::endl;
+}
+
+static const struct option longOptions[] = {
+    { "page-map",    no_argument,       NULL, 'm' },
+    { "quiet",       no_argument,       NULL, 'q' },
+    { "entropy",     no_argument,       NULL, 'e' },
+    { "diagnose",    no_argument,       NULL, 'G' },
+    { "extract",     required_argument, NULL, 'x' },
+    { "json",        no_argument,       NULL, 'j' },
+    { "daemon",      required_argument, NULL, 'd' },
+    { "threads",     required_argument, NULL, 't' },
+    { "watch",       required_argument, NULL, 'w' },
+    { "queue-limit",      required_argument, NULL, 'Q' },
+    { "metrics-socket",   required_argument, NULL, 'M' },
+    { "metrics-file",     required_argument, NULL, 'F' },
+    { "metrics-interval", required_argument, NULL, 'I' },
+    { "index",       required_argument, NULL, 'i' },
+    { "build-index", required_argument, NULL, 'b' },
+    { "block-index", required_argument, NULL, 'o' },
+    { "pages",       no_argument,       NULL, 'p' },
+    { "build-block-index", required_argument, NULL, 'B' },
+    { "build-pack",       required_argument, NULL, 'P' },
+    { "plan",             required_argument, NULL, 'U' },
+    { "relocate",         no_argument,       NULL, 'R' },
+    { "defrag",           required_argument, NULL, 'Z' },
+    { "set",              required_argument, NULL, 'S' },
+    { "offset",           required_argument, NULL, 'A' },
+    { "length",           required_argument, NULL, 'L' },
+    { "regions",          required_argument, NULL, 'Y' },
+    { "cache",       required_argument, NULL, 'c' },
+    { "cache-verify",     no_argument,       NULL, 'V' },
+    { "io",               required_argument, NULL, 'O' },
+    { "io-depth",         required_argument, NULL, 'D' },
+    { "benchmark",        no_argument,       NULL, 'K' },
+    { "version",     no_argument,       NULL, 'v' },
+    { "help",        no_argument,       NULL, 'h' },
+    { NULL,          0,                 NULL, 0 }
+};
+
+static bool parseOffset(const char *text, uint64_t *value)
+{
+    char *end = NULL;
+
+    errno = 0;
+    *value = strtoull(text, &end, 0);
+    return ((*text != '\0') && (*text != '-') && (*end == '\0') && (errno == 0));
+}
+
+/* A region list names one window per line: "FILE OFFSET [LENGTH]" */
+static bool readRegionList(const char *listFile, std::vector<std::string> *files,
+    std::vector<Pack::Region_t> *regions)
+{
+    std::ifstream list(listFile);
+    std::string line, file, offset, length;
+    Pack::Region_t region;
+    uint32_t lineNum = 0;
+    bool ok = true;
+
+    if (!list.is_open())
+    {
+        std::cout << "Unable to open region list '" << listFile << "'";
+        std::cout << std::endl;
+        return false;
+    }
+
+    while (std::getline(list, line))
+    {
+        std::istringstream words(line);
+
+        lineNum++;
+        if (!(words >> file) || (file[0] == '#'))
+            continue;
+
+        /* No length means the rest of the file */
+        offset = "";
+        length = "0";
+        words >> offset >> length;
+        if (!parseOffset(offset.c_str(), &region.offset) ||
+            !parseOffset(length.c_str(), &region.length))
+        {
+            std::cout << "Region list '" << listFile << "' line " << lineNum;
+            std::cout << ": expected \"FILE OFFSET [LENGTH]\"" << std::endl;
+            ok = false;
+            continue;
+        }
+        files->push_back(file);
+        regions->push_back(region);
+    } /* End while */
+
+    return ok;
+}
+
+static bool buildBlockIndex(const char *indexFile, char **dumps,
+    const int dumpCount, const bool pages, const char *catalogFile)
+{
+    BlockIndex::Builder builder;
+    ContentIndex *catalog = NULL;
+    Pack *pack = NULL;
+    bool result = false;
+    int i = 0;
+
+    /* Label contents from the content index when one is given */
+    if (catalogFile)
+    {
+        catalog = new ContentIndex(catalogFile);
+        if (!catalog->isLoaded())
+        {
+            delete catalog;
+            return false;
+        }
+    }
+
+    for (i = 0; i < dumpCount; i++)
+    {
+        pack = new Pack(dumps[i]);
+        if (pack->isLoaded())
+        {
+            pack->analyze();
+            pack->indexBlocks(&builder, pages, catalog);
+        }
+        else
+            std::cout << pack->errorMessage() << std::endl;
+        delete pack;
+    } /* End for */
+
+    result = builder.write(indexFile);
+    delete catalog;
+    return result;
+}
+
+static bool planUpdate(const char *scriptFile, const char *currentFile,
+    const char *desiredFile, const bool relocate, const Pack::IoPolicy_t io)
+{
+    Pack current(currentFile, io);
+    Pack desired(desiredFile, io);
+    UpdatePlanner *planner = NULL;
+    bool result = false;
+
+    if (!current.isLoaded() || !desired.isLoaded())
+    {
+        std::cout << (current.isLoaded() ? desired : current).errorMessage();
+        std::cout << std::endl;
+        return false;
+    }
+    current.analyze();
+    desired.analyze();
+
+    planner = new UpdatePlanner(current, desired);
+    if (!planner->plan(relocate))
+        std::cout << planner->errorMessage() << std::endl;
+    else if (planner->write(scriptFile))
+    {
+        std::cout << "Erasing " << AllocMap::popcount(planner->eraseMask());
+        std::cout << " of " << (desired.packSize() / PACK_BLOCK_SIZE);
+        std::cout << " blocks and writing " << planner->bytesWritten();
+        std::cout << " bytes in " << planner->writes().size() << " ranges";
+        std::cout << std::endl;
+        result = true;
+    }
+
+    delete planner;
+    return result;
+}
+
+static bool defragment(const char *imageFile, const char *dumpFile,
+    const Pack::IoPolicy_t io)
+{
+    Pack pack(dumpFile, io);
+    DefragPlanner *planner = NULL;
+    bool result = false;
+
+    if (!pack.isLoaded())
+    {
+        std::cout << pack.errorMessage() << std::endl;
+        return false;
+    }
+    pack.analyze();
+
+    planner = new DefragPlanner(pack);
+    if (!planner->plan())
+        std::cout << planner->errorMessage() << std::endl;
+    else if (planner->write(imageFile))
+    {
+        std::cout << "Moving " << planner->blocksMoved() << " of ";
+        std::cout << (pack.packSize() / PACK_BLOCK_SIZE) << " blocks in ";
+        std::cout << planner->moves().size() << " steps" << std::endl;
+        result = true;
+    }
+
+    delete planner;
+    return result;
+}
+
+static bool patchDumps(const std::vector<HeaderPatcher::Patch_t> &patches,
+    char **dumps, const int dumpCount)
+{
+    HeaderPatcher patcher(patches);
+    bool result = true;
+    int i = 0;
+
+    for (i = 0; i < dumpCount; i++)
+    {
+        if (!patcher.patch(dumps[i]))
+        {
+            std::cout << patcher.errorMessage() << std::endl;
+            result = false;
+            continue;
+        }
+        std::cout << "Patched " << patcher.bytesChanged() << " bytes and ";
+        std::cout << patcher.checksumsUpdated() << " checksums in '";
+        std::cout << dumps[i] << "'" << std::endl;
+    } /* End for */
+
+    return result;
 }
 
 int main(int argc, char *argv[]) 
 {
     Pack *pack = NULL;
+    ContentIndex *index = NULL;
+    const char *indexFile = NULL;
+    const char *buildIndexFile = NULL;
+    BlockIndex *blockIndex = NULL;
+    const char *blockIndexFile = NULL;
+    const char *buildBlockIndexFile = NULL;
+    const char *buildPackSpec = NULL;
+    const char *planScript = NULL;
+    bool relocate = false;
+    const char *defragImage = NULL;
+    std::vector<HeaderPatcher::Patch_t> patches;
+    Pack::Region_t region = { 0, 0 };
+    bool useRegion = false;
+    const char *regionList = NULL;
+    std::vector<std::string> listed;
+    std::vector<Pack::Region_t> regions;
+    std::vector<char *> dumps;
+    HeaderPatcher::Patch_t patch;
+    std::string patchError;
+    bool usePages = false;
+    bool pageMap = false;
+    bool quiet = false;
+    bool entropy = false;
+    bool diagnose = false;
+    ContentExtractor *extractor = NULL;
+    const char *extractDir = NULL;
+    bool json = false;
+    const char *daemonSocket = NULL;
+    const char *watchDir = NULL;
+    unsigned int threads = WorkerPool::defaultThreads();
+    size_t queueLimit = 64;
+    ScanConfig_t config;
+    std::vector<BatchScanner *> scanners;
+    ScanCache *cache = NULL;
+    const char *cacheFile = NULL;
+    bool verifyCache = false;
+    Pack::IoPolicy_t ioPolicy = Pack::IO_STREAM;
+    bool benchmark = false;
+    unsigned int ioDepth = 16;
+    const char *metricsSocket = NULL;
+    const char *metricsFile = NULL;
+    unsigned int metricsInterval = 10;
+    int result = 0;
+    AllocSummary summary;
+    int packsScanned = 0;
+    int packsSeen = 0;
     int fileIdx = 0;
     bool useColor = true;
     int opt = 0;
 
     /* Parse command line options */
-    while ((opt = getopt(argc, argv, "nvh")) != -1)
+    while ((opt = getopt_long(argc, argv, "nmqejx:d:w:t:i:b:o:pB:c:vh", longOptions, NULL)) != -1)
     {
         switch(opt)
         {
@@ -52,6 +429,148 @@ int main(int argc, char *argv[])
                 useColor = false;
                 break;
 
+            case 'm':
+                pageMap = true;
+                break;
+
+            case 'q':
+                quiet = true;
+                break;
+
+            case 'e':
+                entropy = true;
+                break;
+
+            case 'G':
+                diagnose = true;
+                break;
+
+            case 'x':
+                extractDir = optarg;
+                break;
+
+            case 'j':
+                json = true;
+                break;
+
+            case 'd':
+                daemonSocket = optarg;
+                break;
+
+            case 'w':
+                watchDir = optarg;
+                break;
+
+            case 'Q':
+                queueLimit = atoi(optarg);
+                if (queueLimit == 0) queueLimit = 1;
+                break;
+
+            case 't':
+                threads = atoi(optarg);
+                if (threads == 0) threads = 1;
+                break;
+
+            case 'M':
+                metricsSocket = optarg;
+                break;
+
+            case 'F':
+                metricsFile = optarg;
+                break;
+
+            case 'I':
+                metricsInterval = atoi(optarg);
+                break;
+
+            case 'i':
+                indexFile = optarg;
+                break;
+
+            case 'b':
+                buildIndexFile = optarg;
+                break;
+
+            case 'o':
+                blockIndexFile = optarg;
+                break;
+
+            case 'p':
+                usePages = true;
+                break;
+
+            case 'B':
+                buildBlockIndexFile = optarg;
+                break;
+
+            case 'P':
+                buildPackSpec = optarg;
+                break;
+
+            case 'U':
+                planScript = optarg;
+                break;
+
+            case 'R':
+                relocate = true;
+                break;
+
+            case 'Z':
+                defragImage = optarg;
+                break;
+
+            case 'S':
+                if (!HeaderPatcher::parse(optarg, &patch, &patchError))
+                {
+                    std::cout << "Bad --set '" << optarg << "': ";
+                    std::cout << patchError << std::endl;
+                    return 1;
+                }
+                patches.push_back(patch);
+                break;
+
+            case 'A':
+            case 'L':
+                if (!parseOffset(optarg, (opt == 'A') ? &region.offset :
+                    &region.length))
+                {
+                    std::cout << "Bad " << ((opt == 'A') ? "offset" : "length");
+                    std::cout << " '" << optarg << "'" << std::endl;
+                    return 1;
+                }
+                useRegion = true;
+                break;
+
+            case 'Y':
+                regionList = optarg;
+                break;
+
+            case 'c':
+                cacheFile = optarg;
+                break;
+
+            case 'V':
+                verifyCache = true;
+                break;
+
+            case 'O':
+                if (!Pack::parseIoPolicy(optarg, &ioPolicy))
+                {
+                    std::cout << "Unknown I/O policy '" << optarg << "'";
+                    std::cout << std::endl;
+                    return 1;
+                }
+                break;
+
+            case 'D':
+                ioDepth = atoi(optarg);
+                if (ioDepth == 0) ioDepth = 1;
+                break;
+
+            case 'K':
+                benchmark = true;
+                break;
+
             case 'v':
                 showVersion();
                 return 0;
@@ -66,12 +585,67 @@ int main(int argc, char *argv[])
         }
     } /* End while */
 
-    /* Parse memory pack dump filename */
-    if ( optind == (argc - 1) )
+    /* Build a block index from every dump given */
+    if (buildBlockIndexFile)
+    {
+        if (optind == argc)
+        {
+            std::cout << "No memory pack files specified." << std::endl;
+            return 1;
+        }
+        return buildBlockIndex(buildBlockIndexFile, &argv[optind],
+            argc - optind, usePages, indexFile) ? 0 : 1;
+    }
+
+    /* Compose packs from a spec instead of scanning */
+    if (buildPackSpec)
+        return PackBuilder::buildFromSpec(buildPackSpec) ? 0 : 1;
+
+    /* Plan a reflash from one dump to another instead of scanning */
+    if (planScript)
+    {
+        if ((argc - optind) != 2)
+        {
+            std::cout << "Planning an update needs the current and the desired";
+            std::cout << " dump." << std::endl;
+            return 1;
+        }
+        return planUpdate(planScript, argv[optind], argv[optind + 1],
+            relocate, ioPolicy) ? 0 : 1;
+    }
+
+    /* Defragment a dump instead of scanning it */
+    if (defragImage)
+    {
+        if ((argc - optind) != 1)
+        {
+            std::cout << "Defragmenting needs exactly one dump." << std::endl;
+            return 1;
+        }
+        return defragment(defragImage, argv[optind], ioPolicy) ? 0 : 1;
+    }
+
+    /* Patch headers in place instead of scanning */
+    if (!patches.empty())
+    {
+        if (optind == argc)
+        {
+            std::cout << "No memory pack files specified." << std::endl;
+            return 1;
+        }
+        return patchDumps(patches, &argv[optind], argc - optind) ? 0 : 1;
+    }
+
+    /* Windows of larger files to scan as packs */
+    if (regionList && !readRegionList(regionList, &listed, &regions))
+        return 1;
+
+    /* Parse memory pack dump filename(s); the daemon and watcher take none */
+    if ( (optind < argc) || !listed.empty() )
     {
         fileIdx = optind;
     }
-    else
+    else if ( !(daemonSocket || watchDir) || buildIndexFile )
     {
         /* Filename wasn't specified */
         showVersion();
@@ -80,21 +654,194 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    /* Load the pack data */
-    pack = new Pack(argv[fileIdx]);
-    if (!pack->isLoaded())
+    /* Build a content index from a text catalog instead of scanning */
+    if (buildIndexFile)
+        return ContentIndex::build(argv[fileIdx], buildIndexFile) ? 0 : 1;
+
+    /* Map the content index, if one was given */
+    if (indexFile)
     {
-        delete pack;
-	return 0;
+        index = new ContentIndex(indexFile);
+        if (!index->isLoaded())
+        {
+            delete index;
+            return 1;
+        }
     }
 
-    /* Analyze the pack and generate a report */
-    pack->analyze();
-    showVersion();
-    std::cout << pack->generateReport(useColor);
+    /* Map the block index, if one was given */
+    if (blockIndexFile)
+    {
+        blockIndex = new BlockIndex(blockIndexFile);
+        if (!blockIndex->isLoaded())
+        {
+            delete blockIndex;
+            delete index;
+            return 1;
+        }
+    }
+
+    /* Open (or start) the scan cache, if one was given */
+    if (cacheFile)
+    {
+        cache = new ScanCache(cacheFile, Pack::CACHE_LAYOUT);
+        if (!cache->isLoaded())
+        {
+            delete cache;
+            delete blockIndex;
+            delete index;
+            return 1;
+        }
+    }
+
+    /* Open the extraction directory, if one was given */
+    if (extractDir)
+    {
+        extractor = new ContentExtractor(extractDir);
+        if (!extractor->isLoaded())
+        {
+            delete extractor;
+            delete cache;
+            delete blockIndex;
+            delete index;
+            return 1;
+        }
+    }
+
+    initScanConfig(&config);
+    config.index = index;
+    config.blockIndex = blockIndex;
+    config.pages = usePages;
+    config.entropy = entropy;
+    config.diagnose = diagnose;
+    config.extractor = extractor;
+    config.cache = cache;
+    config.verifyCache = verifyCache;
+    config.io = ioPolicy;
+    config.ioDepth = ioDepth;
+
+    /* Export metrics while we work */
+    if (metricsSocket && !metricsStartSocket(metricsSocket))
+    {
+        delete cache;
+        delete index;
+        delete blockIndex;
+        delete extractor;
+        return 1;
+    }
+    if (metricsFile)
+        metricsStartFileDump(metricsFile, metricsInterval);
+
+    /* Serve requests until told to stop */
+    if (daemonSocket)
+    {
+        ScanDaemon *daemon = new ScanDaemon(config, threads);
+
+        result = daemon->run(daemonSocket);
+        delete daemon;
+        metricsStop();
+        delete cache;
+        delete index;
+        delete blockIndex;
+        delete extractor;
+        return result;
+    }
+
+    /* Scan dumps as they arrive until told to stop */
+    if (watchDir)
+    {
+        ScanWatcher *watcher = new ScanWatcher(config, threads, queueLimit);
+
+        result = watcher->run(watchDir);
+        delete watcher;
+        metricsStop();
+        delete cache;
+        delete index;
+        delete blockIndex;
+        delete extractor;
+        return result;
+    }
+
+    /* Compare the I/O policies instead of reporting */
+    if (benchmark)
+    {
+        result = runBenchmark(&argv[fileIdx], argc - fileIdx, config, useColor);
+        metricsStop();
+        delete cache;
+        delete index;
+        delete blockIndex;
+        delete extractor;
+        return result;
+    }
+
+    /* Scan each pack. More than one dump is batch mode. With --offset or
+     * --length every dump given is a window too, and those come before
+     * the ones in the region list; otherwise the dumps given are scanned
+     * whole (archives and compressed dumps included) before the list. */
+    if (useRegion)
+    {
+        regions.insert(regions.begin(), argc - fileIdx, region);
+        dumps.assign(&argv[fileIdx], &argv[argc]);
+    }
+    else if (fileIdx < argc)
+        scanners.push_back(new BatchScanner(&argv[fileIdx], argc - fileIdx,
+            config));
+    for (std::string &name : listed)
+        dumps.push_back(&name[0]);
+    if (!dumps.empty())
+        scanners.push_back(new BatchScanner(dumps.data(), dumps.size(),
+            config, regions.data()));
+
+    for (BatchScanner *scanner : scanners)
+    {
+        while ((pack = scanner->next()) != NULL)
+        {
+            packsSeen++;
+            if (!pack->isLoaded())
+            {
+                std::cout << pack->errorMessage() << std::endl;
+                delete pack;
+                continue;
+            }
+
+            /* Generate a report */
+            if (json)
+            {
+                if (!quiet) std::cout << pack->generateJSON();
+            }
+            else if (!quiet)
+            {
+                if (!packsScanned) showVersion();
+                else std::cout << std::endl;
+                std::cout << pack->generateReport(useColor, pageMap);
+            }
+            summary.add(pack->filename(), pack->allocation());
+            packsScanned++;
+
+            /* Delete the pack data */
+            delete pack;
+        } /* End while */
+        delete scanner;
+    } /* End for */
+
+    /* Corpus totals, for batch mode (an archive counts its members) */
+    if (packsSeen > 1)
+    {
+        if (json)
+            std::cout << summary.generateJSON();
+        else
+        {
+            if (!quiet) std::cout << std::endl;
+            std::cout << summary.generateReport(useColor);
+        }
+    }
 
-    /* Delete the pack data and exit */
-    delete pack;
+    /* Done! */
+    metricsStop();
+    delete cache;
+    delete index;
+    delete blockIndex;
+    delete extractor;
     return 0;
 }
 
@@ -0,0 +1,391 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <condition_variable>
+#include "metrics.h"
+#include "util.h"
+
+/* Histogram bucket upper bounds, in microseconds */
+static const uint64_t BUCKET_BOUNDS[] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000
+};
+#define BUCKET_COUNT (sizeof(BUCKET_BOUNDS) / sizeof(BUCKET_BOUNDS[0]))
+
+static const char *METRIC_NAMES[METRIC_COUNT][2] = {
+    { "packscan_packs_loaded_total", "Packs successfully loaded" },
+    { "packscan_load_errors_total", "Packs rejected at load time" },
+    { "packscan_bytes_loaded_total", "Pack bytes read" },
+    { "packscan_bytes_verified_total", "Bytes covered by checksum verification" },
+    { "packscan_contents_total", "Content headers found" },
+    { "packscan_checksum_mismatches_total", "Contents whose checksum did not match" },
+    { "packscan_requests_total", "Daemon requests received" },
+    { "packscan_cache_hits_total", "Scans answered from the scan cache" },
+    { "packscan_cache_misses_total", "Cacheable scans that missed the scan cache" }
+};
+
+static const char *PHASE_NAMES[PHASE_COUNT] = {
+    "load", "analyze", "checksum", "report"
+};
+
+typedef struct {
+    std::atomic<uint64_t> counters[METRIC_COUNT];
+    std::atomic<uint64_t> buckets[PHASE_COUNT][BUCKET_COUNT + 1]; /* +Inf */
+    std::atomic<uint64_t> sumNs[PHASE_COUNT];
+} ThreadSlot_t;
+
+/* Slots of live threads, and the counts of threads that have exited.
+ * A thread's counts are folded into the retired totals as it exits
+ * and its slot is kept for the next new thread, so totals never go
+ * backwards and rendering only sums the threads alive now. */
+static std::mutex slotLock;
+static std::deque<ThreadSlot_t> slotStore;
+static std::vector<ThreadSlot_t *> slots;
+static std::vector<ThreadSlot_t *> freeSlots;
+static ThreadSlot_t retired;
+
+static void retireSlot(ThreadSlot_t *slot);
+
+class SlotOwner {
+public:
+    SlotOwner() : slot(NULL) {}
+    ~SlotOwner() { if (slot) retireSlot(slot); }
+    ThreadSlot_t *slot;
+};
+static thread_local SlotOwner mySlot;
+
+static std::mutex sourceLock;
+static std::function<size_t(void)> queueDepthSource;
+
+static std::mutex stopLock;
+static std::condition_variable stopSignal;
+static bool stopping = false;
+static std::vector<std::thread> exporters;
+
+static void clearSlot(ThreadSlot_t *slot)
+{
+    uint32_t i = 0, x = 0;
+
+    for (i = 0; i < METRIC_COUNT; i++)
+        slot->counters[i].store(0, std::memory_order_relaxed);
+    for (i = 0; i < PHASE_COUNT; i++)
+    {
+        for (x = 0; x <= BUCKET_COUNT; x++)
+            slot->buckets[i][x].store(0, std::memory_order_relaxed);
+        slot->sumNs[i].store(0, std::memory_order_relaxed);
+    } /* End for */
+}
+
+/* Add one slot's counts into another. Callers hold slotLock, or own
+ * the destination outright. */
+static void foldSlot(ThreadSlot_t *into, const ThreadSlot_t *from)
+{
+    uint32_t i = 0, x = 0;
+
+    for (i = 0; i < METRIC_COUNT; i++)
+        into->counters[i].store(into->counters[i].load(std::memory_order_relaxed) +
+            from->counters[i].load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    for (i = 0; i < PHASE_COUNT; i++)
+    {
+        for (x = 0; x <= BUCKET_COUNT; x++)
+            into->buckets[i][x].store(
+                into->buckets[i][x].load(std::memory_order_relaxed) +
+                from->buckets[i][x].load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+        into->sumNs[i].store(into->sumNs[i].load(std::memory_order_relaxed) +
+            from->sumNs[i].load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    } /* End for */
+}
+
+static ThreadSlot_t *threadSlot(void)
+{
+    if (mySlot.slot) return mySlot.slot;
+
+    /* First use on this thread */
+    std::lock_guard<std::mutex> guard(slotLock);
+    if (!freeSlots.empty())
+    {
+        mySlot.slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else
+    {
+        slotStore.emplace_back();
+        mySlot.slot = &slotStore.back();
+        clearSlot(mySlot.slot);
+    }
+    slots.push_back(mySlot.slot);
+    return mySlot.slot;
+}
+
+/* Runs as a thread that used metrics exits */
+static void retireSlot(ThreadSlot_t *slot)
+{
+    std::lock_guard<std::mutex> guard(slotLock);
+
+    foldSlot(&retired, slot);
+    clearSlot(slot);
+    slots.erase(std::find(slots.begin(), slots.end(), slot));
+    freeSlots.push_back(slot);
+}
+
+/* Only the owning thread writes a slot, so a relaxed load and store
+ * is enough and avoids a locked read-modify-write */
+static inline void bump(std::atomic<uint64_t> &value, const uint64_t amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount,
+        std::memory_order_relaxed);
+}
+
+void metricAdd(const Metric_t metric, const uint64_t amount)
+{
+    bump(threadSlot()->counters[metric], amount);
+}
+
+void metricObserve(const Phase_t phase, const uint64_t nanoseconds)
+{
+    ThreadSlot_t *slot = threadSlot();
+    uint64_t micros = nanoseconds / 1000;
+    uint32_t bucket = 0;
+
+    while ((bucket < BUCKET_COUNT) && (micros > BUCKET_BOUNDS[bucket]))
+        bucket++;
+
+    bump(slot->buckets[phase][bucket], 1);
+    bump(slot->sumNs[phase], nanoseconds);
+}
+
+void metricsSetQueueDepthSource(const std::function<size_t(void)> &source)
+{
+    std::lock_guard<std::mutex> guard(sourceLock);
+    queueDepthSource = source;
+}
+
+std::string metricsPrometheus(void)
+{
+    std::stringstream text;
+    ThreadSlot_t total;
+    uint64_t counters[METRIC_COUNT];
+    uint64_t buckets[PHASE_COUNT][BUCKET_COUNT + 1];
+    uint64_t sumNs[PHASE_COUNT];
+    uint64_t cumulative = 0;
+    uint32_t i = 0, x = 0, s = 0;
+
+    clearSlot(&total);
+    {
+        std::lock_guard<std::mutex> guard(slotLock);
+        foldSlot(&total, &retired);
+        for (s = 0; s < slots.size(); s++)
+            foldSlot(&total, slots[s]);
+    }
+
+    for (i = 0; i < METRIC_COUNT; i++)
+        counters[i] = total.counters[i].load(std::memory_order_relaxed);
+    for (i = 0; i < PHASE_COUNT; i++)
+    {
+        for (x = 0; x <= BUCKET_COUNT; x++)
+            buckets[i][x] = total.buckets[i][x].load(std::memory_order_relaxed);
+        sumNs[i] = total.sumNs[i].load(std::memory_order_relaxed);
+    } /* End for */
+
+    for (i = 0; i < METRIC_COUNT; i++)
+    {
+        text << "# HELP " << METRIC_NAMES[i][0] << " " << METRIC_NAMES[i][1] << "\n";
+        text << "# TYPE " << METRIC_NAMES[i][0] << " counter\n";
+        text << METRIC_NAMES[i][0] << " " << counters[i] << "\n";
+    } /* End for */
+
+    text << "# HELP packscan_phase_duration_seconds Time spent per phase\n";
+    text << "# TYPE packscan_phase_duration_seconds histogram\n";
+    for (i = 0; i < PHASE_COUNT; i++)
+    {
+        cumulative = 0;
+        for (x = 0; x <= BUCKET_COUNT; x++)
+        {
+            cumulative += buckets[i][x];
+            text << "packscan_phase_duration_seconds_bucket{phase=\"";
+            text << PHASE_NAMES[i] << "\",le=\"";
+            if (x < BUCKET_COUNT)
+                text << (BUCKET_BOUNDS[x] / 1e6);
+            else
+                text << "+Inf";
+            text << "\"} " << cumulative << "\n";
+        } /* End for */
+
+        text << "packscan_phase_duration_seconds_sum{phase=\"" << PHASE_NAMES[i];
+        text << "\"} " << std::fixed << std::setprecision(9) << (sumNs[i] / 1e9);
+        text << std::defaultfloat << "\n";
+        text << "packscan_phase_duration_seconds_count{phase=\"" << PHASE_NAMES[i];
+        text << "\"} " << cumulative << "\n";
+    } /* End for */
+
+    {
+        std::lock_guard<std::mutex> guard(sourceLock);
+        if (queueDepthSource)
+        {
+            text << "# HELP packscan_queue_depth Jobs waiting for a worker\n";
+            text << "# TYPE packscan_queue_depth gauge\n";
+            text << "packscan_queue_depth " << queueDepthSource() << "\n";
+        }
+    }
+
+    return text.str();
+}
+
+static bool writeMetricsFile(const std::string &filename)
+{
+    std::string text = metricsPrometheus();
+
+    return writeImageFile(filename,
+        reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
+
+static void fileDumpMain(const std::string filename, const unsigned int interval)
+{
+    std::unique_lock<std::mutex> guard(stopLock);
+
+    while (!stopping)
+    {
+        guard.unlock();
+        writeMetricsFile(filename);
+        guard.lock();
+        stopSignal.wait_for(guard, std::chrono::seconds(interval));
+    } /* End while */
+
+    /* One last dump with the final totals */
+    guard.unlock();
+    writeMetricsFile(filename);
+}
+
+void metricsStartFileDump(const char *filename, const unsigned int interval)
+{
+    exporters.push_back(std::thread(fileDumpMain, std::string(filename),
+        interval ? interval : 1));
+}
+
+static void socketMain(const int listenFd, const std::string socketPath)
+{
+    struct pollfd listener;
+    std::string text;
+    std::string header;
+    char request[512];
+    ssize_t bytes = 0;
+    int clientFd = -1;
+
+    listener.fd = listenFd;
+    listener.events = POLLIN;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> guard(stopLock);
+            if (stopping) break;
+        }
+
+        /* Wake up now and then to notice metricsStop() */
+        if (poll(&listener, 1, 250) <= 0)
+            continue;
+
+        clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientFd == -1)
+            continue;
+
+        /* Peek at the request without waiting long for one */
+        listener.fd = clientFd;
+        bytes = 0;
+        if (poll(&listener, 1, 100) > 0)
+            bytes = recv(clientFd, request, sizeof(request), MSG_DONTWAIT);
+        listener.fd = listenFd;
+
+        text = metricsPrometheus();
+        if ((bytes >= 4) && (memcmp(request, "GET ", 4) == 0))
+        {
+            std::stringstream http;
+
+            http << "HTTP/1.0 200 OK\r\n";
+            http << "Content-Type: text/plain; version=0.0.4\r\n";
+            http << "Content-Length: " << text.size() << "\r\n\r\n";
+            text = http.str() + text;
+        }
+
+        /* If the scraper already went away there's nothing to do */
+        send(clientFd, text.data(), text.size(), MSG_NOSIGNAL);
+        close(clientFd);
+    } /* End for */
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+}
+
+bool metricsStartSocket(const char *socketPath)
+{
+    struct sockaddr_un addr;
+    int listenFd = -1;
+
+    if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+        std::cout << "Socket path '" << socketPath << "' is too long";
+        std::cout << std::endl;
+        return false;
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    unlink(socketPath);
+
+    if ( (listenFd == -1) ||
+        (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (listen(listenFd, 16) == -1) )
+    {
+        std::cout << "Unable to listen on '" << socketPath << "': ";
+        std::cout << strerror(errno) << std::endl;
+        if (listenFd != -1) close(listenFd);
+        return false;
+    }
+
+    exporters.push_back(std::thread(socketMain, listenFd, std::string(socketPath)));
+    return true;
+}
+
+void metricsStop(void)
+{
+    uint32_t i = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(stopLock);
+        stopping = true;
+    }
+    stopSignal.notify_all();
+
+    for (i = 0; i < exporters.size(); i++)
+        exporters[i].join();
+    exporters.clear();
+}
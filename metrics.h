@@ -0,0 +1,87 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <time.h>
+
+/* Process-wide counters and latency histograms. Each thread updates
+ * its own slot with plain relaxed stores (no locked instructions, no
+ * shared cache lines). A thread's counts are folded into retired totals
+ * when it exits and its slot reused, so readers only sum the slots of
+ * live threads when rendering. */
+
+typedef enum {
+    METRIC_PACKS_LOADED = 0,    /* Packs successfully loaded */
+    METRIC_LOAD_ERRORS,         /* Packs rejected at load time */
+    METRIC_BYTES_LOADED,        /* Pack bytes read */
+    METRIC_BYTES_VERIFIED,      /* Bytes summed by calcCRC() */
+    METRIC_CONTENTS,            /* Headers found */
+    METRIC_CHECKSUM_MISMATCHES, /* Headers whose checksum didn't match */
+    METRIC_REQUESTS,            /* Daemon requests received */
+    METRIC_CACHE_HITS,          /* Scans answered from the scan cache */
+    METRIC_CACHE_MISSES,        /* Cacheable scans that had to be done */
+    METRIC_COUNT
+} Metric_t;
+
+typedef enum {
+    PHASE_LOAD = 0,
+    PHASE_ANALYZE,
+    PHASE_CHECKSUM,
+    PHASE_REPORT,
+    PHASE_COUNT
+} Phase_t;
+
+extern void metricAdd(const Metric_t metric, const uint64_t amount);
+extern void metricObserve(const Phase_t phase, const uint64_t nanoseconds);
+
+/* Sampled when rendering, e.g. the worker pool's queue depth */
+extern void metricsSetQueueDepthSource(const std::function<size_t(void)> &source);
+
+/* Prometheus text exposition format (version 0.0.4) */
+extern std::string metricsPrometheus(void);
+
+/* Rewrite FILE atomically every interval seconds from a background
+ * thread (for the node_exporter textfile collector, for example). */
+extern void metricsStartFileDump(const char *filename, const unsigned int interval);
+
+/* Answer every connection on a Unix socket with the current metrics;
+ * plain HTTP GETs get an HTTP response so it can be scraped directly. */
+extern bool metricsStartSocket(const char *socketPath);
+
+extern void metricsStop(void);
+
+/* Times a scope and records it against a phase */
+class PhaseTimer {
+public:
+    PhaseTimer(const Phase_t phase) : mPhase(phase)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &mStart);
+    }
+
+    ~PhaseTimer()
+    {
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        metricObserve(mPhase, ((uint64_t)(end.tv_sec - mStart.tv_sec) *
+            1000000000ULL) + end.tv_nsec - mStart.tv_nsec);
+    }
+
+private:
+    Phase_t mPhase;
+    struct timespec mStart;
+};
+
+#endif /* __METRICS_H__ */
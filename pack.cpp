@@ -9,119 +9,1035 @@
  ***************************************************************/
 
 #include <string.h>
+#include <stdlib.h>
 #include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include <fstream>
 #include <streambuf>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include "pack.h"
+#include "hash.h"
+#include "content_index.h"
+#include "entropy.h"
+#include "json.h"
+#include "metrics.h"
+#include "buffer_pool.h"
 #include "shiftjis_conv.h"
+#include "inflate.h"
 
-Pack::Pack(const char *filename) : 
-    mIsLoaded(false), mPackSize(INVALID) 
+Pack::Pack(const char *filename, const IoPolicy_t policy) : 
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(false), mIsLoaded(false), mFromCache(false), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false) 
 {
+    PhaseTimer timer(PHASE_LOAD);
     struct stat fileStat;
-    int retVal = 0;
+    bool loaded = false;
 
-    mPackData.empty();
-    retVal = stat(filename, &fileStat);
+    mFilename = std::string(filename);
+    if (!statFile(&fileStat))
+        return;
+
+    /* A file that isn't a dump's size may be a compressed dump */
+    if ((fileStat.st_size != SIZE_8M) && (fileStat.st_size != SIZE_32M))
+        loaded = loadCompressed(fileStat.st_size);
+    else
+    {
+        /* Load file data the way we were asked to */
+        checkSize(fileStat.st_size);
+        mPolicy = policy;
+        switch (mPolicy)
+        {
+            case IO_FADVISE:
+            case IO_URING:
+                loaded = loadRead(false);
+                break;
+
+            case IO_HUGEPAGE:
+                loaded = loadRead(true);
+                break;
+
+            case IO_MMAP:
+                loaded = loadMap();
+                break;
+
+            case IO_DIRECT:
+                loaded = loadDirect();
+                break;
+
+            default:
+                loaded = loadStream();
+        } /* End switch */
+    }
+
+    /* The file may have changed since we stat()'d it */
+    if (!loaded)
+    {
+        if (mError == PACK_OK)
+            fail(PACK_ERR_IO, "Unable to read file '" + mFilename + "'");
+        return;
+    }
+
+    /* Done! */
+    mIsLoaded = true;
+    metricAdd(METRIC_PACKS_LOADED, 1);
+    metricAdd(METRIC_BYTES_LOADED, mPackSize);
+}
+
+Pack::Pack(const char *filename, const Region_t &region, const IoPolicy_t policy) :
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(false), mIsLoaded(false), mFromCache(false), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false)
+{
+    PhaseTimer timer(PHASE_LOAD);
+    std::stringstream label;
+    std::stringstream message;
+    struct stat fileStat;
+    uint64_t length = region.length;
 
+    mFilename = std::string(filename);
+    if (!statFile(&fileStat))
+        return;
+
+    label << filename << "@0x" << std::hex << std::uppercase << region.offset;
+    if (region.length)
+        label << "+0x" << region.length;
+    mFilename = label.str();
+
+    if (!length && (region.offset < (uint64_t)fileStat.st_size))
+        length = fileStat.st_size - region.offset;
+    if ( (region.offset >= (uint64_t)fileStat.st_size) ||
+        (length > ((uint64_t)fileStat.st_size - region.offset)) )
+    {
+        message << "Region '" << mFilename << "' runs past the end of the file (";
+        message << fileStat.st_size << " bytes)";
+        fail(PACK_ERR_SIZE, message.str());
+        return;
+    }
+    if (!isDumpSize(length))
+    {
+        checkSize(length);
+        return;
+    }
+
+    mPolicy = policy;
+    if (!loadRegion(filename, region.offset, length))
+    {
+        if (mError == PACK_OK)
+            fail(PACK_ERR_IO, "Unable to read file '" + std::string(filename) + "'");
+        return;
+    }
+
+    /* Done! */
+    mIsLoaded = true;
+    metricAdd(METRIC_PACKS_LOADED, 1);
+    metricAdd(METRIC_BYTES_LOADED, mPackSize);
+}
+
+/* stat() the dump, which has to be a regular file */
+bool Pack::statFile(struct stat *fileStat)
+{
     /* Can we stat() the file? */
-    if (retVal == -1) {
+    if (stat(mFilename.c_str(), fileStat) == -1) {
         switch(errno) {
             case EACCES:
-                std::cout << "Unable to access file '" << filename;
-                std::cout << "': Access denied" << std::endl;
-	        return;
+                fail(PACK_ERR_ACCESS, "Unable to access file '" + mFilename +
+                    "': Access denied");
+	        return false;
 
 	    case ENOENT:
-                std::cout << "Unable to access file '" << filename;
-                std::cout << "': Path doesn't exist" << std::endl;
-	        return;
+                fail(PACK_ERR_NOT_FOUND, "Unable to access file '" + mFilename +
+                    "': Path doesn't exist");
+	        return false;
 
             default:
-                std::cout << "Unable to access file '" << filename;
-                std::cout << "': Error opening file" << std::endl;
-	        return;
+                fail(PACK_ERR_IO, "Unable to access file '" + mFilename +
+                    "': Error opening file");
+	        return false;
         } /* End case */
     } /* End if */
 
     /* Is the file an actual file? */
-    if ((fileStat.st_mode & S_IFMT) != S_IFREG) 
+    if ((fileStat->st_mode & S_IFMT) != S_IFREG) 
     {
-        std::cout << "Unable to access file '" << filename;
-        std::cout << "': Not a file" << std::endl;
-	return;
+        fail(PACK_ERR_NOT_FILE, "Unable to access file '" + mFilename +
+            "': Not a file");
+	return false;
     }
+    return true;
+}
 
-    /* Is the file the right size for a valid dump? */
-    switch(fileStat.st_size) 
+Pack::Pack(const uint8_t *data, const size_t size, const char *name) :
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(false), mIsLoaded(false), mFromCache(false), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false)
+{
+    bool compressed = false;
+
+    mFilename = std::string(name ? name : "(memory)");
+
+    /* A compressed dump is inflated into a buffer of our own */
+    if (!inflateDump(data, size, &compressed))
     {
-        case SIZE_8M:
-        case SIZE_32M:
-            mPackSize = static_cast<Pack::PackSize_t>(fileStat.st_size);
-	    break;
+        if (compressed || !fitSize(data, size))
+            return;
+
+        /* The caller owns the buffer and must keep it around. A truncated
+         * dump needs room for the rest of the pack, so that one is copied. */
+        if (geometry() == GEOMETRY_TRUNCATED)
+        {
+            mPackData = BufferPool::acquire(mPackSize);
+            mPooled = true;
+            memcpy(&mPackData[0], data, size);
+            memset(&mPackData[size], 0xFF, mPackSize - size);
+            mData = &mPackData[0];
+        }
+        else
+            mData = data;
+    }
+    mIsLoaded = true;
+    metricAdd(METRIC_PACKS_LOADED, 1);
+    metricAdd(METRIC_BYTES_LOADED, mPackSize);
+}
+
+Pack::Pack(std::vector<uint8_t> &&data, const char *name) :
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(false), mIsLoaded(false), mFromCache(false), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false)
+{
+    bool compressed = false;
+
+    mFilename = std::string(name ? name : "(memory)");
+    if (!inflateDump(data.data(), data.size(), &compressed))
+    {
+        if (compressed || !fitSize(data.data(), data.size()))
+            return;
+
+        mPackData = std::move(data);
+        if (mPackData.size() < (size_t)mPackSize)
+            mPackData.resize(mPackSize, 0xFF);
+        mData = &mPackData[0];
+    }
+    mIsLoaded = true;
+    metricAdd(METRIC_PACKS_LOADED, 1);
+    metricAdd(METRIC_BYTES_LOADED, mPackSize);
+}
+
+/* Takes over a BufferPool buffer filled by someone else's reader */
+Pack::Pack(std::vector<uint8_t> &&pooled, const size_t size, const char *name) :
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(true), mIsLoaded(false), mFromCache(false), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false)
+{
+    std::vector<uint8_t> source;
+    bool compressed = false;
+    bool ok = false;
+
+    mFilename = std::string(name ? name : "(memory)");
+    mPackData = std::move(pooled);
+    if (size > mPackData.size())
+    {
+        fail(PACK_ERR_IO, "Unable to read file '" + mFilename + "'");
+        return;
+    }
+
+    /* A compressed dump is inflated into a second pooled buffer, and
+     * the one it arrived in goes back */
+    source.swap(mPackData);
+    mPooled = false;
+    ok = inflateDump(source.data(), size, &compressed);
+    if (compressed)
+    {
+        BufferPool::release(std::move(source));
+        if (!ok)
+            return;
+    }
+    else
+    {
+        mPackData.swap(source);
+        mPooled = true;
+        if (!fitSize(&mPackData[0], size))
+            return;
+        if (size < (size_t)mPackSize)
+        {
+            if (mPackData.size() < (size_t)mPackSize)
+                mPackData.resize(mPackSize);
+            memset(&mPackData[size], 0xFF, mPackSize - size);
+        }
+        mData = &mPackData[0];
+    }
+
+    mIsLoaded = true;
+    metricAdd(METRIC_PACKS_LOADED, 1);
+    metricAdd(METRIC_BYTES_LOADED, mPackSize);
+}
+
+/* Restored from the scan cache: headers and page map, no contents */
+Pack::Pack(void) :
+    mData(NULL), mPolicy(IO_STREAM), mMap(NULL), mMapLength(0), mMapFd(-1),
+    mPooled(false), mIsLoaded(false), mFromCache(true), mPackSize(INVALID),
+    mDumpSize(0), mError(PACK_OK), mSummedBlocks(0), mOrphansScanned(false)
+{
+}
+
+Pack::~Pack()
+{
+    if (mMap) munmap(mMap, mMapLength);
+    if (mMapFd != -1)
+    {
+        /* Done with it; don't let it crowd out the next dump */
+        posix_fadvise(mMapFd, 0, 0, POSIX_FADV_DONTNEED);
+        close(mMapFd);
+    }
+    if (mPooled) BufferPool::release(std::move(mPackData));
+}
+
+static const char *IO_POLICY_NAMES[Pack::IO_POLICY_COUNT] = {
+    "stream", "fadvise", "hugepage", "mmap", "direct", "uring"
+};
+
+/* O_DIRECT buffers, offsets and lengths must be aligned to the logical
+ * block size of the device; a page covers every device we care about */
+#define DIRECT_ALIGN 0x1000
+
+bool Pack::parseIoPolicy(const char *name, IoPolicy_t *policy)
+{
+    int i = 0;
+
+    for (i = 0; i < IO_POLICY_COUNT; i++)
+    {
+        if (strcmp(name, IO_POLICY_NAMES[i]) == 0)
+        {
+            *policy = static_cast<IoPolicy_t>(i);
+            return true;
+        }
+    } /* End for */
+    return false;
+}
+
+const char *Pack::ioPolicyName(const IoPolicy_t policy)
+{
+    return IO_POLICY_NAMES[policy];
+}
+
+/* Start the kernel reading a dump we're about to load */
+void Pack::prefetch(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+bool Pack::loadStream(void)
+{
+    std::ifstream str(mFilename.c_str(), std::ios::binary);
+
+    mPackData = BufferPool::acquire(mPackSize);
+    mPooled = true;
+    str.read(reinterpret_cast<char *>(&mPackData[0]), mPackSize);
+    if ((str.gcount() != mPackSize) || (str.peek() != EOF))
+        return false;
+
+    mData = &mPackData[0];
+    return true;
+}
+
+bool Pack::loadRead(const bool hugePages)
+{
+    int fd = open(mFilename.c_str(), O_RDONLY | O_CLOEXEC);
+    ssize_t bytes = 0;
+    size_t done = 0;
+    char extra = 0;
+
+    if (fd == -1) return false;
+
+    /* Ask for aggressive readahead; we read front to back exactly once */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    mPackData = BufferPool::acquire(mPackSize, hugePages);
+    mPooled = true;
+
+    while (done < (size_t)mPackSize)
+    {
+        bytes = read(fd, &mPackData[done], mPackSize - done);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            break;
+        done += bytes;
+    } /* End while */
+
+    /* Short, or grown since we stat()'d it */
+    if ((done != (size_t)mPackSize) || (read(fd, &extra, 1) != 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    /* We have our own copy now; the page cache doesn't need one */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    mData = &mPackData[0];
+    return true;
+}
+
+bool Pack::loadDirect(void)
+{
+    int fd = open(mFilename.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    uint8_t *buffer = NULL;
+    ssize_t bytes = 0;
+    size_t done = 0;
+
+    /* tmpfs and some network filesystems refuse O_DIRECT outright */
+    if ((fd == -1) && (errno == EINVAL))
+        return loadRead(false);
+    if (fd == -1) return false;
+
+    /* Room to align the start, plus one block to probe for growth */
+    mPackData = BufferPool::acquire(mPackSize + (2 * DIRECT_ALIGN));
+    mPooled = true;
+    buffer = reinterpret_cast<uint8_t *>(
+        ((uintptr_t)&mPackData[0] + DIRECT_ALIGN - 1) &
+        ~(uintptr_t)(DIRECT_ALIGN - 1));
+
+    while (done <= (size_t)mPackSize)
+    {
+        bytes = read(fd, buffer + done, DIRECT_ALIGN + mPackSize - done);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            break;
+        done += bytes;
+    } /* End while */
+    close(fd);
+
+    /* Others accept the open() but fail the read() */
+    if ((bytes == -1) && (errno == EINVAL) && (done == 0))
+    {
+        BufferPool::release(std::move(mPackData));
+        mPooled = false;
+        return loadRead(false);
+    }
+
+    /* Short, or grown since we stat()'d it */
+    if (done != (size_t)mPackSize)
+        return false;
+
+    mData = buffer;
+    return true;
+}
+
+bool Pack::loadMap(void)
+{
+    struct stat fileStat;
+    void *map = NULL;
+
+    mMapFd = open(mFilename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (mMapFd == -1) return false;
+
+    /* A mapping can't notice the file changing size; check up front */
+    if ((fstat(mMapFd, &fileStat) == -1) || (fileStat.st_size != mPackSize))
+        return false;
+
+    map = mmap(NULL, mPackSize, PROT_READ, MAP_PRIVATE, mMapFd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    /* Hints only; older kernels may refuse some of them */
+    madvise(map, mPackSize, MADV_SEQUENTIAL);
+    madvise(map, mPackSize, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    madvise(map, mPackSize, MADV_HUGEPAGE);
+#endif
+
+    mMap = map;
+    mMapLength = mPackSize;
+    mData = static_cast<const uint8_t *>(map);
+    return true;
+}
+
+/* Only the window is touched: a mapping that starts on the page the
+ * region starts in, or a pread() of exactly the region */
+bool Pack::loadRegion(const char *filename, const uint64_t offset,
+    const uint64_t length)
+{
+    const uint64_t slack = offset % sysconf(_SC_PAGESIZE);
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    const uint8_t *data = NULL;
+    void *map = NULL;
+    ssize_t bytes = 0;
+    size_t done = 0;
+
+    if (fd == -1) return false;
+
+    if (mPolicy == IO_MMAP)
+    {
+        map = mmap(NULL, length + slack, PROT_READ, MAP_PRIVATE, fd,
+            offset - slack);
+        close(fd);
+        if (map == MAP_FAILED)
+            return false;
+        madvise(map, length + slack, MADV_SEQUENTIAL);
+        mMap = map;
+        mMapLength = length + slack;
+        data = static_cast<const uint8_t *>(map) + slack;
+        if (!fitSize(data, length))
+            return false;
+        if (geometry() != GEOMETRY_TRUNCATED)
+        {
+            mData = data;
+            return true;
+        }
+
+        /* A truncated one needs room for the rest of the pack */
+        mPackData = BufferPool::acquire(mPackSize);
+        mPooled = true;
+        memcpy(&mPackData[0], data, length);
+        memset(&mPackData[length], 0xFF, mPackSize - length);
+        munmap(mMap, mMapLength);
+        mMap = NULL;
+        mData = &mPackData[0];
+        return true;
+    }
+
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+    mPackData = BufferPool::acquire(length);
+    mPooled = true;
+    while (done < length)
+    {
+        bytes = pread(fd, &mPackData[done], length - done, offset + done);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            break;
+        done += bytes;
+    } /* End while */
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    if ((done != length) || !fitSize(&mPackData[0], length))
+        return false;
+    if (length < (uint64_t)mPackSize)
+    {
+        if (mPackData.size() < (size_t)mPackSize)
+            mPackData.resize(mPackSize);
+        memset(&mPackData[length], 0xFF, mPackSize - length);
+    }
+    mData = &mPackData[0];
+    return true;
+}
+
+/* A dump file that isn't 8M or 32M: compressed, or an overdump or
+ * truncated dump if anything */
+bool Pack::loadCompressed(const uint64_t fileSize)
+{
+    void *map = NULL;
+    int fd = -1;
+    bool compressed = false;
+    bool ok = false;
+
+    if (fileSize == 0)
+        return checkSize(fileSize);
+
+    fd = open(mFilename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, fileSize, MADV_SEQUENTIAL);
+
+    ok = inflateDump(static_cast<const uint8_t *>(map), fileSize, &compressed);
+    if (!compressed)
+        return loadOddSize(map, fileSize);
+    munmap(map, fileSize);
+    return ok;
+}
+
+/* gzip and zlib dumps are inflated straight into a pooled buffer. Each
+ * block is summed for the checksums as soon as it has been written, so
+ * the sums are taken while the block is still in cache instead of in a
+ * second pass over the whole pack. Files and buffers alike come through
+ * here; *compressed is cleared for anything that isn't compressed, which
+ * is left for the caller to load as it is. A dump's worth of raw data can
+ * start with what looks like a zlib header, so a dump-sized one that
+ * doesn't inflate is left to the caller too. */
+bool Pack::inflateDump(const uint8_t *data, const size_t size, bool *compressed)
+{
+    std::stringstream message;
+    Compression_t format = COMPRESSION_NONE;
+    std::string reason;
+    size_t produced = 0;
+    bool ok = false;
+
+    /* A dump of exactly a pack's size is taken as it is */
+    *compressed = false;
+    if (!data || (size == SIZE_8M) || (size == SIZE_32M))
+        return false;
+
+    format = detectCompression(data, size);
+    switch (format)
+    {
+        case COMPRESSION_NONE:
+            return false;
+
+        case COMPRESSION_ZSTD:
+            if (isDumpSize(size))
+                return false;
+            *compressed = true;
+            fail(PACK_ERR_FORMAT, "Dump '" + mFilename +
+                "' is zstd compressed, which isn't supported");
+            return false;
 
         default:
-            std::cout <<"Dump '" << filename << "' is invalid size (";
-            std::cout << fileStat.st_size << " bytes)" << std::endl;
-	    return;
+            break;
+    } /* End switch */
+
+    *compressed = true;
+    mPackData = BufferPool::acquire(SIZE_32M);
+    mPooled = true;
+    mData = &mPackData[0];
+    ok = inflateStream(data, size, format,
+        std::bind(&Pack::inflated, this, std::placeholders::_1,
+        std::placeholders::_2, &produced), &reason);
+    mData = NULL;
+
+    if (!ok && isDumpSize(size))
+    {
+        BufferPool::release(std::move(mPackData));
+        mPackData.clear();
+        mPooled = false;
+        mSummedBlocks = 0;
+        *compressed = false;
+        return false;
+    }
+    if (!ok && (produced > SIZE_32M))
+    {
+        message << "Dump '" << mFilename << "' is invalid size (more than ";
+        message << SIZE_32M << " bytes decompressed)";
+        fail(PACK_ERR_SIZE, message.str());
+        return false;
+    }
+    if (!ok)
+    {
+        fail(PACK_ERR_FORMAT, "Dump '" + mFilename + "' is not valid " +
+            compressionName(format) + " data: " + reason);
+        return false;
     }
+    if (!fitSize(&mPackData[0], produced))
+        return false;
+    if (produced < (size_t)mPackSize)
+        memset(&mPackData[produced], 0xFF, mPackSize - produced);
 
-    /* Load file data into mPackData */
-    mFilename = std::string(filename);
-    std::ifstream str(filename);
-    mPackData.reserve(mPackSize);
-    mPackData.assign((std::istreambuf_iterator<char>(str)), 
-        std::istreambuf_iterator<char>());
+    /* Done! */
+    mData = &mPackData[0];
+    return true;
+}
+
+/* An uncompressed dump that isn't 8M or 32M, still mapped */
+bool Pack::loadOddSize(void *map, const uint64_t fileSize)
+{
+    const uint8_t *data = static_cast<const uint8_t *>(map);
+
+    if (!fitSize(data, fileSize))
+    {
+        munmap(map, fileSize);
+        return false;
+    }
+
+    /* An overdump keeps its first copy mapped and lets go of the rest */
+    if (geometry() == GEOMETRY_MIRRORED)
+    {
+        munmap(static_cast<uint8_t *>(map) + mPackSize, fileSize - mPackSize);
+        mMap = map;
+        mMapLength = mPackSize;
+        mData = data;
+        return true;
+    }
+
+    /* A truncated one needs room for the rest of the pack */
+    mPackData = BufferPool::acquire(mPackSize);
+    mPooled = true;
+    memcpy(&mPackData[0], data, fileSize);
+    memset(&mPackData[fileSize], 0xFF, mPackSize - fileSize);
+    munmap(map, fileSize);
+    mData = &mPackData[0];
+    return true;
+}
+
+/* Inflate sink: append to the pack, summing each block as it fills */
+bool Pack::inflated(const uint8_t *data, const size_t length, size_t *produced)
+{
+    uint32_t block = 0;
+
+    if (length > SIZE_32M - *produced)
+    {
+        *produced = SIZE_32M + 1;
+        return false;
+    }
+    memcpy(&mPackData[*produced], data, length);
+    *produced += length;
+
+    /* Sum the blocks this piece completed while they're still hot */
+    for (block = (*produced - length) / PACK_BLOCK_SIZE;
+        block < (*produced / PACK_BLOCK_SIZE); block++)
+        blockSum(block);
+    return true;
+}
+
+/* Cache payload layout, native byte order:
+ *   uint32_t packSize, then the size of the dump it came from
+ *   uint32_t block count, then one erased page mask per block
+ *   uint32_t header count, then the Header_t structs as analyzed */
+std::string Pack::serialize(void) const
+{
+    std::string payload;
+    uint32_t value = 0;
+
+    value = mPackSize;
+    payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    value = mDumpSize;
+    payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    value = mErasedPages.size();
+    payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    payload.append(reinterpret_cast<const char *>(mErasedPages.data()),
+        mErasedPages.size() * sizeof(uint32_t));
+    value = mBlockHeader.size();
+    payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    payload.append(reinterpret_cast<const char *>(mBlockHeader.data()),
+        mBlockHeader.size() * sizeof(Header_t));
+    return payload;
+}
+
+Pack *Pack::fromCache(const char *filename, const std::string &payload)
+{
+    Pack *pack = new Pack();
+
+    pack->mFilename = std::string(filename);
+    if (!pack->restore(payload))
+    {
+        delete pack;
+        return NULL;
+    }
+    return pack;
+}
+
+/* Never loaded: for inputs that failed before there was a dump to
+ * read, such as a broken archive member */
+Pack *Pack::fromError(const char *name, const PackError_t error,
+    const std::string &message)
+{
+    Pack *pack = new Pack();
+
+    pack->mFilename = std::string(name);
+    pack->mFromCache = false;
+    pack->fail(error, message);
+    return pack;
+}
+
+bool Pack::restore(const std::string &payload)
+{
+    const char *ptr = payload.data();
+    const char *end = ptr + payload.size();
+    uint32_t value = 0;
+    uint32_t i = 0;
+    uint64_t used = 0;
+
+    /* Pack size */
+    if ((end - ptr) < (ptrdiff_t)sizeof(value)) return false;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    if ((value != SIZE_8M) && (value != SIZE_32M)) return false;
+    mPackSize = static_cast<PackSize_t>(value);
+
+    /* Dump size */
+    if ((end - ptr) < (ptrdiff_t)sizeof(value)) return false;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    if (!isDumpSize(value)) return false;
+    mDumpSize = value;
+
+    /* Erased page masks */
+    if ((end - ptr) < (ptrdiff_t)sizeof(value)) return false;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    if ( (value != (uint32_t)(mPackSize / PACK_BLOCK_SIZE)) ||
+        ((end - ptr) < (ptrdiff_t)(value * sizeof(uint32_t))) )
+        return false;
+    mErasedPages.resize(value);
+    memcpy(mErasedPages.data(), ptr, value * sizeof(uint32_t));
+    ptr += value * sizeof(uint32_t);
+
+    /* Analyzed headers */
+    if ((end - ptr) < (ptrdiff_t)sizeof(value)) return false;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    if ((end - ptr) != (ptrdiff_t)(value * sizeof(Header_t))) return false;
+    mBlockHeader.resize(value);
+    memcpy(mBlockHeader.data(), ptr, value * sizeof(Header_t));
+
+    /* Rebuild block ownership the same way analyze() does */
+    for (i=0; i < mErasedPages.size(); i++)
+        if (mErasedPages[i] != 0xFFFFFFFF)
+            used |= ((uint64_t)1 << i);
+    mAlloc.reset(mErasedPages.size(), used);
+    for (i=0; i < mBlockHeader.size(); i++)
+        mAlloc.addContent(blockMask(&(mBlockHeader[i])));
 
     /* Done! */
     mIsLoaded = true;
+    return true;
 }
 
-Pack::~Pack()
+uint64_t Pack::contentHash(void) const
 {
-    if (mIsLoaded) mPackData.empty();
+    if (!mData) return 0;
+    return hash64(mData, mPackSize, 0);
 }
 
-void Pack::analyze(void) 
+bool Pack::checkSize(const uint64_t size)
+{
+    std::stringstream message;
+
+    switch(size) 
+    {
+        case SIZE_8M:
+        case SIZE_32M:
+            mPackSize = static_cast<Pack::PackSize_t>(size);
+            mDumpSize = size;
+	    return true;
+
+        default:
+            message << "Dump '" << mFilename << "' is invalid size (";
+            message << size << " bytes)";
+            fail(PACK_ERR_SIZE, message.str());
+	    return false;
+    }
+}
+
+bool Pack::isDumpSize(const uint64_t size)
+{
+    uint64_t copies = 0;
+
+    if ((size == 0) || (size % PACK_BLOCK_SIZE) || (size > PACK_MAX_DUMP))
+        return false;
+    if (size <= SIZE_32M)
+        return true;
+
+    /* Overdumps repeat the pack a power of two times */
+    copies = size / SIZE_8M;
+    return ((size % SIZE_8M) == 0) && !(copies & (copies - 1));
+}
+
+uint32_t Pack::headerBlocks(const PackSize_t size)
+{
+    /* One probe per 64 KB bank, for as many banks as there are blocks */
+    return (uint32_t)(((uint64_t)1 << ((size / PACK_BLOCK_SIZE) / 2)) - 1);
+}
+
+uint32_t Pack::claimableBlocks(const PackSize_t size)
+{
+    switch (size)
+    {
+        case SIZE_8M:
+        case SIZE_32M:
+            return 0xFF;
+
+        default:
+            return 0;
+    } /* End switch */
+}
+
+bool Pack::mayHoldDump(const uint64_t size)
+{
+    return isDumpSize(size) || ((size > 0) && (size <= PACK_MAX_DUMP));
+}
+
+Pack::Geometry_t Pack::geometry(void) const
 {
+    if (mDumpSize > (uint64_t)mPackSize)
+        return GEOMETRY_MIRRORED;
+    if (mDumpSize < (uint64_t)mPackSize)
+        return GEOMETRY_TRUNCATED;
+    return GEOMETRY_EXACT;
+}
+
+/* Works out which pack a dump of any size holds. Each block is hashed
+ * once, and the dump is an overdump if the hashes repeat with a period
+ * of 8M or 32M all the way through; otherwise a dump short of 32M is
+ * taken as the start of the smallest pack it fits in. */
+bool Pack::fitSize(const uint8_t *data, const uint64_t size)
+{
+    std::stringstream message;
+    std::vector<uint64_t> hashes;
+    const uint32_t blocks = size / PACK_BLOCK_SIZE;
+    uint32_t period = 0;
     uint32_t i = 0;
-    uint32_t totalBlocks = 0;
-    Header_t header;
 
-    if (!mIsLoaded) {
-        mBlockHeader.empty();	    
+    if ((size == SIZE_8M) || (size == SIZE_32M) || !data || !isDumpSize(size))
+        return checkSize(size);
+
+    hashes.resize(blocks);
+    for (i = 0; i < blocks; i++)
+        hashes[i] = hash64(&data[i * PACK_BLOCK_SIZE], PACK_BLOCK_SIZE, 0);
+
+    /* 8 blocks, then 32 */
+    for (period = SIZE_8M / PACK_BLOCK_SIZE; period < blocks; period *= 4)
+    {
+        if (blocks % period)
+            continue;
+        for (i = period; (i < blocks) && (hashes[i] == hashes[i % period]); i++);
+        if (i == blocks)
+        {
+            mPackSize = static_cast<Pack::PackSize_t>(period * PACK_BLOCK_SIZE);
+            mDumpSize = size;
+            return true;
+        }
+    } /* End for */
+
+    if (size < SIZE_32M)
+    {
+        mPackSize = (size < SIZE_8M) ? SIZE_8M : SIZE_32M;
+        mDumpSize = size;
+        return true;
+    }
+
+    message << "Dump '" << mFilename << "' is invalid size (" << size;
+    message << " bytes, and not a mirrored pack)";
+    fail(PACK_ERR_SIZE, message.str());
+    return false;
+}
+
+void Pack::fail(const PackError_t error, const std::string &message)
+{
+    mError = error;
+    mErrorMessage = message;
+    metricAdd(METRIC_LOAD_ERRORS, 1);
+}
+
+void Pack::analyze(void) 
+{
+    PhaseTimer timer(PHASE_ANALYZE);
+
+    /* A cached pack was analyzed when it went into the cache */
+    if (mFromCache)
         return;
+
+    mBlockHeader.clear();
+    if (!mIsLoaded)
+        return;
+
+    switch (mPackSize) {
+        case SIZE_8M:
+            analyzeBlocks<8>();
+            break;
+
+        case SIZE_32M:
+            analyzeBlocks<32>();
+            break;
+
+        default:
+            break;
+    } /* End switch */
+}
+
+template <uint32_t BLOCKS>
+void Pack::analyzeBlocks(void)
+{
+    const uint32_t allBlocks = (uint32_t)(((uint64_t)1 << BLOCKS) - 1);
+    uint32_t i = 0;
+    uint32_t claimed = 0;
+    uint64_t used = 0;
+
+    findHeaderBlocks<BLOCKS>();
+    for (i=0; i < mBlockHeader.size(); i++)
+        claimed |= blockMask(&(mBlockHeader[i])) & allBlocks;
+
+    /* Find out which pages actually hold data */
+    mapErased<BLOCKS>(claimed);
+
+    /* Work out who owns which blocks */
+    for (i=0; i < BLOCKS; i++)
+        if (mErasedPages[i] != 0xFFFFFFFF)
+            used |= ((uint64_t)1 << i);
+    mAlloc.reset(BLOCKS, used);
+    for (i=0; i < mBlockHeader.size(); i++)
+        mAlloc.addContent(blockMask(&(mBlockHeader[i])));
+
+    /* Checksum and fingerprint each content */
+    for (i=0; i < mBlockHeader.size(); i++)
+    {
+        mBlockHeader[i].calcChksum = calcCRC<BLOCKS>(&(mBlockHeader[i]));
+        mBlockHeader[i].digest = contentDigest(&(mBlockHeader[i]));
+        if (mBlockHeader[i].calcChksum != mBlockHeader[i].chksum)
+            metricAdd(METRIC_CHECKSUM_MISMATCHES, 1);
     }
+    metricAdd(METRIC_CONTENTS, mBlockHeader.size());
+}
+
+void Pack::findHeaders(void)
+{
+    if (mFromCache)
+        return;
+
+    mBlockHeader.clear();
+    if (!mIsLoaded)
+        return;
 
     switch (mPackSize) {
         case SIZE_8M:
-            totalBlocks = 8;
+            findHeaderBlocks<8>();
             break;
 
         case SIZE_32M:
-            totalBlocks = 32;
+            findHeaderBlocks<32>();
             break;
 
         default:
-            totalBlocks = 0;
+            break;
     } /* End switch */
+}
 
-    for (i=0; i < totalBlocks; i++) 
+template <uint32_t BLOCKS>
+void Pack::findHeaderBlocks(void)
+{
+    uint32_t i = 0;
+    Header_t header;
+
+    mBlockHeader.reserve(BLOCKS);
+    for (i=0; i < BLOCKS; i++) 
     {
         /* Check block for a header */
-        if ( validHeader(i, true, &header) )
+        if ( validHeader<BLOCKS>(i, true, &header) )
             mBlockHeader.push_back(header);
-        else if ( validHeader(i, false, &header) )
+        else if ( validHeader<BLOCKS>(i, false, &header) )
             mBlockHeader.push_back(header);
 	
     } /* End for */
 }
 
-bool Pack::validHeader(const uint32_t block, const bool LoROM, Pack::Header_t *header) 
+void Pack::identify(const ContentIndex &index)
+{
+    uint32_t i = 0;
+
+    mKnownContent.assign(mBlockHeader.size(), std::string());
+    for (i=0; i < mBlockHeader.size(); i++)
+        index.lookup(mBlockHeader[i].digest, &(mKnownContent[i]));
+}
+
+template <uint32_t BLOCKS>
+bool Pack::validHeader(const uint32_t block, const bool LoROM,
+    Pack::Header_t *header) 
 {
     uint32_t offset = 0;
     uint32_t i = 0;
@@ -137,23 +1053,23 @@ bool Pack::validHeader(const uint32_t block, const bool LoROM, Pack::Header_t *h
 
     /* Copy licensee */
     for (i=0; i < 2; i++)
-        header->licensee[i] = mPackData[offset + i + 0x00];
+        header->licensee[i] = mData[offset + i + 0x00];
 
     /* Copy program type */
     for (i=0; i < 4; i++)
-        header->programType[i] = mPackData[offset + i + 0x02];
+        header->programType[i] = mData[offset + i + 0x02];
 
     /* Copy title */
     for (i=0; i < 16; i++)
-        header->title[i] = mPackData[offset + i + 0x10];
+        header->title[i] = mData[offset + i + 0x10];
     header->title[16] = '\0';
 
     /* Copy block allocation flags */
     for (i=0; i < 4; i++)
-        header->blockAlloc[i] = mPackData[offset + i + 0x20];
+        header->blockAlloc[i] = mData[offset + i + 0x20];
   
     /* Check for valid block allocation */
-    if (mPackData.size() != SIZE_8M)
+    if (BLOCKS != 8)
     {
         if ( (header->blockAlloc[3] != 0) ||
             (header->blockAlloc[2] != 0) ||
@@ -167,27 +1083,27 @@ bool Pack::validHeader(const uint32_t block, const bool LoROM, Pack::Header_t *h
 
     /* Copy limited starts */
     for (i=0; i < 2; i++)
-        header->starts[i] = mPackData[offset + i + 0x24];
+        header->starts[i] = mData[offset + i + 0x24];
 
     /* Copy month/day */
-    header->dateMonth = mPackData[offset + 0x26];
-    header->dateDay = mPackData[offset + 0x27];
+    header->dateMonth = mData[offset + 0x26];
+    header->dateDay = mData[offset + 0x27];
 
     /* Heuristic: If the date bytes are 0xFFFF, this header is invalid */
     if ((header->dateMonth == 0xFF) && (header->dateDay == 0xFF))
         return false;
 
     /* Copy map mode */
-    header->speedMap = mPackData[offset + 0x28];
+    header->speedMap = mData[offset + 0x28];
 
     /* Copy file type */
-    header->fileType = mPackData[offset + 0x29];
+    header->fileType = mData[offset + 0x29];
 
     /* Copy the fixed maker field (modified by BS-X on download) */
-    header->maker = mPackData[offset + 0x2A];
+    header->maker = mData[offset + 0x2A];
 
     /* Check for valid version number */
-    switch(mPackData[offset + 0x2A])
+    switch(mData[offset + 0x2A])
     {
         case 0x33: /* BS-X validated (BS-X changed this to 0x33) */
         case 0xFF: /* Download data, not yet BS-X validated */ 
@@ -199,21 +1115,23 @@ bool Pack::validHeader(const uint32_t block, const bool LoROM, Pack::Header_t *h
     }
 
     /* Copy version */
-    header->version = mPackData[offset + 0x2B];
+    header->version = mData[offset + 0x2B];
 
     /* Copy inverse checksum */
-    header->invChksum = (uint8_t)mPackData[offset + 0x2C];
-    header->invChksum += ((uint8_t)mPackData[offset + 0x2D]) << 8;
+    header->invChksum = (uint8_t)mData[offset + 0x2C];
+    header->invChksum += ((uint8_t)mData[offset + 0x2D]) << 8;
 
     /* Copy checksum */
-    header->chksum = (uint8_t)mPackData[offset + 0x2E];
-    header->chksum += ((uint8_t)mPackData[offset + 0x2F]) << 8;
+    header->chksum = (uint8_t)mData[offset + 0x2E];
+    header->chksum += ((uint8_t)mData[offset + 0x2F]) << 8;
     return true;    
 }
 
-std::string Pack::generateReport(const bool color) 
+std::string Pack::generateReport(const bool color, const bool pageMap) 
 {
+    PhaseTimer timer(PHASE_REPORT);
     std::stringstream report;
+    char title[PACK_TITLE_UTF8];
     uint32_t i = 0, x = 0;
     uint32_t temp = 0;
     uint16_t tempCRC = 0;
@@ -243,6 +1161,97 @@ std::string Pack::generateReport(const bool color)
     report << mFilename << std::endl;
     report << colorLabel << "MEMORY PACK SIZE:     " << colorReset;
     report << mPackSize << " bytes" << std::endl;
+    if (geometry() != GEOMETRY_EXACT)
+    {
+        report << colorLabel << "DUMP GEOMETRY:        " << colorReset;
+        report << mDumpSize << " bytes, ";
+        if (geometry() == GEOMETRY_MIRRORED)
+            report << (mDumpSize / mPackSize) << " mirrored copies";
+        else
+            report << "truncated (the rest reads as erased)";
+        report << std::endl;
+    }
+
+    temp = mAlloc.claimedMask();
+    report << colorLabel << "FLASH OCCUPANCY:      " << colorReset << "[";
+    for (x=0; x < mErasedPages.size(); x++)
+    {
+        if ( (temp >> x) & 0x1 )
+        {
+            if (mErasedPages[x] == 0xFFFFFFFF)
+                report << colorBad << "!" << colorReset; /* Claimed, blank */
+            else
+                report << "X";
+        }
+        else if (mErasedPages[x] != 0xFFFFFFFF)
+            report << colorBad << "?" << colorReset;     /* Unclaimed, dirty */
+        else
+            report << ".";
+    } /* End for */
+    report << "]" << std::endl;
+    report << "                      (X=in use .=erased !=claimed/erased ";
+    report << "?=unclaimed/has data)" << std::endl;
+
+    report << colorLabel << "ALLOCATED BLOCKS:     " << colorReset;
+    report << mAlloc.claimedBlocks() << " of " << mAlloc.totalBlocks();
+    report << " (" << std::fixed << std::setprecision(1);
+    report << mAlloc.utilization() << "%)" << std::endl;
+    report << colorLabel << "FREE EXTENTS:         " << colorReset;
+    report << mAlloc.freeExtents() << " (largest ";
+    report << mAlloc.largestFreeExtent() << " blocks)" << std::endl;
+    report << colorLabel << "FRAGMENTED CONTENTS:  " << colorReset;
+    report << mAlloc.fragmentedContents() << std::endl;
+    report << colorLabel << "OVERLAPPING BLOCKS:   " << colorReset;
+    if (mAlloc.overlapMask() == 0)
+        report << "None" << std::endl;
+    else
+    {
+        report << "[";
+        for (x=0; x < mAlloc.totalBlocks(); x++)
+        {
+            if ( (mAlloc.overlapMask() >> x) & 0x1 )
+                report << colorBad << "X" << colorReset;
+            else
+                report << ".";
+        } /* End for */
+        report << "]" << colorBad << " [CLAIMED BY MULTIPLE CONTENTS]";
+        report << colorReset << std::endl;
+    }
+
+    if (pageMap)
+    {
+        report << colorLabel << "PAGE OCCUPANCY:" << colorReset;
+        report << "       (#=data, .=erased)" << std::endl;
+        for (x=0; x < mErasedPages.size(); x++)
+        {
+            report << colorLabel << "    BLOCK " << std::setfill('0');
+            report << std::setw(2) << x << ":" << colorReset << "            [";
+            for (i=0; i < (PACK_BLOCK_SIZE / PACK_PAGE_SIZE); i++)
+                report << (((mErasedPages[x] >> i) & 0x1) ? "." : "#");
+            report << "]" << std::endl;
+        } /* End for */
+    }
+
+    if (!mPageClass.empty())
+    {
+        report << colorLabel << "ENTROPY PROFILE:" << colorReset;
+        report << "      (" << PROFILE_ERASED << "=erased ";
+        report << PROFILE_PADDING << "=padding " << PROFILE_TEXT << "=text ";
+        report << PROFILE_CODE << "=code/data " << PROFILE_COMPRESSED;
+        report << "=compressed)" << std::endl;
+
+        for (x=0; x < mErasedPages.size(); x++)
+        {
+            report << colorLabel << "    BLOCK " << std::setfill('0');
+            report << std::setw(2) << x << ":" << colorReset << "  ";
+            report << std::fixed << std::setprecision(2) << std::setfill(' ');
+            report << std::setw(4) << histogramEntropy(&mBlockHistogram[x * 256],
+                PACK_BLOCK_SIZE);
+            report << " bits   [" << mPageClass.substr(x *
+                (PACK_BLOCK_SIZE / PACK_PAGE_SIZE), PACK_BLOCK_SIZE /
+                PACK_PAGE_SIZE) << "]" << std::endl;
+        } /* End for */
+    }
 
     for(i=0; i < mBlockHeader.size(); i++) 
     {
@@ -253,7 +1262,7 @@ std::string Pack::generateReport(const bool color)
         report << "):" << std::endl << std::dec << std::setw(1);
 
         report << "    TITLE:" << colorReset << "                [";
-        report << sjis2utf8((char *)mBlockHeader[i].title) << "]";
+        report << decodeTitle(&(mBlockHeader[i]), title) << "]";
         report << std::endl;
 
 	report << colorLabel << "    DATE:" << colorReset;
@@ -275,7 +1284,7 @@ std::string Pack::generateReport(const bool color)
 
 	report << colorLabel << "    CALCULATED CRC:" << colorReset;
 	report << "       0x";
-        tempCRC = calcCRC(&(mBlockHeader[i]));
+        tempCRC = mBlockHeader[i].calcChksum;
         report << std::uppercase << std::setfill('0') << std::setw(4);
         report << std::hex << tempCRC << std::dec;
         if (tempCRC == mBlockHeader[i].chksum)
@@ -284,11 +1293,23 @@ std::string Pack::generateReport(const bool color)
             report << colorBad << " [DOES NOT MATCH REPORTED]";
 	report << std::endl;
 
+        if ((i < mChecksumRules.size()) && (tempCRC != mBlockHeader[i].chksum))
+        {
+            report << colorLabel << "    CHECKSUM RULE:" << colorReset;
+            if (mChecksumRules[i].empty())
+            {
+                report << "        " << colorBad << "[NO VARIANT MATCHES]";
+                report << colorReset << std::endl;
+            }
+            for (x=0; x < mChecksumRules[i].size(); x++)
+            {
+                report << (x ? "                          " : "        ");
+                report << checksumRuleName(mChecksumRules[i][x]) << std::endl;
+            } /* End for */
+        }
+
         report << colorLabel << "    BS-X MENU VISIBILITY: " << colorReset;
-	if ( ((mBlockHeader[i].chksum == 0) && 
-            (mBlockHeader[i].invChksum == 0)) || 
-            (mBlockHeader[i].maker != 0x33) ||
-            (mBlockHeader[i].starts[1] == 0x80) )
+	if ( !menuVisible(&(mBlockHeader[i])) )
             report << "No" << colorBad << " [NOT SHOWN IN MENU]";
 	else
             report << "Yes" << colorGood << " [SHOWS IN MENU]";
@@ -296,26 +1317,7 @@ std::string Pack::generateReport(const bool color)
 
 	report << std::dec << colorLabel << "    PROGRAM TYPE:";
         report << colorReset << "         ";
-        if ( !mBlockHeader[i].programType[0] &&
-            !mBlockHeader[i].programType[1] &&
-            !mBlockHeader[i].programType[3] ) {
-
-            switch (mBlockHeader[i].programType[2]) {
-                case 0x01:
-                    report << "BS-X bytecode";
-                    break;
-
-                case 0x02:
-                    report << "SA-1 code";
-                    break;
-
-                default:
-                    report << "65C816 code";
-                    break;
-            } /* End switch */
-
-        } else
-            report << "65C816 code";
+        report << programTypeName(&(mBlockHeader[i]));
         report << std::endl;
 
 	report << colorLabel << "    BOOTS REMAINING:";
@@ -357,11 +1359,8 @@ std::string Pack::generateReport(const bool color)
 
         report << colorLabel << "    BLOCK ALLOCATION:" << colorReset;
 	report << "     [";
-        temp = (mBlockHeader[i].blockAlloc[3] << 24);
-        temp |= (mBlockHeader[i].blockAlloc[2] << 16);
-	temp |= (mBlockHeader[i].blockAlloc[1] << 8);
-	temp |= (mBlockHeader[i].blockAlloc[0] << 0);
-	for (x=0; x < (uint32_t)(mPackSize / (128 * 1024)); x++)
+        temp = blockMask(&(mBlockHeader[i]));
+	for (x=0; x < mAlloc.totalBlocks(); x++)
         {
             if ( (temp >> x) & 0x1 )
                 report << "X";
@@ -370,51 +1369,798 @@ std::string Pack::generateReport(const bool color)
         } /* End for */
         
        report << "]" << std::endl;
+
+        report << colorLabel << "    CONTENT DIGEST:" << colorReset;
+        report << "       0x" << std::uppercase << std::setfill('0');
+        report << std::setw(16) << std::hex << mBlockHeader[i].digest;
+        report << std::dec << std::endl;
+
+        if (i < mKnownContent.size())
+        {
+            report << colorLabel << "    KNOWN CONTENT:" << colorReset;
+            if (mKnownContent[i].empty())
+                report << "        " << colorBad << "[NOT IN CATALOG]";
+            else
+                report << "        " << colorGood << "[" << mKnownContent[i] << "]";
+            report << colorReset << std::endl;
+        }
+    }
+
+    if (mOrphansScanned)
+    {
+        report << std::endl << colorLabel << "ORPHAN BLOCKS:" << colorReset;
+        if (mOrphans.empty())
+            report << "         None";
+        report << std::endl;
+
+        for (i=0; i < mOrphans.size(); i += (x + 1))
+        {
+            const Orphan_t *orphan = &(mOrphans[i]);
+            std::stringstream where;
+
+            /* Collapse runs of consecutive pages from the same source */
+            for (x = 0; (orphan->page != NO_PAGE) &&
+                ((i + x + 1) < mOrphans.size()); x++)
+            {
+                const Orphan_t *next = &(mOrphans[i + x + 1]);
+
+                if ( (next->block != orphan->block) ||
+                    (next->page != (orphan->page + x + 1)) ||
+                    (next->match.page != (orphan->match.page + x + 1)) ||
+                    (next->match.position != orphan->match.position) ||
+                    (next->match.label != orphan->match.label) )
+                    break;
+            } /* End for */
+
+            where << "    BLOCK " << orphan->block;
+            if (orphan->page != NO_PAGE)
+            {
+                where << ", PAGE " << orphan->page;
+                if (x) where << "-" << (orphan->page + x);
+            }
+            where << ":";
+
+            report << colorLabel << std::left << std::setfill(' ');
+            report << std::setw(26) << where.str() << std::right << colorReset;
+            if (!orphan->known)
+            {
+                report << colorBad << "[UNKNOWN]" << colorReset << std::endl;
+                continue;
+            }
+
+            report << colorGood << "[" << orphan->match.label << "]";
+            report << colorReset << " block " << (orphan->match.position + 1);
+            report << " of " << orphan->match.blockCount;
+            if (orphan->match.page != BlockIndex::NO_PAGE)
+            {
+                report << ", page " << orphan->match.page;
+                if (x) report << "-" << (orphan->match.page + x);
+            }
+            report << std::endl;
+        } /* End for */
     }
 
     return report.str();
 }
 
-uint16_t Pack::calcCRC(const Pack::Header_t *header)
+void Pack::attributeOrphans(const BlockIndex &index, const bool pages)
 {
-    uint16_t crc = 0;
-    uint32_t i = 0;
-    uint32_t x = 0;
-    uint32_t bitmask = 0;
-    uint32_t totalBlocks = mPackSize / (128 * 1024);
-    
-    bitmask =  (header->blockAlloc[3] << 24);
-    bitmask |= (header->blockAlloc[2] << 16);
-    bitmask |= (header->blockAlloc[1] << 8);
-    bitmask |= (header->blockAlloc[0] << 0);
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+    uint64_t claimed = mAlloc.claimedMask();
+    uint32_t i = 0, x = 0;
+    Orphan_t orphan;
+
+    mOrphans.clear();
+    mOrphansScanned = true;
+    if (!mIsLoaded || !mData) return;
 
     for (x = 0; x < totalBlocks; x++)
     {
-        /* Is the current block in use by this header? */
-        if ( (bitmask >> x) & 0x1 )
+        /* Only unclaimed blocks that still hold data are orphans */
+        if ( ((claimed >> x) & 0x1) || (mErasedPages[x] == 0xFFFFFFFF) )
+            continue;
+
+        orphan.block = x;
+        orphan.page = NO_PAGE;
+        orphan.known = index.lookupBlock(blockHash(x), &orphan.match);
+        if (orphan.known || !pages)
+        {
+            mOrphans.push_back(orphan);
+            continue;
+        }
+
+        /* Partially overwritten block: attribute whatever pages match */
+        for (i = 0; i < pagesPerBlock; i++)
         {
-            /* Does the current block contain the header? */
-            if ( ((x * 0x20000) < header->address) &&
-                 (((x+1) * 0x20000) > header->address) )
+            orphan.page = i;
+            if (index.lookupPage(pageHash((x * pagesPerBlock) + i),
+                &orphan.match))
             {
-                /* Calculate CRC before header location */
-                for (i = (x * 0x20000); i < header->address; i++)
-                    crc += (uint8_t)mPackData[i];
+                orphan.known = true;
+                mOrphans.push_back(orphan);
+            }
+        } /* End for */
+
+        if (!orphan.known)
+        {
+            orphan.page = NO_PAGE;
+            mOrphans.push_back(orphan);
+        }
+    } /* End for */
+}
+
+void Pack::profile(void)
+{
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+    uint32_t hist[256];
+    uint32_t x = 0, page = 0, i = 0;
+    uint32_t *blockHist = NULL;
+
+    mPageEntropy.clear();
+    mPageClass.clear();
+    mBlockHistogram.clear();
+    if (!mIsLoaded || !mData) return;
+
+    mPageEntropy.resize(totalBlocks * pagesPerBlock, 0.0f);
+    mPageClass.assign(totalBlocks * pagesPerBlock, PROFILE_ERASED);
+    mBlockHistogram.assign(totalBlocks * 256, 0);
+
+    for (x = 0; x < totalBlocks; x++)
+    {
+        blockHist = &mBlockHistogram[x * 256];
 
-                /*  Calculate CRC after header location */
-                for (i = (header->address + 0x30); i < ((x+1) * 0x20000); i++ )
-                    crc += (uint8_t)mPackData[i];
+        for (page = 0; page < pagesPerBlock; page++)
+        {
+            /* Erased pages are already known, skip reading them again */
+            if ((mErasedPages[x] >> page) & 0x1)
+            {
+                blockHist[0xFF] += PACK_PAGE_SIZE;
+                continue;
             }
-            else
+
+            memset(hist, 0, sizeof(hist));
+            byteHistogram(&mData[(x * PACK_BLOCK_SIZE) +
+                (page * PACK_PAGE_SIZE)], PACK_PAGE_SIZE, hist);
+
+            mPageEntropy[(x * pagesPerBlock) + page] =
+                histogramEntropy(hist, PACK_PAGE_SIZE);
+            mPageClass[(x * pagesPerBlock) + page] = classifyPage(hist,
+                PACK_PAGE_SIZE, mPageEntropy[(x * pagesPerBlock) + page]);
+
+            for (i = 0; i < 256; i++)
+                blockHist[i] += hist[i];
+        } /* End for */
+    } /* End for */
+}
+
+uint32_t Pack::indexBlocks(BlockIndex::Builder *builder, const bool pages,
+    const ContentIndex *index)
+{
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+    uint32_t added = 0;
+    uint32_t bitmask = 0;
+    uint32_t content = 0;
+    uint32_t position = 0;
+    uint32_t i = 0, x = 0, page = 0;
+    const Header_t *header = NULL;
+
+    if (!mData) return 0;
+
+    for (i=0; i < mBlockHeader.size(); i++)
+    {
+        header = &(mBlockHeader[i]);
+
+        /* Only learn from contents that verify cleanly */
+        if ( ((header->chksum + header->invChksum) != 0xFFFF) ||
+            (header->calcChksum != header->chksum) )
+            continue;
+
+        bitmask = blockMask(header);
+        content = builder->addContent(contentLabel(header, index),
+            __builtin_popcount(bitmask));
+
+        for (x = 0, position = 0; x < totalBlocks; x++)
+        {
+            if ( !((bitmask >> x) & 0x1) )
+                continue;
+
+            builder->addBlock(blockHash(x), content, position);
+            if (pages)
             {
-                /* Calculate CRC of entire block */
-                for (i = (x * 0x20000); i < ((x+1) * 0x20000); i++)
-                    crc += (uint8_t)mPackData[i];
+                for (page = 0; page < pagesPerBlock; page++)
+                {
+                    /* Erased pages would match everything */
+                    if ((mErasedPages[x] >> page) & 0x1)
+                        continue;
+                    builder->addPage(pageHash((x * pagesPerBlock) + page),
+                        content, position, page);
+                } /* End for */
             }
-        } /* End if */
+            position++;
+        } /* End for */
+
+        added++;
+    } /* End for */
+
+    return added;
+}
+
+std::string Pack::contentLabel(const Pack::Header_t *header,
+    const ContentIndex *index)
+{
+    std::stringstream label;
+    std::string known;
+    char title[PACK_TITLE_UTF8];
+
+    if (index && index->lookup(header->digest, &known))
+        return known;
+
+    /* Fall back on the header title and digest */
+    label << decodeTitle(header, title) << " (0x" << std::uppercase;
+    label << std::setfill('0') << std::setw(16) << std::hex;
+    label << header->digest << ")";
+    return label.str();
+}
+
+/* Decodes into the caller's PACK_TITLE_UTF8 byte buffer and returns it */
+const char *Pack::decodeTitle(const Pack::Header_t *header, char *utf8)
+{
+    char title[17];
+
+    /* sjis2utf8Into() converts in place, so work on a copy */
+    memcpy(title, header->title, sizeof(title));
+    sjis2utf8Into(title, utf8);
+    return utf8;
+}
+
+bool Pack::menuVisible(const Pack::Header_t *header)
+{
+    if ( ((header->chksum == 0) && (header->invChksum == 0)) ||
+        (header->maker != 0x33) ||
+        (header->starts[1] == 0x80) )
+        return false;
+
+    return true;
+}
+
+const char *Pack::programTypeName(const Pack::Header_t *header)
+{
+    if ( !header->programType[0] &&
+        !header->programType[1] &&
+        !header->programType[3] ) {
+
+        switch (header->programType[2]) {
+            case 0x01:
+                return "BS-X bytecode";
+
+            case 0x02:
+                return "SA-1 code";
+
+            default:
+                break;
+        } /* End switch */
+    }
+
+    return "65C816 code";
+}
+
+static const char *GEOMETRY_NAMES[] = { "exact", "mirrored", "truncated" };
+
+std::string Pack::generateJSON(void)
+{
+    PhaseTimer timer(PHASE_REPORT);
+    std::stringstream json;
+    const Header_t *header = NULL;
+    char title[PACK_TITLE_UTF8];
+    uint32_t i = 0, x = 0;
+    uint16_t tempCRC = 0;
+
+    /* One JSON object per pack, on a single line */
+    json << "{\"file\":" << jsonString(mFilename);
+    if (!mIsLoaded)
+    {
+        json << ",\"error\":" << jsonString(mErrorMessage) << "}" << std::endl;
+        return json.str();
+    }
+
+    json << ",\"size\":" << mPackSize;
+    json << ",\"dumpSize\":" << mDumpSize;
+    json << ",\"geometry\":\"" << GEOMETRY_NAMES[geometry()] << "\"";
+    json << ",\"blocks\":" << mAlloc.totalBlocks();
+
+    json << ",\"erasedPages\":[";
+    for (x=0; x < mErasedPages.size(); x++)
+        json << (x ? "," : "") << mErasedPages[x];
+    json << "]";
+
+    json << ",\"allocation\":{\"claimed\":" << mAlloc.claimedMask();
+    json << ",\"claimedBlocks\":" << mAlloc.claimedBlocks();
+    json << ",\"utilization\":" << std::fixed << std::setprecision(1);
+    json << mAlloc.utilization();
+    json << ",\"overlap\":" << mAlloc.overlapMask();
+    json << ",\"unclaimedUsed\":" << mAlloc.unclaimedUsedMask();
+    json << ",\"claimedErased\":" << mAlloc.claimedErasedMask();
+    json << ",\"freeExtents\":" << mAlloc.freeExtents();
+    json << ",\"largestFreeExtent\":" << mAlloc.largestFreeExtent();
+    json << ",\"fragmentedContents\":" << mAlloc.fragmentedContents() << "}";
+
+    json << ",\"headers\":[";
+    for (i=0; i < mBlockHeader.size(); i++)
+    {
+        header = &(mBlockHeader[i]);
+        tempCRC = header->calcChksum;
+
+        json << (i ? "," : "") << "{\"address\":" << header->address;
+        json << ",\"title\":" << jsonString(decodeTitle(header, title));
+        json << ",\"month\":" << (header->dateMonth >> 4);
+        json << ",\"day\":" << (header->dateDay >> 3);
+        json << ",\"chksum\":" << header->chksum;
+        json << ",\"invChksum\":" << header->invChksum;
+        json << ",\"calculatedChksum\":" << tempCRC;
+        json << ",\"complementOk\":";
+        json << (((header->chksum + header->invChksum) == 0xFFFF) ? "true" : "false");
+        json << ",\"checksumOk\":";
+        json << ((tempCRC == header->chksum) ? "true" : "false");
+        if ((i < mChecksumRules.size()) && (tempCRC != header->chksum))
+        {
+            json << ",\"checksumRules\":[";
+            for (x=0; x < mChecksumRules[i].size(); x++)
+                json << (x ? "," : "") << jsonString(checksumRuleName(
+                    mChecksumRules[i][x]));
+            json << "]";
+        }
+        json << ",\"menuVisible\":" << (menuVisible(header) ? "true" : "false");
+        json << ",\"programType\":" << jsonString(programTypeName(header));
+        json << ",\"bootsRemaining\":";
+        if (header->starts[1] & 0x80)
+            json << ((header->starts[1] >> 2) & 0x1F);
+        else
+            json << "null";
+        json << ",\"hiROM\":" << ((header->speedMap & 1) ? "true" : "false");
+        json << ",\"fastROM\":" << (((header->speedMap >> 4) > 2) ? "true" : "false");
+        json << ",\"psram\":" << ((header->fileType & 0x20) ? "true" : "false");
+        json << ",\"soundlinkMuted\":" << ((header->fileType & 0x10) ? "true" : "false");
+        json << ",\"stGigaIntro\":" << ((header->fileType & 0x80) ? "false" : "true");
+        json << ",\"blockAlloc\":" << blockMask(header);
+        json << ",\"maker\":" << (int)header->maker;
+        json << ",\"digest\":\"" << std::hex << std::uppercase;
+        json << std::setfill('0') << std::setw(16) << header->digest << std::dec << "\"";
+        if (i < mKnownContent.size())
+        {
+            json << ",\"knownContent\":";
+            if (mKnownContent[i].empty()) json << "null";
+            else json << jsonString(mKnownContent[i]);
+        }
+        json << "}";
     } /* End for */
+    json << "]";
+
+    if (mOrphansScanned)
+    {
+        json << ",\"orphans\":[";
+        for (i=0; i < mOrphans.size(); i++)
+        {
+            const Orphan_t *orphan = &(mOrphans[i]);
+
+            json << (i ? "," : "") << "{\"block\":" << orphan->block;
+            if (orphan->page != NO_PAGE)
+                json << ",\"page\":" << orphan->page;
+            if (orphan->known)
+            {
+                json << ",\"content\":" << jsonString(orphan->match.label);
+                json << ",\"position\":" << orphan->match.position;
+                json << ",\"contentBlocks\":" << orphan->match.blockCount;
+                if (orphan->match.page != BlockIndex::NO_PAGE)
+                    json << ",\"contentPage\":" << orphan->match.page;
+            }
+            json << "}";
+        } /* End for */
+        json << "]";
+    }
+
+    if (!mPageClass.empty())
+    {
+        json << ",\"profile\":{\"pageClass\":" << jsonString(mPageClass);
+        json << ",\"pageEntropy\":[" << std::setprecision(2);
+        for (x=0; x < mPageEntropy.size(); x++)
+            json << (x ? "," : "") << mPageEntropy[x];
+        json << "],\"blockHistogram\":[";
+        for (x=0; x < mErasedPages.size(); x++)
+        {
+            json << (x ? ",[" : "[");
+            for (i=0; i < 256; i++)
+                json << (i ? "," : "") << mBlockHistogram[(x * 256) + i];
+            json << "]";
+        } /* End for */
+        json << "]}";
+    }
+
+    json << "}" << std::endl;
+    return json.str();
+}
+
+template <uint32_t BLOCKS>
+uint16_t Pack::calcCRC(const Pack::Header_t *header)
+{
+    const uint32_t allBlocks = (uint32_t)(((uint64_t)1 << BLOCKS) - 1);
+    const uint32_t bitmask = blockMask(header) & allBlocks;
+    uint16_t crc = 0;
+    uint32_t i = 0;
+    uint32_t x = 0;
+    PhaseTimer timer(PHASE_CHECKSUM);
+
+    /* The checksum is a 16-bit byte sum, so whole block sums can be
+     * added and the header window taken back out */
+    for (x = 0; x < BLOCKS; x++)
+        if ( (bitmask >> x) & 0x1 )
+            crc += blockSum(x);
+
+    /* Does a block in use contain the header? */
+    x = header->address / PACK_BLOCK_SIZE;
+    if ( (bitmask >> x) & 0x1 )
+    {
+        for (i = header->address; i < (header->address + 0x30); i++)
+            crc -= (uint8_t)mData[i];
+    }
+    metricAdd(METRIC_BYTES_VERIFIED,
+        (uint64_t)__builtin_popcount(bitmask) * PACK_BLOCK_SIZE);
 
     /* Done! */
     return crc;
 }
 
+/* Byte sum of one block, worked out the first time it is asked for.
+ * With erasedPages, the block is summed page by page even if it was
+ * summed before, and bit N is set for each page N that is all 0xFF. */
+uint32_t Pack::blockSum(const uint32_t block, uint32_t *erasedPages)
+{
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    const uint8_t *ptr = &mData[block * PACK_BLOCK_SIZE];
+    const uint8_t *end = NULL;
+    uint32_t sum = 0;
+    uint32_t pageSum = 0;
+    uint32_t page = 0;
+
+    if (((mSummedBlocks >> block) & 1) && !erasedPages)
+        return mBlockSums[block];
+
+    /* Only an erased page sums to 0xFF per byte */
+    for (page = 0; page < pagesPerBlock; page++)
+    {
+        end = ptr + PACK_PAGE_SIZE;
+#if defined(__SSE2__)
+        /* SAD against zero adds up 8 bytes into each 64-bit lane */
+        const __m128i zero = _mm_setzero_si128();
+        __m128i total = _mm_setzero_si128();
+
+        for (; ptr < end; ptr += 64)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 32));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 48));
+
+            total = _mm_add_epi64(total, _mm_add_epi64(
+                _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)),
+                _mm_add_epi64(_mm_sad_epu8(c, zero), _mm_sad_epu8(d, zero))));
+        } /* End for */
+        pageSum = _mm_cvtsi128_si32(total) +
+            _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+#else
+        for (pageSum = 0; ptr < end; ptr++)
+            pageSum += *ptr;
+#endif
+
+        if (erasedPages && (pageSum == (0xFF * PACK_PAGE_SIZE)))
+            *erasedPages |= (1U << page);
+        sum += pageSum;
+    } /* End for */
+
+    if (mBlockSums.size() <= block)
+        mBlockSums.resize(SIZE_32M / PACK_BLOCK_SIZE);
+    mBlockSums[block] = sum;
+    mSummedBlocks |= ((uint64_t)1 << block);
+    return sum;
+}
+
+/* Checksum rule variants for diagnoseChecksums(). A rule number holds
+ * one choice from each family:
+ *   rule = ((coverage * WINDOW_COUNT + window) * 2 + preValidation) * 2
+ *          + mirrored */
+enum {
+    COVER_ALLOC = 0,    /* Blocks in blockAlloc (what calcCRC() does) */
+    COVER_SPAN,         /* First through last allocated block */
+    COVER_ALLOC_USED,   /* Allocated blocks that hold data */
+    COVER_HEADER_BLOCK, /* Only the block holding the header */
+    COVER_USED,         /* Every block in the pack that holds data */
+    COVER_WHOLE,        /* The whole pack */
+    COVER_COUNT
+};
+
+enum {
+    WINDOW_EXCLUDED = 0,    /* xFB0-xFDF skipped (what calcCRC() does) */
+    WINDOW_INCLUDED,        /* Header bytes summed like any others */
+    WINDOW_CHECKSUM_ONLY,   /* Only the checksums at xFDC-xFDF skipped */
+    WINDOW_COUNT
+};
+
+#define CHECKSUM_RULES (COVER_COUNT * WINDOW_COUNT * 2 * 2)
+
+static const char *COVER_NAMES[COVER_COUNT] = {
+    "allocated blocks", "first to last allocated block",
+    "allocated blocks holding data", "header block only",
+    "all blocks holding data", "whole pack"
+};
+
+static const char *WINDOW_NAMES[WINDOW_COUNT] = {
+    "header excluded", "header included", "checksum bytes excluded"
+};
+
+std::string Pack::checksumRuleName(const uint16_t rule)
+{
+    std::string name;
+
+    name = COVER_NAMES[rule / (WINDOW_COUNT * 4)];
+    name += ", ";
+    name += WINDOW_NAMES[(rule / 4) % WINDOW_COUNT];
+    if (rule & 2) name += ", maker byte 0xFF";
+    if (rule & 1) name += ", mirrored to a power of two";
+    return name;
+}
+
+/* The checksum of a header's content under one rule. False when the
+ * rule makes no difference for this header or pack (no maker byte to
+ * undo, nothing to mirror), so it isn't tried twice. */
+bool Pack::ruleChecksum(const Header_t *header, const uint16_t rule,
+    uint16_t *checksum)
+{
+    const uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+    const uint32_t headerBlock = header->address / PACK_BLOCK_SIZE;
+    const uint32_t coverage = rule / (WINDOW_COUNT * 4);
+    const uint32_t window = (rule / 4) % WINDOW_COUNT;
+    const bool preValidation = (rule & 2);
+    const bool mirrored = (rule & 1);
+    uint64_t all = ((uint64_t)1 << totalBlocks) - 1;
+    uint64_t used = 0;
+    uint64_t mask = 0;
+    uint32_t blocks[64];
+    uint32_t count = 0;
+    uint32_t power = 1;
+    uint32_t sum = 0;
+    uint32_t tail = 0;
+    uint32_t x = 0;
+
+    for (x = 0; x < totalBlocks; x++)
+        if (mErasedPages[x] != 0xFFFFFFFF)
+            used |= ((uint64_t)1 << x);
+
+    mask = blockMask(header) & all;
+    switch (coverage)
+    {
+        case COVER_SPAN:
+            if (mask)
+                mask = (((uint64_t)1 << (63 - __builtin_clzll(mask))) << 1) -
+                    ((uint64_t)1 << __builtin_ctzll(mask));
+            break;
+
+        case COVER_ALLOC_USED:
+            mask &= used;
+            break;
+
+        case COVER_HEADER_BLOCK:
+            mask = ((uint64_t)1 << headerBlock);
+            break;
+
+        case COVER_USED:
+            mask = used;
+            break;
+
+        case COVER_WHOLE:
+            mask = all;
+            break;
+
+        default:
+            break;
+    } /* End switch */
+
+    /* Pointless variants: no header bytes summed, or already 0xFF */
+    if ( preValidation && ((window == WINDOW_EXCLUDED) || (header->maker != 0x33) ||
+        !((mask >> headerBlock) & 1)) )
+        return false;
+
+    for (x = 0; x < totalBlocks; x++)
+        if ((mask >> x) & 1)
+            blocks[count++] = x;
+    if (count == 0)
+        return false;
+
+    /* Like SNES ROMs that aren't a power of two long: the tail is
+     * repeated until it fills out the next power of two */
+    while ((power << 1) <= count)
+        power <<= 1;
+    if (mirrored && ((power == count) || (power % (count - power))))
+        return false;
+
+    for (x = 0; x < count; x++)
+    {
+        if (mirrored && (x >= power))
+            tail += blockSum(blocks[x]);
+        else
+            sum += blockSum(blocks[x]);
+    } /* End for */
+    if (mirrored)
+        sum += tail * (power / (count - power));
+
+    /* Take back the header bytes this rule doesn't cover */
+    if ((mask >> headerBlock) & 1)
+    {
+        if (window == WINDOW_EXCLUDED)
+            for (x = 0; x < PACK_HEADER_SIZE; x++)
+                sum -= mData[header->address + x];
+        else if (window == WINDOW_CHECKSUM_ONLY)
+            for (x = 0x2C; x < PACK_HEADER_SIZE; x++)
+                sum -= mData[header->address + x];
+
+        /* BS-X writes 0x33 over the 0xFF a download arrives with */
+        if (preValidation)
+            sum += 0xFF - 0x33;
+    }
+
+    *checksum = (uint16_t)sum;
+    return true;
+}
+
+/* Works out which way of computing the checksum would give the value
+ * in the header, for each content whose checksum doesn't match. Every
+ * rule is a few additions of block sums calcCRC() already took. */
+void Pack::diagnoseChecksums(void)
+{
+    uint16_t checksum = 0;
+    uint16_t rule = 0;
+    uint32_t i = 0;
+    PhaseTimer timer(PHASE_CHECKSUM);
+
+    mChecksumRules.assign(mBlockHeader.size(), std::vector<uint16_t>());
+    if (!mIsLoaded || !mData) return;
+
+    for (i = 0; i < mBlockHeader.size(); i++)
+    {
+        if (mBlockHeader[i].calcChksum == mBlockHeader[i].chksum)
+            continue;
+
+        for (rule = 0; rule < CHECKSUM_RULES; rule++)
+            if (ruleChecksum(&(mBlockHeader[i]), rule, &checksum) &&
+                (checksum == mBlockHeader[i].chksum))
+                mChecksumRules[i].push_back(rule);
+    } /* End for */
+}
+
+uint64_t Pack::pageHash(const uint32_t page)
+{
+    const uint8_t *data = &mData[page * PACK_PAGE_SIZE];
+    const uint32_t window = (0x7FB0 % PACK_PAGE_SIZE);
+    uint64_t hash = 0;
+
+    /* Every 32 KB bank may hold a header at xFB0, and BS-X rewrites
+     * the boot count and maker byte there. Skip that window so a
+     * content keeps its fingerprint after being booted or validated. */
+    if ((page % (0x8000 / PACK_PAGE_SIZE)) != (0x7FB0 / PACK_PAGE_SIZE))
+        return hash64(data, PACK_PAGE_SIZE, 0);
+
+    hash = hash64(data, window, 0);
+    return hash64(data + window + PACK_HEADER_SIZE,
+        PACK_PAGE_SIZE - window - PACK_HEADER_SIZE, hash);
+}
+
+uint64_t Pack::blockHash(const uint32_t block)
+{
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    uint64_t pages[PACK_BLOCK_SIZE / PACK_PAGE_SIZE];
+    uint32_t i = 0;
+
+    for (i = 0; i < pagesPerBlock; i++)
+        pages[i] = pageHash((block * pagesPerBlock) + i);
+
+    return hash64(pages, sizeof(pages), 0);
+}
+
+uint64_t Pack::contentDigest(const Pack::Header_t *header)
+{
+    uint64_t blocks[32];
+    uint32_t count = 0;
+    uint32_t x = 0;
+    uint32_t bitmask = 0;
+    uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+
+    bitmask = blockMask(header);
+
+    /* Digest is the hash of the allocated block hashes, in order */
+    for (x = 0; x < totalBlocks; x++)
+        if ( (bitmask >> x) & 0x1 )
+            blocks[count++] = blockHash(x);
+
+    return hash64(blocks, count * sizeof(uint64_t), 0);
+}
+
+uint32_t Pack::blockMask(const Pack::Header_t *header) const
+{
+    return (header->blockAlloc[3] << 24) | (header->blockAlloc[2] << 16) |
+        (header->blockAlloc[1] << 8) | (header->blockAlloc[0] << 0);
+}
+
+template <uint32_t BLOCKS>
+void Pack::mapErased(const uint32_t claimed)
+{
+    const uint32_t pagesPerBlock = PACK_BLOCK_SIZE / PACK_PAGE_SIZE;
+    uint32_t x = 0, page = 0;
+
+    mErasedPages.assign(BLOCKS, 0);
+    for (x = 0; x < BLOCKS; x++)
+    {
+        /* Claimed blocks get read in full for their checksums anyway,
+         * so sum them now and map their pages on the same pass */
+        if ( ((claimed >> x) & 0x1) && !((mSummedBlocks >> x) & 0x1) )
+        {
+            blockSum(x, &mErasedPages[x]);
+            continue;
+        }
+
+        for (page = 0; page < pagesPerBlock; page++)
+            if (isErased((x * PACK_BLOCK_SIZE) + (page * PACK_PAGE_SIZE),
+                PACK_PAGE_SIZE))
+                mErasedPages[x] |= (1U << page);
+    } /* End for */
+}
+
+bool Pack::isErased(const uint32_t offset, const uint32_t length) const
+{
+    const uint8_t *ptr = &mData[offset];
+    const uint8_t *end = ptr + length;
+
+    /* Lengths are always multiples of 64 bytes (pages or blocks). Data
+     * almost never survives 64 bytes of all-ones, so in-use pages bail
+     * out on the first chunk and only erased pages are read in full. */
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+
+    for (; ptr < end; ptr += 64)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + 32));
+
+        if (!_mm256_testc_si256(_mm256_and_si256(a, b), ones))
+            return false;
+    } /* End for */
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+
+    for (; ptr < end; ptr += 64)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 48));
+
+        a = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, ones)) != 0xFFFF)
+            return false;
+    } /* End for */
+#else
+    uint64_t word[8];
+    uint32_t i = 0;
+
+    for (; ptr < end; ptr += 64)
+    {
+        memcpy(word, ptr, sizeof(word));
+        for (i = 1; i < 8; i++)
+            word[0] &= word[i];
+        if (word[0] != ~(uint64_t)0)
+            return false;
+    } /* End for */
+#endif
+
+    return true;
+}
@@ -14,26 +14,56 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include "block_index.h"
+#include "alloc_map.h"
 
-class Pack {
-public:
-    Pack(const char *filename);
-    ~Pack();
-    bool isLoaded(void) { return mIsLoaded; }
-    void analyze(void);
-    std::string generateReport(const bool color);
+#define PACK_BLOCK_SIZE  0x20000 /* Flash erase/allocation block */
+#define PACK_PAGE_SIZE   0x1000  /* Sub-block granularity for hashing */
+#define PACK_HEADER_SIZE 0x30    /* Header window at xFB0-xFDF */
+#define PACK_TITLE_UTF8  49      /* Decoded title: 16 chars, 3 bytes each */
+#define PACK_MAX_DUMP    0x1000000 /* Largest overdump taken apart */
 
-private:
-
-    std::vector<uint8_t> mPackData;
-    std::string mFilename;
-    bool mIsLoaded;
+class ContentIndex;
+struct stat;
 
+class Pack {
+public:
     enum PackSize_t {
        INVALID = 0,
        SIZE_8M = (1024 * 1024),
        SIZE_32M = (4 * 1024 * 1024)
-    } mPackSize;
+    };
+
+    enum PackError_t {
+        PACK_OK = 0,
+        PACK_ERR_ACCESS,    /* Permission denied */
+        PACK_ERR_NOT_FOUND, /* Path doesn't exist */
+        PACK_ERR_NOT_FILE,  /* Not a regular file */
+        PACK_ERR_SIZE,      /* Not a valid dump size */
+        PACK_ERR_IO,        /* Open or read failed */
+        PACK_ERR_FORMAT     /* Corrupt or unsupported compressed dump */
+    };
+
+    /* How the dump file relates to the pack it holds */
+    enum Geometry_t {
+        GEOMETRY_EXACT = 0,     /* The pack, byte for byte */
+        GEOMETRY_MIRRORED,      /* The pack repeated (an overdump) */
+        GEOMETRY_TRUNCATED      /* The start of the pack; the rest reads
+                                 * as erased */
+    };
+
+    /* How Pack(filename) gets a dump into memory */
+    enum IoPolicy_t {
+        IO_STREAM = 0,  /* std::ifstream into a pooled buffer */
+        IO_FADVISE,     /* read() with sequential readahead, DONTNEED after */
+        IO_HUGEPAGE,    /* IO_FADVISE into a MADV_HUGEPAGE pooled buffer */
+        IO_MMAP,        /* Map the file with SEQUENTIAL/WILLNEED/HUGEPAGE */
+        IO_DIRECT,      /* O_DIRECT into an aligned pooled buffer, bypassing
+                         * the page cache; IO_FADVISE where unsupported */
+        IO_URING,       /* Batch scans keep statx/openat/read in flight on
+                         * an io_uring; a lone Pack reads like IO_FADVISE */
+        IO_POLICY_COUNT
+    };
 
     typedef struct {
         uint32_t address;       /* Address of header in pack */
@@ -50,13 +80,177 @@ private:
         uint8_t version;        /* xFDB */
         uint16_t invChksum;   /* xFDC-xFDD */
         uint16_t chksum;      /* xFDE-xFDF */
+        uint16_t calcChksum;    /* Calculated checksum (computed) */
+        uint64_t digest;        /* Content digest (computed) */
     } Header_t;
 
+    /* A window of a larger file holding the pack */
+    typedef struct {
+        uint64_t offset;
+        uint64_t length;        /* 0 for the rest of the file */
+    } Region_t;
+
+    Pack(const char *filename, const IoPolicy_t policy = IO_STREAM);
+
+    /* Only the region is read: mapped on its own with IO_MMAP, read
+     * with pread() under any other policy. Everything in the pack,
+     * header addresses included, counts from the start of the region.
+     * The pack is named "<file>@<offset>[+<length>]". */
+    Pack(const char *filename, const Region_t &region,
+        const IoPolicy_t policy = IO_STREAM);
+    Pack(const uint8_t *data, const size_t size, const char *name);
+    Pack(std::vector<uint8_t> &&data, const char *name);
+    Pack(std::vector<uint8_t> &&pooled, const size_t size, const char *name);
+    static Pack *fromCache(const char *filename, const std::string &payload);
+    static Pack *fromError(const char *name, const PackError_t error,
+        const std::string &message);
+    ~Pack();
+    bool isLoaded(void) const { return mIsLoaded; }
+    PackError_t error(void) const { return mError; }
+    const std::string &errorMessage(void) const { return mErrorMessage; }
+    const std::string &filename(void) const { return mFilename; }
+    PackSize_t packSize(void) const { return mPackSize; }
+    uint64_t dumpSize(void) const { return mDumpSize; }
+    Geometry_t geometry(void) const;
+
+    /* Whether a file this size could hold a pack: 8M or 32M, a power of
+     * two multiple of either (up to PACK_MAX_DUMP), or whole blocks
+     * short of 32M. Mirroring is only checked once the data is read. */
+    static bool isDumpSize(const uint64_t size);
+
+    /* Whether a file this size is worth reading to find out: a dump's
+     * size, or small enough to be a compressed dump */
+    static bool mayHoldDump(const uint64_t size);
+    /* Blocks a header has to sit in for findHeaders() to look at it,
+     * and blocks its blockAlloc can claim for the header to be taken.
+     * Headers are only probed in the first half of the pack, and a 32M
+     * header claims from blockAlloc's first byte alone. */
+    static uint32_t headerBlocks(const PackSize_t size);
+    static uint32_t claimableBlocks(const PackSize_t size);
+    const uint8_t *data(void) const { return mData; }
+    uint32_t headerCount(void) const { return mBlockHeader.size(); }
+    const Header_t &header(const uint32_t index) const { return mBlockHeader[index]; }
+    const AllocMap &allocation(void) const { return mAlloc; }
+    uint32_t blockMask(const Header_t *header) const;
+    bool isCached(void) const { return mFromCache; }
+
+    /* utf8 must hold PACK_TITLE_UTF8 bytes */
+    static const char *decodeTitle(const Header_t *header, char *utf8);
+
+    static bool parseIoPolicy(const char *name, IoPolicy_t *policy);
+    static const char *ioPolicyName(const IoPolicy_t policy);
+    static void prefetch(const char *filename);
+
+    /* Bump CACHE_LAYOUT whenever serialize() or Header_t changes */
+    static const uint32_t CACHE_LAYOUT = (2 << 16) | sizeof(Header_t);
+    std::string serialize(void) const;
+    uint64_t contentHash(void) const;
+
+    void analyze(void);
+
+    /* Just the header scan analyze() starts with. Only the header
+     * windows are read, so nothing else is checked or summed. */
+    void findHeaders(void);
+    void identify(const ContentIndex &index);
+    void attributeOrphans(const BlockIndex &index, const bool pages);
+    void profile(void);
+    void diagnoseChecksums(void);
+    uint32_t indexBlocks(BlockIndex::Builder *builder, const bool pages,
+        const ContentIndex *index);
+    std::string generateReport(const bool color, const bool pageMap = false);
+    std::string generateJSON(void);
+
+private:
+    Pack(void);
+
+    std::vector<uint8_t> mPackData; /* Owned data, when we have it. May be
+                                     * longer than the pack; see BufferPool */
+    const uint8_t *mData;           /* Pack contents, owned or not */
+    IoPolicy_t mPolicy;
+    void *mMap;                     /* IO_MMAP mapping, if any */
+    size_t mMapLength;
+    int mMapFd;                     /* Kept for DONTNEED once we're done */
+    bool mPooled;                   /* mPackData came from BufferPool */
+    std::string mFilename;
+    bool mIsLoaded;
+    bool mFromCache;                /* Restored by fromCache(), no data */
+    PackSize_t mPackSize;
+    uint64_t mDumpSize;             /* Size of the file or buffer given */
+    PackError_t mError;
+    std::string mErrorMessage;
+
     std::vector<Header_t> mBlockHeader;
+    std::vector<std::string> mKnownContent;
+
+    /* Byte sum of each block, for the content checksums. Compressed
+     * dumps get these as each block is decompressed; others on demand */
+    std::vector<uint32_t> mBlockSums;
+    uint64_t mSummedBlocks;              /* Bit N: mBlockSums[N] is valid */
 
-    bool validHeader(const uint32_t block, const bool LoROM, Pack::Header_t *header);
-    uint16_t calcCRC(const Header_t *header);
+    typedef struct {
+        uint32_t block;         /* Unclaimed, non-erased block */
+        uint32_t page;          /* Page within the block, or NO_PAGE */
+        bool known;             /* Found in the block index */
+        BlockIndex::Match_t match;
+    } Orphan_t;
+
+    /* Bit N of entry B is set when page N of block B is all 0xFF */
+    std::vector<uint32_t> mErasedPages;
+
+    /* Entropy profile, filled in by profile() */
+    std::vector<float> mPageEntropy;
+    std::string mPageClass;              /* One PROFILE_* per page */
+    std::vector<uint32_t> mBlockHistogram; /* 256 byte counts per block */
+
+    /* Checksum rule variants that reproduce the reported checksum of
+     * each mismatching header, filled in by diagnoseChecksums() */
+    std::vector<std::vector<uint16_t> > mChecksumRules;
+
+    /* Ownership of blocks across all headers */
+    AllocMap mAlloc;
+
+    static const uint32_t NO_PAGE = 0xFFFFFFFF;
+    std::vector<Orphan_t> mOrphans;
+    bool mOrphansScanned;
+
+    bool restore(const std::string &payload);
+    bool loadStream(void);
+    bool loadRead(const bool hugePages);
+    bool loadMap(void);
+    bool loadDirect(void);
+    bool loadCompressed(const uint64_t fileSize);
+    bool loadOddSize(void *map, const uint64_t fileSize);
+    bool inflateDump(const uint8_t *data, const size_t size, bool *compressed);
+    bool loadRegion(const char *filename, const uint64_t offset,
+        const uint64_t length);
+    bool statFile(struct stat *fileStat);
+    bool inflated(const uint8_t *data, const size_t length, size_t *produced);
+    bool checkSize(const uint64_t size);
+    bool fitSize(const uint8_t *data, const uint64_t size);
+    void fail(const PackError_t error, const std::string &message);
+
+    /* Analysis that depends on the geometry, specialized on the block
+     * count so masks and trip counts are constants; analyze() and
+     * findHeaders() pick the variant once per pack */
+    template <uint32_t BLOCKS> void analyzeBlocks(void);
+    template <uint32_t BLOCKS> void findHeaderBlocks(void);
+    template <uint32_t BLOCKS> bool validHeader(const uint32_t block,
+        const bool LoROM, Pack::Header_t *header);
+    template <uint32_t BLOCKS> uint16_t calcCRC(const Header_t *header);
+    template <uint32_t BLOCKS> void mapErased(const uint32_t claimed);
+
+    /* Summing a block can map its erased pages on the same pass */
+    uint32_t blockSum(const uint32_t block, uint32_t *erasedPages = NULL);
+    bool ruleChecksum(const Header_t *header, const uint16_t rule,
+        uint16_t *checksum);
+    static std::string checksumRuleName(const uint16_t rule);
+    bool isErased(const uint32_t offset, const uint32_t length) const;
+    std::string contentLabel(const Header_t *header, const ContentIndex *index);
+    static bool menuVisible(const Header_t *header);
+    static const char *programTypeName(const Header_t *header);
+    uint64_t pageHash(const uint32_t page);
+    uint64_t blockHash(const uint32_t block);
+    uint64_t contentDigest(const Header_t *header);
 };
 
 #endif /* __PACK_H__ */
-
@@ -0,0 +1,401 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include "pack_builder.h"
+#include "util.h"
+
+#define LOROM_HEADER 0x7FB0
+#define HIROM_HEADER 0xFFB0
+
+/* Could this be a header window? The same tests Pack::validHeader()
+ * makes that don't depend on where the content sits. */
+static bool plausibleHeader(const uint8_t *window, const bool HiROM)
+{
+    if ((window[0x26] == 0xFF) && (window[0x27] == 0xFF))
+        return false;
+    if ((window[0x2A] != 0x33) && (window[0x2A] != 0xFF) && (window[0x2A] != 0x00))
+        return false;
+    return ((window[0x28] & 0x1) == (HiROM ? 1 : 0));
+}
+
+bool PackBuilder::loadImage(const char *filename, Image_t *image,
+    std::string *error)
+{
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    uint32_t i = 0;
+    size_t blocks = 0;
+
+    image->filename = filename;
+    image->data.clear();
+    if (!file)
+    {
+        *error = "Unable to open content image '" + image->filename + "'";
+        return false;
+    }
+    image->data.assign(std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>());
+
+    blocks = image->data.size() / PACK_BLOCK_SIZE;
+    if ( !blocks || (image->data.size() % PACK_BLOCK_SIZE) ||
+        (blocks > (Pack::SIZE_32M / PACK_BLOCK_SIZE)) )
+    {
+        *error = "Content image '" + image->filename +
+            "' isn't a whole number of 128 KB blocks";
+        return false;
+    }
+
+    /* Go by the map mode bit, and failing that prefer LoROM */
+    if (plausibleHeader(&image->data[LOROM_HEADER], false))
+        image->headerOffset = LOROM_HEADER;
+    else if (plausibleHeader(&image->data[HIROM_HEADER], true))
+        image->headerOffset = HIROM_HEADER;
+    else
+    {
+        *error = "Content image '" + image->filename +
+            "' has no header at 0x7FB0 or 0xFFB0";
+        return false;
+    }
+
+    /* The window is rewritten when the content is placed */
+    image->sum = 0;
+    for (i = 0; i < image->data.size(); i++)
+        image->sum += image->data[i];
+    for (i = image->headerOffset; i < (image->headerOffset + PACK_HEADER_SIZE); i++)
+        image->sum -= image->data[i];
+
+    /* Done! */
+    return true;
+}
+
+PackBuilder::PackBuilder(const Pack::PackSize_t size) :
+    mPackSize(size)
+{
+}
+
+bool PackBuilder::fail(const std::string &message)
+{
+    mErrorMessage = message;
+    return false;
+}
+
+void PackBuilder::add(const Image_t *image, const Placement_t &placement)
+{
+    Content_t content;
+
+    content.image = image;
+    content.placement = placement;
+    mContents.push_back(content);
+}
+
+bool PackBuilder::build(std::vector<uint8_t> *pack)
+{
+    uint32_t totalBlocks = mPackSize / PACK_BLOCK_SIZE;
+    uint32_t all = (totalBlocks == 32) ? 0xFFFFFFFF : ((1u << totalBlocks) - 1);
+    uint32_t claimable = Pack::claimableBlocks(mPackSize);
+    uint32_t probed = Pack::headerBlocks(mPackSize);
+    uint32_t used = 0, mask = 0, count = 0, x = 0, position = 0;
+    std::stringstream block;
+    std::vector<uint32_t> masks(mContents.size(), 0);
+    uint8_t *window = NULL;
+    uint16_t crc = 0;
+    size_t i = 0;
+
+    /* Contents with fixed blocks claim them first... */
+    for (i = 0; i < mContents.size(); i++)
+    {
+        const Content_t &content = mContents[i];
+
+        mask = content.placement.blocks;
+        if (!mask)
+            continue;
+
+        count = content.image->data.size() / PACK_BLOCK_SIZE;
+        if ((uint32_t)__builtin_popcount(mask) != count)
+            return fail("'" + content.image->filename +
+                "' is given a different number of blocks than it holds");
+        if (mask & ~all)
+            return fail("'" + content.image->filename +
+                "' is given blocks beyond the end of the pack");
+
+        /* Only place contents where packscan can find them again */
+        if (mask & ~claimable)
+            return fail("'" + content.image->filename +
+                "' is given blocks past 7, which a 32M header can't claim");
+        if ( !((probed >> __builtin_ctz(mask)) & 0x1) )
+        {
+            block << __builtin_ctz(mask);
+            return fail("'" + content.image->filename + "' would have its "
+                "header in block " + block.str() +
+                ", where headers aren't looked for");
+        }
+        if (mask & used)
+            return fail("'" + content.image->filename +
+                "' is given blocks another content already has");
+        used |= mask;
+        masks[i] = mask;
+    } /* End for */
+
+    /* ...then the rest go in the first free run that fits, or failing
+     * that the lowest free blocks. Either way the blocks have to be
+     * claimable, and the first one (which gets the header) probed. */
+    for (i = 0; i < mContents.size(); i++)
+    {
+        if (masks[i])
+            continue;
+
+        count = mContents[i].image->data.size() / PACK_BLOCK_SIZE;
+        mask = (count == 32) ? 0xFFFFFFFF : ((1u << count) - 1);
+        for (x = 0; ((x + count) <= totalBlocks) && ((probed >> x) & 0x1); x++)
+            if ( !((mask << x) & (used | ~claimable)) )
+                break;
+
+        if ( ((x + count) <= totalBlocks) && ((probed >> x) & 0x1) )
+            mask <<= x;
+        else
+        {
+            mask = 0;
+            for (x = 0; (x < totalBlocks) && ((uint32_t)__builtin_popcount(mask) < count); x++)
+                if ( !((used >> x) & 0x1) && ((claimable >> x) & 0x1) )
+                    mask |= (1u << x);
+            if ( ((uint32_t)__builtin_popcount(mask) < count) ||
+                !((probed >> __builtin_ctz(mask)) & 0x1) )
+                return fail("'" + mContents[i].image->filename +
+                    "' doesn't fit in the blocks left in the pack");
+        }
+        used |= mask;
+        masks[i] = mask;
+    } /* End for */
+
+    /* Lay out the blocks, erased where unclaimed */
+    pack->assign(mPackSize, 0xFF);
+    for (i = 0; i < mContents.size(); i++)
+    {
+        const Content_t &content = mContents[i];
+        const uint8_t *data = &content.image->data[0];
+
+        for (x = 0, position = 0; x < totalBlocks; x++)
+        {
+            if ( !((masks[i] >> x) & 0x1) )
+                continue;
+            memcpy(&(*pack)[x * PACK_BLOCK_SIZE],
+                data + (position * PACK_BLOCK_SIZE), PACK_BLOCK_SIZE);
+            position++;
+        } /* End for */
+
+        /* The header sits in the first block the content has */
+        window = &(*pack)[(__builtin_ctz(masks[i]) * PACK_BLOCK_SIZE) +
+            content.image->headerOffset];
+
+        window[0x20] = masks[i] & 0xFF;
+        window[0x21] = (masks[i] >> 8) & 0xFF;
+        window[0x22] = (masks[i] >> 16) & 0xFF;
+        window[0x23] = (masks[i] >> 24) & 0xFF;
+
+        /* Bit 7 limits the starts, bits 2-6 count them down */
+        if (content.placement.boots == BOOTS_UNLIMITED)
+            window[0x25] &= 0x7F;
+        else if (content.placement.boots != KEEP)
+            window[0x25] = (window[0x25] & 0x03) | 0x80 |
+                ((content.placement.boots & 0x1F) << 2);
+
+        if (content.placement.maker != KEEP)
+            window[0x2A] = content.placement.maker;
+
+        /* Everything but the window was summed when the image loaded */
+        crc = (uint16_t)content.image->sum;
+        window[0x2C] = (crc ^ 0xFFFF) & 0xFF;
+        window[0x2D] = (crc ^ 0xFFFF) >> 8;
+        window[0x2E] = crc & 0xFF;
+        window[0x2F] = crc >> 8;
+    } /* End for */
+
+    /* Done! */
+    return true;
+}
+
+/* "5" or "5,6,7" style block lists, each block in decimal or 0x hex */
+static bool parseBlocks(const std::string &text, uint32_t *mask)
+{
+    std::istringstream list(text);
+    std::string item;
+    long block = 0;
+
+    *mask = 0;
+    while (std::getline(list, item, ','))
+    {
+        if (!parseNumber(item, 0, &block) || (block < 0) || (block > 31) ||
+            ((*mask >> block) & 0x1))
+            return false;
+        *mask |= (1u << block);
+    } /* End while */
+    return (*mask != 0);
+}
+
+bool PackBuilder::buildFromSpec(const char *specFile)
+{
+    std::ifstream spec(specFile);
+    std::map<std::string, Image_t> images;
+    std::vector<uint8_t> pack;
+    PackBuilder *builder = NULL;
+    std::string line, keyword, packFile, error, reason;
+    uint32_t lineNum = 0, packs = 0;
+    bool ok = true;
+
+    if (!spec)
+    {
+        std::cout << "Unable to open pack spec '" << specFile << "'";
+        std::cout << std::endl;
+        return false;
+    }
+
+    /* A pack is built and written once its last content line is read */
+    while (ok)
+    {
+        std::istringstream words;
+        bool more = static_cast<bool>(std::getline(spec, line));
+
+        if (more)
+        {
+            lineNum++;
+            if (!line.empty() && (line[line.size() - 1] == '\r'))
+                line.erase(line.size() - 1);
+            words.str(line);
+            if (!(words >> keyword) || (keyword[0] == '#'))
+                continue;
+        }
+
+        if (builder && (!more || (keyword == "pack")))
+        {
+            if (!builder->build(&pack))
+            {
+                std::cout << "Unable to build pack '" << packFile << "': ";
+                std::cout << builder->errorMessage() << std::endl;
+                ok = false;
+            }
+            else if (!writeImageFile(packFile, &pack[0], pack.size()))
+                ok = false;
+            else
+                packs++;
+            delete builder;
+            builder = NULL;
+        }
+        if (!ok || !more)
+            break;
+
+        reason = "";
+        if (keyword == "pack")
+        {
+            std::string size = "8M";
+
+            if (!(words >> packFile))
+                reason = "expected \"pack FILE [8M|32M]\"";
+            else if ((words >> size) && (size != "8M") && (size != "32M"))
+                reason = "pack size must be 8M or 32M";
+            else
+                builder = new PackBuilder((size == "32M") ?
+                    Pack::SIZE_32M : Pack::SIZE_8M);
+        }
+        else if (keyword == "content")
+        {
+            std::string imageFile, option, value;
+            Placement_t placement;
+            uint32_t count = 0;
+            long number = 0;
+
+            placement.blocks = 0;
+            placement.boots = KEEP;
+            placement.maker = KEEP;
+
+            if (!builder)
+                reason = "\"content\" before any \"pack\"";
+            else if (!(words >> imageFile))
+                reason = "expected \"content IMAGE [options]\"";
+
+            /* Each image is only read the first time it's named */
+            else if (!images.count(imageFile) &&
+                !loadImage(imageFile.c_str(), &images[imageFile], &error))
+            {
+                images.erase(imageFile);
+                reason = error;
+            }
+            else
+                count = images[imageFile].data.size() / PACK_BLOCK_SIZE;
+
+            while (reason.empty() && (words >> option))
+            {
+                if (!(words >> value))
+                    reason = "\"" + option + "\" needs a value";
+                else if (option == "at")
+                {
+                    if (!parseNumber(value, 0, &number) || (number < 0) ||
+                        ((number + count) > 32))
+                        reason = "\"at\" needs a block the content fits after";
+                    else
+                        placement.blocks = (uint32_t)((((uint64_t)1 << count) - 1) << number);
+                }
+                else if (option == "blocks")
+                {
+                    if (!parseBlocks(value, &placement.blocks))
+                        reason = "\"blocks\" needs a list of blocks 0-31";
+                }
+                else if (option == "boots")
+                {
+                    if (value == "unlimited")
+                        placement.boots = BOOTS_UNLIMITED;
+                    else if (!parseNumber(value, 10, &number) || (number < 0) ||
+                        (number > 31))
+                        reason = "\"boots\" needs 0-31 or \"unlimited\"";
+                    else
+                        placement.boots = number;
+                }
+                else if (option == "maker")
+                {
+                    if (!parseNumber(value, 16, &number) || ((number != 0x00) &&
+                        (number != 0x33) && (number != 0xFF)))
+                        reason = "\"maker\" needs 00, 33 or FF";
+                    else
+                        placement.maker = number;
+                }
+                else
+                    reason = "unknown option \"" + option + "\"";
+            } /* End while */
+
+            if (reason.empty())
+                builder->add(&images[imageFile], placement);
+        }
+        else
+            reason = "unknown keyword \"" + keyword + "\"";
+
+        if (!reason.empty())
+        {
+            std::cout << "Pack spec '" << specFile << "' line " << lineNum;
+            std::cout << ": " << reason << std::endl;
+            ok = false;
+        }
+    } /* End while */
+
+    delete builder;
+    if (!ok)
+        return false;
+
+    std::cout << "Wrote " << packs << " memory pack";
+    std::cout << ((packs == 1) ? "" : "s") << std::endl;
+    return true;
+}
@@ -0,0 +1,87 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __PACK_BUILDER_H__
+#define __PACK_BUILDER_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "pack.h"
+
+/* Composes a memory pack image from content images. Each content gets
+ * its 128 KB blocks (placed where asked, or first-fit), and its header
+ * window gets the block allocation, maker, boot count and a checksum
+ * worked out the same way Pack::calcCRC() checks it. Blocks no content
+ * claims are left erased. Only placements packscan can read back are
+ * made: a header in the first half of the pack, and in a 32M pack
+ * nothing past block 7.
+ *
+ * A content's checksum doesn't depend on where its blocks land, so it
+ * is summed once when the image is loaded; building a pack after that
+ * is a fill and a copy per content. */
+class PackBuilder {
+public:
+    /* A content as --extract writes it: its blocks back to back, with
+     * the header at 0x7FB0 (LoROM) or 0xFFB0 (HiROM) of the first */
+    typedef struct {
+        std::string filename;
+        std::vector<uint8_t> data;
+        uint32_t headerOffset;  /* Header window within data */
+        uint32_t sum;           /* Byte sum, less the header window */
+    } Image_t;
+
+    static const int KEEP = -1;           /* Leave the image's value */
+    static const int BOOTS_UNLIMITED = -2;
+
+    typedef struct {
+        uint32_t blocks;        /* Blocks to use, or 0 to pick them */
+        int boots;              /* 0-31, KEEP or BOOTS_UNLIMITED */
+        int maker;              /* 0x00, 0x33, 0xFF or KEEP */
+    } Placement_t;
+
+    static bool loadImage(const char *filename, Image_t *image,
+        std::string *error);
+
+    PackBuilder(const Pack::PackSize_t size);
+    const std::string &errorMessage(void) const { return mErrorMessage; }
+
+    /* The image must outlive the builder */
+    void add(const Image_t *image, const Placement_t &placement);
+
+    /* Place every content added so far and write out the pack. False,
+     * with a reason in errorMessage(), if they don't fit. */
+    bool build(std::vector<uint8_t> *pack);
+
+    /* Build every pack a spec file describes:
+     *
+     *   pack FILE [8M|32M]
+     *   content IMAGE [at BLOCK | blocks BLOCK,...] [boots N|unlimited]
+     *       [maker 00|33|FF]
+     *
+     * Each "pack" line starts a new pack, and the "content" lines after
+     * it go into that pack. Images used by several packs are read once.
+     * Blank lines and lines starting with '#' are ignored. */
+    static bool buildFromSpec(const char *specFile);
+
+private:
+    typedef struct {
+        const Image_t *image;
+        Placement_t placement;
+    } Content_t;
+
+    bool fail(const std::string &message);
+
+    Pack::PackSize_t mPackSize;
+    std::vector<Content_t> mContents;
+    std::string mErrorMessage;
+};
+
+#endif /* __PACK_BUILDER_H__ */
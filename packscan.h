@@ -0,0 +1,91 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __PACKSCAN_H__
+#define __PACKSCAN_H__
+
+/* C interface to libpackscan. Packs are analyzed when opened; header
+ * records and checksums are then read back without any parsing of
+ * report text. All functions are safe to call on different packs from
+ * different threads. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct packscan_pack packscan_pack;
+
+typedef enum {
+    PACKSCAN_OK = 0,
+    PACKSCAN_ERR_ACCESS,     /* Permission denied */
+    PACKSCAN_ERR_NOT_FOUND,  /* Path doesn't exist */
+    PACKSCAN_ERR_NOT_FILE,   /* Not a regular file */
+    PACKSCAN_ERR_SIZE,       /* Not a valid dump size */
+    PACKSCAN_ERR_IO,         /* Open or read failed */
+    PACKSCAN_ERR_ARGUMENT,   /* Bad argument (NULL pointer, bad index) */
+    PACKSCAN_ERR_MEMORY,     /* Out of memory */
+    PACKSCAN_ERR_FORMAT,     /* Corrupt or unsupported compressed dump */
+    PACKSCAN_ERR_INTERNAL    /* Unexpected failure inside the library */
+} packscan_status;
+
+/* Set struct_size to sizeof(packscan_header) before calling
+ * packscan_get_header(). Fields are only ever added at the end, and
+ * only those that fit in struct_size are filled in. */
+typedef struct {
+    uint32_t struct_size;    /* Size of this struct, as the caller knows it */
+    uint32_t address;        /* Address of header in pack */
+    uint8_t licensee[2];     /* xFB0-xFB1 */
+    uint8_t program_type[4]; /* xFB2-xFB5 */
+    uint8_t title[17];       /* xFC0-xFCF, Shift-JIS (plus NUL) */
+    uint32_t block_alloc;    /* xFD0-xFD3, bit N = 128 KB block N */
+    uint8_t starts[2];       /* xFD4-xFD5 */
+    uint8_t date_month;      /* xFD6 */
+    uint8_t date_day;        /* xFD7 */
+    uint8_t speed_map;       /* xFD8 */
+    uint8_t file_type;       /* xFD9 */
+    uint8_t maker;           /* xFDA */
+    uint8_t version;         /* xFDB */
+    uint16_t inv_chksum;     /* xFDC-xFDD */
+    uint16_t chksum;         /* xFDE-xFDF */
+    uint16_t calc_chksum;    /* Checksum calculated over the content */
+    uint64_t digest;         /* Content digest */
+} packscan_header;
+
+/* Open and analyze a dump file, which may be gzip or zlib compressed. */
+extern packscan_status packscan_open_file(const char *path, packscan_pack **pack);
+
+/* Analyze a dump already in memory, which may be gzip or zlib
+ * compressed. The buffer is not copied (unless the dump is compressed
+ * or truncated) and must stay valid until packscan_close(). */
+extern packscan_status packscan_open_buffer(const void *data, size_t size,
+    packscan_pack **pack);
+
+extern void packscan_close(packscan_pack *pack);
+
+extern uint32_t packscan_pack_size(const packscan_pack *pack);
+extern uint32_t packscan_header_count(const packscan_pack *pack);
+extern packscan_status packscan_get_header(const packscan_pack *pack,
+    uint32_t index, packscan_header *header);
+
+/* Report in the same formats as the packscan tool. The returned string
+ * is owned by the pack and valid until the next call or close. */
+extern const char *packscan_report(packscan_pack *pack, int color);
+extern const char *packscan_json(packscan_pack *pack);
+
+extern const char *packscan_strerror(packscan_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PACKSCAN_H__ */
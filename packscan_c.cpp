@@ -0,0 +1,178 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include "packscan.h"
+#include "pack.h"
+
+struct packscan_pack {
+    Pack *pack;
+    std::string text;        /* Backing store for report strings */
+};
+
+static packscan_status toStatus(const Pack::PackError_t error)
+{
+    switch (error)
+    {
+        case Pack::PACK_OK:            return PACKSCAN_OK;
+        case Pack::PACK_ERR_ACCESS:    return PACKSCAN_ERR_ACCESS;
+        case Pack::PACK_ERR_NOT_FOUND: return PACKSCAN_ERR_NOT_FOUND;
+        case Pack::PACK_ERR_NOT_FILE:  return PACKSCAN_ERR_NOT_FILE;
+        case Pack::PACK_ERR_SIZE:      return PACKSCAN_ERR_SIZE;
+        case Pack::PACK_ERR_FORMAT:    return PACKSCAN_ERR_FORMAT;
+        default:                       return PACKSCAN_ERR_IO;
+    } /* End switch */
+}
+
+/* The Pack stays owned here until the handle holding it exists, so
+ * nothing leaks if anything along the way throws */
+static packscan_status finishOpen(std::unique_ptr<Pack> pack,
+    packscan_pack **out)
+{
+    std::unique_ptr<packscan_pack> handle;
+
+    if (!pack->isLoaded())
+        return toStatus(pack->error());
+
+    handle.reset(new packscan_pack);
+    pack->analyze();
+    handle->pack = pack.release();
+    *out = handle.release();
+    return PACKSCAN_OK;
+}
+
+/* No exception may cross into C callers */
+packscan_status packscan_open_file(const char *path, packscan_pack **pack)
+{
+    if (!path || !pack) return PACKSCAN_ERR_ARGUMENT;
+    *pack = NULL;
+
+    try {
+        return finishOpen(std::unique_ptr<Pack>(new Pack(path)), pack);
+    } catch (const std::bad_alloc &) {
+        return PACKSCAN_ERR_MEMORY;
+    } catch (...) {
+        return PACKSCAN_ERR_INTERNAL;
+    }
+}
+
+packscan_status packscan_open_buffer(const void *data, size_t size,
+    packscan_pack **pack)
+{
+    if (!data || !pack) return PACKSCAN_ERR_ARGUMENT;
+    *pack = NULL;
+
+    try {
+        return finishOpen(std::unique_ptr<Pack>(new Pack(
+            static_cast<const uint8_t *>(data), size, NULL)), pack);
+    } catch (const std::bad_alloc &) {
+        return PACKSCAN_ERR_MEMORY;
+    } catch (...) {
+        return PACKSCAN_ERR_INTERNAL;
+    }
+}
+
+void packscan_close(packscan_pack *pack)
+{
+    if (!pack) return;
+    delete pack->pack;
+    delete pack;
+}
+
+uint32_t packscan_pack_size(const packscan_pack *pack)
+{
+    return pack ? pack->pack->packSize() : 0;
+}
+
+uint32_t packscan_header_count(const packscan_pack *pack)
+{
+    return pack ? pack->pack->headerCount() : 0;
+}
+
+packscan_status packscan_get_header(const packscan_pack *pack,
+    uint32_t index, packscan_header *header)
+{
+    const Pack::Header_t *src = NULL;
+    packscan_header record;
+
+    if (!pack || !header || (index >= pack->pack->headerCount()) ||
+        (header->struct_size < (offsetof(packscan_header, struct_size) +
+        sizeof(header->struct_size))))
+        return PACKSCAN_ERR_ARGUMENT;
+
+    /* Fields past the caller's struct_size are left out, so callers
+     * built against an older header keep working */
+    memset(&record, 0, sizeof(record));
+    record.struct_size = std::min<size_t>(header->struct_size, sizeof(record));
+    src = &(pack->pack->header(index));
+    record.address = src->address;
+    memcpy(record.licensee, src->licensee, sizeof(record.licensee));
+    memcpy(record.program_type, src->programType, sizeof(record.program_type));
+    memcpy(record.title, src->title, sizeof(record.title));
+    record.block_alloc = pack->pack->blockMask(src);
+    memcpy(record.starts, src->starts, sizeof(record.starts));
+    record.date_month = src->dateMonth;
+    record.date_day = src->dateDay;
+    record.speed_map = src->speedMap;
+    record.file_type = src->fileType;
+    record.maker = src->maker;
+    record.version = src->version;
+    record.inv_chksum = src->invChksum;
+    record.chksum = src->chksum;
+    record.calc_chksum = src->calcChksum;
+    record.digest = src->digest;
+    memcpy(header, &record, record.struct_size);
+    return PACKSCAN_OK;
+}
+
+const char *packscan_report(packscan_pack *pack, int color)
+{
+    if (!pack) return NULL;
+
+    try {
+        pack->text = pack->pack->generateReport(color != 0);
+    } catch (...) {
+        return NULL;
+    }
+    return pack->text.c_str();
+}
+
+const char *packscan_json(packscan_pack *pack)
+{
+    if (!pack) return NULL;
+
+    try {
+        pack->text = pack->pack->generateJSON();
+    } catch (...) {
+        return NULL;
+    }
+    return pack->text.c_str();
+}
+
+const char *packscan_strerror(packscan_status status)
+{
+    switch (status)
+    {
+        case PACKSCAN_OK:            return "Success";
+        case PACKSCAN_ERR_ACCESS:    return "Access denied";
+        case PACKSCAN_ERR_NOT_FOUND: return "Path doesn't exist";
+        case PACKSCAN_ERR_NOT_FILE:  return "Not a file";
+        case PACKSCAN_ERR_SIZE:      return "Invalid dump size";
+        case PACKSCAN_ERR_IO:        return "Error reading file";
+        case PACKSCAN_ERR_ARGUMENT:  return "Invalid argument";
+        case PACKSCAN_ERR_MEMORY:    return "Out of memory";
+        case PACKSCAN_ERR_FORMAT:    return "Corrupt or unsupported compressed dump";
+        case PACKSCAN_ERR_INTERNAL:  return "Internal error";
+        default:                     return "Unknown error";
+    } /* End switch */
+}
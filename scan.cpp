@@ -0,0 +1,594 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <memory>
+#include "scan.h"
+#include "buffer_pool.h"
+#include "metrics.h"
+
+void initScanConfig(ScanConfig_t *config)
+{
+    config->index = NULL;
+    config->blockIndex = NULL;
+    config->pages = false;
+    config->entropy = false;
+    config->diagnose = false;
+    config->extractor = NULL;
+    config->cache = NULL;
+    config->verifyCache = false;
+    config->io = Pack::IO_STREAM;
+    config->ioDepth = 16;
+}
+
+void scanPack(Pack *pack, const ScanConfig_t &config)
+{
+    pack->analyze();
+    if (config.index) pack->identify(*config.index);
+    if (config.blockIndex)
+        pack->attributeOrphans(*config.blockIndex, config.pages);
+    if (config.entropy) pack->profile();
+    if (config.diagnose) pack->diagnoseChecksums();
+    if (config.extractor) config.extractor->extract(*pack);
+}
+
+/* Sets up loaded's cache key from the dump's stat() and looks it up.
+ * A hit comes back in *cached; it still has to be verified by
+ * resolve() when the config asks for that. */
+static void recall(const char *filename, const struct stat &fileStat,
+    const ScanConfig_t &config, LoadedPack_t *loaded, Pack **cached,
+    uint64_t *cachedHash)
+{
+    std::string payload;
+
+    loaded->pack = NULL;
+    loaded->analyzed = false;
+    loaded->store = config.cache && !config.blockIndex && !config.entropy &&
+        !config.diagnose && !config.extractor &&
+        ScanCache::cacheable(fileStat);
+    *cached = NULL;
+
+    if (!loaded->store)
+        return;
+
+    /* Unchanged since it was last scanned? */
+    loaded->key = ScanCache::makeKey(fileStat);
+    if (config.cache->lookup(loaded->key, &payload, cachedHash))
+        *cached = Pack::fromCache(filename, payload);
+}
+
+/* Decides between the cached result and the freshly read pack */
+static void resolve(LoadedPack_t *loaded, Pack *cached,
+    const uint64_t cachedHash, Pack *pack)
+{
+    /* Same identity isn't proof of same contents; check if we read it */
+    if (cached && pack && (!pack->isLoaded() ||
+        (pack->contentHash() != cachedHash)))
+    {
+        delete cached;
+        cached = NULL;
+    }
+
+    if (cached)
+    {
+        delete pack;
+        metricAdd(METRIC_CACHE_HITS, 1);
+        loaded->pack = cached;
+        loaded->analyzed = true;
+        loaded->store = false;
+        return;
+    }
+
+    if (loaded->store) metricAdd(METRIC_CACHE_MISSES, 1);
+    loaded->pack = pack;
+    if (!pack->isLoaded())
+        loaded->store = false;
+}
+
+/* Everything scanFile() does before analysis: the cache lookup and
+ * the read. Safe to run on another thread. */
+LoadedPack_t loadFile(const char *filename, const ScanConfig_t &config,
+    const Pack::Region_t *region)
+{
+    struct stat before;
+    uint64_t cachedHash = 0;
+    Pack *cached = NULL;
+    LoadedPack_t loaded;
+
+    /* The cache knows files, not windows of them */
+    if (region)
+    {
+        loaded.analyzed = false;
+        loaded.store = false;
+        resolve(&loaded, NULL, 0, new Pack(filename, *region, config.io));
+        return loaded;
+    }
+
+    if (config.cache && (stat(filename, &before) == 0))
+        recall(filename, before, config, &loaded, &cached, &cachedHash);
+    else
+    {
+        loaded.pack = NULL;
+        loaded.analyzed = false;
+        loaded.store = false;
+    }
+
+    if (cached && !config.verifyCache)
+        resolve(&loaded, cached, cachedHash, NULL);
+    else
+        resolve(&loaded, cached, cachedHash, new Pack(filename, config.io));
+    return loaded;
+}
+
+/* The rest: analysis, and remembering the result */
+Pack *finishFile(const LoadedPack_t &loaded, const ScanConfig_t &config)
+{
+    Pack *pack = loaded.pack;
+    struct stat after;
+
+    if (!pack->isLoaded())
+        return pack;
+
+    if (loaded.analyzed)
+    {
+        if (config.index) pack->identify(*config.index);
+        return pack;
+    }
+    scanPack(pack, config);
+
+    /* Only remember it if it didn't change underneath us */
+    if (loaded.store && (stat(pack->filename().c_str(), &after) == 0))
+    {
+        ScanCache::Key_t now = ScanCache::makeKey(after);
+
+        if (memcmp(&loaded.key, &now, sizeof(now)) == 0)
+            config.cache->store(loaded.key, pack->contentHash(),
+                pack->serialize());
+    }
+
+    return pack;
+}
+
+Pack *scanFile(const char *filename, const ScanConfig_t &config)
+{
+    return finishFile(loadFile(filename, config), config);
+}
+
+/* loadFile() for a batch entry. Archives are left for next() to open
+ * and come back without a pack. */
+static LoadedPack_t loadEntry(const char *filename,
+    const Pack::Region_t *region, const ScanConfig_t &config)
+{
+    LoadedPack_t loaded = LoadedPack_t();
+
+    if (!region && ArchiveReader::isArchive(filename))
+        return loaded;
+    return loadFile(filename, config, region);
+}
+
+/* Stages a dump goes through on the ring, kept in the low bits of
+ * each SQE's user_data with the slot number above them */
+#define STAGE_STATX 0
+#define STAGE_OPEN  1
+#define STAGE_READ  2
+#define STAGE_CLOSE 3
+#define STAGE_DONE  4               /* loaded is ready for next() */
+#define STAGE_IDLE  5               /* Nothing in this slot */
+#define STAGE_BITS  4
+
+struct BatchScanner::Slot_t {
+    int file;                       /* Index into mFiles */
+    int stage;
+    struct statx fileStat;
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t size;                    /* From statx */
+    size_t done;                    /* Bytes read so far */
+    Pack *cached;                   /* Cache hit awaiting verification */
+    uint64_t cachedHash;
+    LoadedPack_t loaded;
+};
+
+BatchScanner::BatchScanner(char **files, const int count,
+    const ScanConfig_t &config, const Pack::Region_t *regions) :
+    mFiles(files), mRegions(regions), mCount(count), mNext(0), mQueued(0), mConfig(config),
+    mArchive(NULL), mReader(NULL), mDepth(0), mRing(NULL), mRingFailed(false), mInFlight(0)
+{
+    unsigned int depth = mConfig.ioDepth ? mConfig.ioDepth : 1;
+    unsigned int i = 0;
+
+    /* Keep statx/openat/read for the next few dumps on an io_uring.
+     * Regions are read on threads; the ring reads whole files. */
+    if (mConfig.io == Pack::IO_URING)
+    {
+        mRing = mRegions ? NULL : new Uring(depth * 2);
+        if ( mRing && mRing->isLoaded() && mRing->supports(IORING_OP_STATX) &&
+            mRing->supports(IORING_OP_OPENAT) &&
+            mRing->supports(IORING_OP_READ) &&
+            mRing->supports(IORING_OP_CLOSE) )
+        {
+            mSlots.resize(depth);
+            for (i = 0; (i < depth) && (mQueued < mCount); i++)
+                startSlot(&(mSlots[i]), mQueued++);
+            return;
+        }
+
+        /* No io_uring here; the same pipeline on plain threads */
+        delete mRing;
+        mRing = NULL;
+        mReader = new WorkerPool(depth);
+    }
+
+    /* O_DIRECT gets no kernel readahead, so read one dump ahead
+     * ourselves while the current one is being analyzed */
+    if (mConfig.io == Pack::IO_DIRECT)
+    {
+        depth = 1;
+        mReader = new WorkerPool(1);
+    }
+
+    if (mReader)
+    {
+        mDepth = depth;
+        readAhead();
+    }
+}
+
+BatchScanner::~BatchScanner()
+{
+    size_t i = 0;
+
+    delete mArchive;
+
+    /* Don't leave a read in flight, or its pack behind */
+    if (mReader)
+    {
+        mReader->wait();
+        while (!mAhead.empty())
+        {
+            delete mAhead.front().get().pack;
+            mAhead.pop_front();
+        }
+        delete mReader;
+    }
+
+    /* The kernel may still be writing into our buffers. If the ring
+     * broke, tearing it down cancels whatever it still had. */
+    if (mRing)
+    {
+        while (mInFlight && !mRingFailed)
+            mRingFailed = !pump();
+        if (mRingFailed)
+        {
+            delete mRing;
+            mRing = NULL;
+        }
+        for (i = 0; i < mSlots.size(); i++)
+        {
+            if (mSlots[i].stage == STAGE_DONE)
+                delete mSlots[i].loaded.pack;
+            else if (!mInFlight && (mSlots[i].fd != -1))
+                close(mSlots[i].fd);
+            delete mSlots[i].cached;
+            if (!mSlots[i].buffer.empty())
+                BufferPool::release(std::move(mSlots[i].buffer));
+        } /* End for */
+    }
+    delete mRing;
+}
+
+void BatchScanner::readAhead(void)
+{
+    std::shared_ptr<std::packaged_task<LoadedPack_t(void)> > task;
+
+    while ((mQueued < mCount) && (mAhead.size() < mDepth))
+    {
+        task = std::make_shared<std::packaged_task<LoadedPack_t(void)> >(
+            std::bind(loadEntry, mFiles[mQueued], region(mQueued),
+            std::cref(mConfig)));
+        mQueued++;
+        mAhead.push_back(task->get_future());
+        mReader->submit([task]() { (*task)(); });
+    } /* End while */
+}
+
+Pack *BatchScanner::next(void)
+{
+    LoadedPack_t loaded;
+    Pack *pack = NULL;
+
+    for (;;)
+    {
+        /* Members of an archive come before the file after it */
+        if (mArchive)
+        {
+            pack = mArchive->next();
+            if (pack)
+            {
+                if (pack->isLoaded())
+                    scanPack(pack, mConfig);
+                return pack;
+            }
+            delete mArchive;
+            mArchive = NULL;
+        }
+
+        if (mNext >= mCount)
+            return NULL;
+
+        loaded = take();
+        if (loaded.pack)
+            return finishFile(loaded, mConfig);
+        mArchive = new ArchiveReader(mFiles[mNext - 1]);
+    } /* End for */
+}
+
+/* The next file's loaded pack, however it was read */
+LoadedPack_t BatchScanner::take(void)
+{
+    LoadedPack_t loaded;
+    Slot_t *slot = NULL;
+
+    if (mRing)
+    {
+        /* Dumps finish out of order; hand them back in order */
+        slot = &(mSlots[mNext % mSlots.size()]);
+        while ((slot->stage != STAGE_DONE) && !mRingFailed)
+            mRingFailed = !pump();
+
+        if (slot->stage == STAGE_DONE)
+        {
+            loaded = slot->loaded;
+            slot->stage = STAGE_IDLE;
+            if (!mRingFailed && (mQueued < mCount))
+                startSlot(slot, mQueued++);
+        }
+        else
+        {
+            /* The ring stopped working; carry on without it */
+            loaded = loadEntry(mFiles[mNext], region(mNext), mConfig);
+        }
+        mNext++;
+    }
+    else if (mReader)
+    {
+        loaded = mAhead.front().get();
+        mAhead.pop_front();
+        mNext++;
+        readAhead();
+    }
+    else
+    {
+        /* Let the kernel read the next dump while we work on this one */
+        if ( (mConfig.io != Pack::IO_STREAM) && ((mNext + 1) < mCount) &&
+            !mRegions && !ArchiveReader::isArchive(mFiles[mNext + 1]) )
+            Pack::prefetch(mFiles[mNext + 1]);
+        loaded = loadEntry(mFiles[mNext], region(mNext), mConfig);
+        mNext++;
+    }
+
+    return loaded;
+}
+
+bool BatchScanner::queue(Slot_t *slot, const int stage,
+    struct io_uring_sqe **sqe)
+{
+    *sqe = mRing->getSqe();
+    if (!*sqe)
+    {
+        /* Full; push what's there to the kernel and try again */
+        mRing->submit(0);
+        *sqe = mRing->getSqe();
+        if (!*sqe) return false;
+    }
+
+    (*sqe)->user_data = ((uint64_t)(slot - &(mSlots[0])) << STAGE_BITS) | stage;
+    mInFlight++;
+    return true;
+}
+
+void BatchScanner::startSlot(Slot_t *slot, const int file)
+{
+    struct io_uring_sqe *sqe = NULL;
+
+    slot->file = file;
+    slot->stage = STAGE_STATX;
+    slot->fd = -1;
+    slot->size = 0;
+    slot->done = 0;
+    slot->cached = NULL;
+    slot->cachedHash = 0;
+    slot->loaded = LoadedPack_t();
+
+    /* Archives are opened by next() when their turn comes */
+    if (ArchiveReader::isArchive(mFiles[file]))
+    {
+        slot->stage = STAGE_DONE;
+        return;
+    }
+
+    if (!queue(slot, STAGE_STATX, &sqe))
+    {
+        finishSlot(slot, true);
+        return;
+    }
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)mFiles[file];
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uint64_t)(uintptr_t)&(slot->fileStat);
+}
+
+void BatchScanner::finishSlot(Slot_t *slot, const bool fallback)
+{
+    struct io_uring_sqe *sqe = NULL;
+    Pack *pack = NULL;
+
+    /* Let go of the file; nobody waits for this one */
+    if (slot->fd != -1)
+    {
+        if (queue(slot, STAGE_CLOSE, &sqe))
+        {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = slot->fd;
+        }
+        else
+            close(slot->fd);
+        slot->fd = -1;
+    }
+
+    if (fallback)
+    {
+        /* Something odd (missing, wrong size, changed underneath us);
+         * the synchronous loader knows how to report it */
+        delete slot->cached;
+        slot->cached = NULL;
+        if (!slot->buffer.empty())
+            BufferPool::release(std::move(slot->buffer));
+        slot->loaded = loadFile(mFiles[slot->file], mConfig);
+    }
+    else if (slot->cached && !mConfig.verifyCache)
+        resolve(&(slot->loaded), slot->cached, slot->cachedHash, NULL);
+    else
+    {
+        pack = new Pack(std::move(slot->buffer), slot->size, mFiles[slot->file]);
+        slot->buffer.clear();
+        resolve(&(slot->loaded), slot->cached, slot->cachedHash, pack);
+    }
+    slot->cached = NULL;
+    slot->stage = STAGE_DONE;
+}
+
+bool BatchScanner::pump(void)
+{
+    struct io_uring_cqe cqe;
+    struct io_uring_sqe *sqe = NULL;
+    struct stat fileStat;
+    Slot_t *slot = NULL;
+    int stage = 0;
+
+    if (!mRing->submit(1))
+        return false;
+
+    while (mRing->peek(&cqe))
+    {
+        mInFlight--;
+        slot = &(mSlots[cqe.user_data >> STAGE_BITS]);
+        stage = cqe.user_data & ((1 << STAGE_BITS) - 1);
+
+        switch (stage)
+        {
+            case STAGE_STATX:
+                if ( (cqe.res < 0) || !S_ISREG(slot->fileStat.stx_mode) ||
+                    ((slot->fileStat.stx_size != Pack::SIZE_8M) &&
+                    (slot->fileStat.stx_size != Pack::SIZE_32M)) )
+                {
+                    finishSlot(slot, true);
+                    break;
+                }
+                slot->size = slot->fileStat.stx_size;
+
+                /* The cache speaks struct stat */
+                if (mConfig.cache)
+                {
+                    memset(&fileStat, 0, sizeof(fileStat));
+                    fileStat.st_dev = makedev(slot->fileStat.stx_dev_major,
+                        slot->fileStat.stx_dev_minor);
+                    fileStat.st_ino = slot->fileStat.stx_ino;
+                    fileStat.st_mode = slot->fileStat.stx_mode;
+                    fileStat.st_size = slot->fileStat.stx_size;
+                    fileStat.st_mtim.tv_sec = slot->fileStat.stx_mtime.tv_sec;
+                    fileStat.st_mtim.tv_nsec = slot->fileStat.stx_mtime.tv_nsec;
+                    recall(mFiles[slot->file], fileStat, mConfig,
+                        &(slot->loaded), &(slot->cached), &(slot->cachedHash));
+                }
+                else
+                {
+                    slot->loaded.analyzed = false;
+                    slot->loaded.store = false;
+                }
+                if (slot->cached && !mConfig.verifyCache)
+                {
+                    finishSlot(slot, false);
+                    break;
+                }
+
+                slot->stage = STAGE_OPEN;
+                if (!queue(slot, STAGE_OPEN, &sqe))
+                {
+                    finishSlot(slot, true);
+                    break;
+                }
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)(uintptr_t)mFiles[slot->file];
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                break;
+
+            case STAGE_OPEN:
+                if (cqe.res < 0)
+                {
+                    finishSlot(slot, true);
+                    break;
+                }
+                slot->fd = cqe.res;
+
+                /* One spare byte tells us if it grew since statx */
+                slot->buffer = BufferPool::acquire(slot->size + 1);
+                slot->stage = STAGE_READ;
+                /* Fall through */
+
+            case STAGE_READ:
+                if (stage == STAGE_READ)
+                {
+                    if (cqe.res < 0)
+                    {
+                        finishSlot(slot, true);
+                        break;
+                    }
+                    slot->done += cqe.res;
+
+                    /* A short read of a regular file means end of file */
+                    if (slot->done > slot->size)
+                    {
+                        finishSlot(slot, true);
+                        break;
+                    }
+                    if ((cqe.res == 0) || (slot->done == slot->size))
+                    {
+                        finishSlot(slot, slot->done != slot->size);
+                        break;
+                    }
+                }
+
+                if (!queue(slot, STAGE_READ, &sqe))
+                {
+                    finishSlot(slot, true);
+                    break;
+                }
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = slot->fd;
+                sqe->addr = (uint64_t)(uintptr_t)&(slot->buffer[slot->done]);
+                sqe->len = slot->size + 1 - slot->done;
+                sqe->off = slot->done;
+                break;
+
+            default:
+                /* Close completions need nothing */
+                break;
+        } /* End switch */
+    } /* End while */
+
+    return true;
+}
@@ -0,0 +1,120 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <deque>
+#include <future>
+#include "pack.h"
+#include "content_index.h"
+#include "block_index.h"
+#include "scan_cache.h"
+#include "worker_pool.h"
+#include "uring.h"
+#include "archive.h"
+#include "extract.h"
+
+/* Which optional analysis passes to run on each pack. Shared by the
+ * one-shot, batch and long-running modes so they all agree. */
+typedef struct {
+    const ContentIndex *index;      /* Identify contents, if set */
+    const BlockIndex *blockIndex;   /* Attribute orphans, if set */
+    bool pages;                     /* Page-level orphan matching */
+    bool entropy;                   /* Entropy profile */
+    bool diagnose;                  /* Checksum rule diagnosis */
+    const ContentExtractor *extractor; /* Extract contents, if set */
+    ScanCache *cache;               /* Reuse earlier results, if set */
+    bool verifyCache;               /* Re-hash dumps before trusting a hit */
+    Pack::IoPolicy_t io;            /* How scanFile() reads dumps */
+    unsigned int ioDepth;           /* Dumps in flight for IO_URING */
+} ScanConfig_t;
+
+extern void initScanConfig(ScanConfig_t *config);
+
+/* Run analyze() and every enabled pass on a loaded pack. */
+extern void scanPack(Pack *pack, const ScanConfig_t &config);
+
+/* A dump that has been read (or recalled from the scan cache) but not
+ * yet analyzed. See loadFile() and finishFile(). */
+typedef struct {
+    Pack *pack;
+    bool analyzed;                  /* Came from the cache */
+    bool store;                     /* Add to the cache once analyzed */
+    ScanCache::Key_t key;
+} LoadedPack_t;
+
+/* With a region, only that window of the file is read (see Pack), and
+ * the scan cache is bypassed */
+extern LoadedPack_t loadFile(const char *filename, const ScanConfig_t &config,
+    const Pack::Region_t *region = NULL);
+extern Pack *finishFile(const LoadedPack_t &loaded, const ScanConfig_t &config);
+
+/* Load and scan a dump by name, answering from the scan cache when the
+ * file is unchanged. The cache only covers header analysis, so it is
+ * bypassed when orphan attribution, profiling, checksum diagnosis or
+ * extraction needs the data. The caller owns the returned pack, which
+ * may have failed to load. */
+extern Pack *scanFile(const char *filename, const ScanConfig_t &config);
+
+/* scanFile() over a list of dumps, in order, keeping the I/O ahead of
+ * the analysis: the next dump is prefetched, or with IO_DIRECT read on
+ * a background thread, while the caller works on the current one.
+ * IO_URING keeps ioDepth dumps moving through statx, openat and read
+ * on an io_uring, or on that many threads if io_uring isn't there.
+ * ZIP and TAR archives in the list are expanded in place into one pack
+ * per member (see ArchiveReader); those bypass the scan cache.
+ *
+ * regions, if given, holds one window per file to scan as the pack.
+ * Those are read one region at a time (on threads for IO_URING), never
+ * expanded as archives, and bypass the scan cache. */
+class BatchScanner {
+public:
+    BatchScanner(char **files, const int count, const ScanConfig_t &config,
+        const Pack::Region_t *regions = NULL);
+    ~BatchScanner();
+
+    /* The next scanned pack, which the caller owns, or NULL when done */
+    Pack *next(void);
+
+private:
+    struct Slot_t;
+
+    LoadedPack_t take(void);
+    void readAhead(void);
+    bool queue(Slot_t *slot, const int stage, struct io_uring_sqe **sqe);
+    void startSlot(Slot_t *slot, const int file);
+    void finishSlot(Slot_t *slot, const bool fallback);
+    bool pump(void);
+
+    const Pack::Region_t *region(const int file) const
+        { return mRegions ? &(mRegions[file]) : NULL; }
+
+    char **mFiles;
+    const Pack::Region_t *mRegions;
+    int mCount;
+    int mNext;                      /* Next dump next() hands back */
+    int mQueued;                    /* Next dump to start reading */
+    ScanConfig_t mConfig;
+    ArchiveReader *mArchive;        /* Archive whose members come next */
+
+    /* Thread-based read-ahead */
+    WorkerPool *mReader;
+    size_t mDepth;
+    std::deque<std::future<LoadedPack_t> > mAhead;
+
+    /* io_uring pipeline; dump N lives in slot N % mSlots.size() */
+    Uring *mRing;
+    bool mRingFailed;
+    std::vector<Slot_t> mSlots;
+    unsigned int mInFlight;         /* SQEs without a completion yet */
+};
+
+#endif /* __SCAN_H__ */
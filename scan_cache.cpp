@@ -0,0 +1,221 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <iostream>
+#include "scan_cache.h"
+#include "hash.h"
+
+static const char CACHE_MAGIC[8] = { 'P', 'S', 'C', 'A', 'C', 'H', 'E', '1' };
+static const uint32_t RECORD_MAGIC = 0x52435350; /* "PSCR" */
+
+/* Files modified this recently may still be being written, and a
+ * second write within the same mtime tick would go unnoticed */
+static const time_t RACY_SECONDS = 2;
+
+ScanCache::ScanCache(const char *filename, const uint32_t layout) :
+    mFilename(filename), mFd(-1), mMap(NULL), mMapSize(0),
+    mIndexed(sizeof(FileHeader_t)), mIsLoaded(false)
+{
+    FileHeader_t header;
+    struct stat fileStat;
+    ssize_t bytes = 0;
+
+    mFd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (mFd == -1)
+    {
+        std::cout << "Unable to open scan cache '" << filename << "': ";
+        std::cout << strerror(errno) << std::endl;
+        return;
+    }
+
+    /* Whoever gets here first on an empty file writes the header */
+    flock(mFd, LOCK_EX);
+    if ((fstat(mFd, &fileStat) == 0) && (fileStat.st_size == 0))
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.layout = layout;
+        bytes = write(mFd, &header, sizeof(header));
+    }
+    else
+        bytes = pread(mFd, &header, sizeof(header), 0);
+    flock(mFd, LOCK_UN);
+
+    if ( (bytes != (ssize_t)sizeof(header)) ||
+        (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) )
+    {
+        std::cout << "Scan cache '" << filename << "' is not a valid cache file";
+        std::cout << std::endl;
+        return;
+    }
+
+    if (header.layout != layout)
+    {
+        std::cout << "Scan cache '" << filename << "' was written by a ";
+        std::cout << "different version of packscan; delete it to rebuild";
+        std::cout << std::endl;
+        return;
+    }
+
+    /* Done! */
+    mIsLoaded = remap();
+}
+
+ScanCache::~ScanCache()
+{
+    if (mMap) munmap(const_cast<uint8_t *>(mMap), mMapSize);
+    if (mFd != -1) close(mFd);
+}
+
+size_t ScanCache::KeyHash::operator()(const Key_t &key) const
+{
+    return hash64(&key, sizeof(key), 0);
+}
+
+bool ScanCache::KeyEqual::operator()(const Key_t &a, const Key_t &b) const
+{
+    return memcmp(&a, &b, sizeof(Key_t)) == 0;
+}
+
+ScanCache::Key_t ScanCache::makeKey(const struct stat &fileStat)
+{
+    Key_t key;
+
+    memset(&key, 0, sizeof(key));
+    key.device = fileStat.st_dev;
+    key.inode = fileStat.st_ino;
+    key.size = fileStat.st_size;
+    key.mtimeSec = fileStat.st_mtim.tv_sec;
+    key.mtimeNsec = fileStat.st_mtim.tv_nsec;
+    return key;
+}
+
+bool ScanCache::cacheable(const struct stat &fileStat)
+{
+    return ((fileStat.st_mode & S_IFMT) == S_IFREG) &&
+        ((time(NULL) - fileStat.st_mtim.tv_sec) >= RACY_SECONDS);
+}
+
+bool ScanCache::remap(void)
+{
+    struct stat fileStat;
+    const Record_t *record = NULL;
+    void *map = NULL;
+    Record_t copy;
+
+    if (fstat(mFd, &fileStat) == -1)
+        return false;
+
+    /* Grow the mapping to cover whatever has been appended */
+    if ((size_t)fileStat.st_size > mMapSize)
+    {
+        map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+        if (map == MAP_FAILED)
+            return false;
+        if (mMap) munmap(const_cast<uint8_t *>(mMap), mMapSize);
+        mMap = static_cast<const uint8_t *>(map);
+        mMapSize = fileStat.st_size;
+    }
+
+    /* Index every complete record we haven't seen yet. A record that
+     * fails its checksum is either still being written by someone else
+     * or was torn by a crash; stop there and look again later. */
+    while ((mIndexed + sizeof(Record_t)) <= mMapSize)
+    {
+        record = reinterpret_cast<const Record_t *>(mMap + mIndexed);
+        memcpy(&copy, record, sizeof(copy));
+
+        if ( (copy.magic != RECORD_MAGIC) ||
+            ((mIndexed + sizeof(Record_t) + copy.length) > mMapSize) ||
+            (hash64(mMap + mIndexed + sizeof(Record_t), copy.length, 0) !=
+                copy.checksum) )
+            break;
+
+        mIndex[copy.key] = mIndexed;
+        mIndexed += sizeof(Record_t) + copy.length;
+    } /* End while */
+
+    return true;
+}
+
+bool ScanCache::lookup(const Key_t &key, std::string *payload,
+    uint64_t *contentHash)
+{
+    std::unordered_map<Key_t, size_t, KeyHash, KeyEqual>::iterator it;
+    const Record_t *record = NULL;
+
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mIsLoaded) return false;
+
+    it = mIndex.find(key);
+    if (it == mIndex.end())
+    {
+        /* Another worker may have added it since we last looked */
+        remap();
+        it = mIndex.find(key);
+        if (it == mIndex.end())
+            return false;
+    }
+
+    record = reinterpret_cast<const Record_t *>(mMap + it->second);
+    payload->assign(reinterpret_cast<const char *>(record + 1), record->length);
+    if (contentHash) *contentHash = record->contentHash;
+    return true;
+}
+
+bool ScanCache::store(const Key_t &key, const uint64_t contentHash,
+    const std::string &payload)
+{
+    std::string buffer;
+    Record_t record;
+    ssize_t bytes = 0;
+
+    memset(&record, 0, sizeof(record));
+    record.magic = RECORD_MAGIC;
+    record.length = payload.size();
+    record.key = key;
+    record.contentHash = contentHash;
+    record.checksum = hash64(payload.data(), payload.size(), 0);
+    buffer.assign(reinterpret_cast<const char *>(&record), sizeof(record));
+    buffer += payload;
+
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mIsLoaded) return false;
+
+    /* The exclusive lock keeps appends from other processes whole */
+    flock(mFd, LOCK_EX);
+    remap();
+
+    /* Nobody else can be writing right now, so anything past the last
+     * good record is debris from a crash. Drop it. */
+    if (mIndexed < mMapSize)
+    {
+        if (ftruncate(mFd, mIndexed) == 0)
+        {
+            munmap(const_cast<uint8_t *>(mMap), mMapSize);
+            mMap = NULL;
+            mMapSize = 0;
+        }
+    }
+
+    /* O_APPEND plus a single write() puts the record at the end */
+    bytes = write(mFd, buffer.data(), buffer.size());
+    flock(mFd, LOCK_UN);
+
+    remap();
+    return (bytes == (ssize_t)buffer.size());
+}
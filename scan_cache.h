@@ -0,0 +1,84 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __SCAN_CACHE_H__
+#define __SCAN_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+
+/* Persistent, append-only cache of analysis results keyed by file
+ * identity (device, inode, size, mtime). The file is memory-mapped for
+ * lookups; new results are appended under an exclusive flock() so any
+ * number of threads and processes can share one cache. A later record
+ * for the same file supersedes an earlier one, and a changed size or
+ * mtime simply stops matching, so invalidation is automatic. */
+class ScanCache {
+public:
+    typedef struct {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+    } Key_t;
+
+    ScanCache(const char *filename, const uint32_t layout);
+    ~ScanCache();
+    bool isLoaded(void) const { return mIsLoaded; }
+
+    static Key_t makeKey(const struct stat &fileStat);
+    static bool cacheable(const struct stat &fileStat);
+
+    /* Copy out the payload stored for key. contentHash is zero if the
+     * record was written without one. */
+    bool lookup(const Key_t &key, std::string *payload, uint64_t *contentHash);
+    bool store(const Key_t &key, const uint64_t contentHash,
+        const std::string &payload);
+
+private:
+    typedef struct {
+        char magic[8];          /* "PSCACHE1" */
+        uint32_t layout;        /* Payload layout version, see scan_cache.cpp */
+        uint32_t reserved;
+    } FileHeader_t;
+
+    typedef struct {
+        uint32_t magic;         /* RECORD_MAGIC */
+        uint32_t length;        /* Payload bytes following this header */
+        Key_t key;
+        uint64_t contentHash;   /* hash64() of the dump, or zero */
+        uint64_t checksum;      /* hash64() of the payload */
+    } Record_t;
+
+    struct KeyHash {
+        size_t operator()(const Key_t &key) const;
+    };
+    struct KeyEqual {
+        bool operator()(const Key_t &a, const Key_t &b) const;
+    };
+
+    bool remap(void);
+
+    std::string mFilename;
+    int mFd;
+    const uint8_t *mMap;
+    size_t mMapSize;
+    size_t mIndexed;            /* Bytes of the file already indexed */
+    std::unordered_map<Key_t, size_t, KeyHash, KeyEqual> mIndex;
+    std::mutex mLock;
+    bool mIsLoaded;
+};
+
+#endif /* __SCAN_CACHE_H__ */
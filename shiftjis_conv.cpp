@@ -72,13 +72,13 @@ void sjis2ascii(char* bData)
 }
 
 // PSV files (PS1/PS2) savegame titles are stored in Shift-JIS
-char* sjis2utf8(char* input)
+//Convert into a caller-supplied buffer of at least 3 * strlen(input) + 1 bytes
+size_t sjis2utf8Into(char* input, char* output)
 {
     // Simplify the input and decode standard ASCII characters
     sjis2ascii(input);
 
     size_t len = strlen(input);
-    char* output = (char *)malloc(3 * len); //ShiftJis won't give 4byte UTF8, so max. 3 byte per input char are needed
     size_t indexInput = 0, indexOutput = 0;
 
     while(indexInput < len)
@@ -124,6 +124,14 @@ char* sjis2utf8(char* input)
 
 	//remove the unnecessary bytes
     output[indexOutput] = 0;
+    return indexOutput;
+}
+
+char* sjis2utf8(char* input)
+{
+    //ShiftJis won't give 4byte UTF8, so max. 3 byte per input char are needed
+    char* output = (char *)malloc(3 * strlen(input) + 1);
+    sjis2utf8Into(input, output);
     return output;
 }
 
@@ -11,8 +11,11 @@
 #ifndef __SHIFTJIS_CONV_H__
 #define __SHIFTJIS_CONV_H__
 
+#include <stddef.h>
+
 extern void sjis2ascii(char* bData);
 extern char* sjis2utf8(char* input);
+extern size_t sjis2utf8Into(char* input, char* output);
 
 #endif /* __SHIFTJIS_CONV_H__ */
 
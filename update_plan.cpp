@@ -0,0 +1,406 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include "update_plan.h"
+#include "util.h"
+
+/* Any erase costs more than programming every byte of a block */
+#define ERASE_COST ((uint64_t)1 << 32)
+
+/* Unchanged runs shorter than this are written over rather than
+ * splitting a write in two. Rewriting a byte with what it already
+ * holds (or 0xFF into an erased byte) programs nothing. */
+#define MERGE_GAP 16
+
+#define NO_BLOCK 0xFFFFFFFF
+
+UpdatePlanner::UpdatePlanner(const Pack &current, const Pack &desired) :
+    mCurrent(current), mDesired(desired), mTotalBlocks(0), mEraseMask(0)
+{
+}
+
+/* What turning block of the current pack into target costs: an erase
+ * if any bit has to go from 0 to 1, plus the bytes programmed */
+uint64_t UpdatePlanner::blockCost(const uint32_t block, const uint8_t *target) const
+{
+    const uint8_t *current = mCurrent.data() + (block * PACK_BLOCK_SIZE);
+    uint64_t differs = 0, dirty = 0;
+    bool erase = false;
+    uint32_t i = 0;
+
+    if (!memcmp(current, target, PACK_BLOCK_SIZE))
+        return 0;
+
+#if defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+
+    for (i = 0; i < PACK_BLOCK_SIZE; i += 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(current + i));
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(target + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(c, t), t)) != 0xFFFF)
+            erase = true;
+        differs += __builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(c, t)) & 0xFFFF);
+        dirty += __builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(t, ones)) & 0xFFFF);
+    } /* End for */
+#else
+    for (i = 0; i < PACK_BLOCK_SIZE; i++)
+    {
+        if ((current[i] & target[i]) != target[i])
+            erase = true;
+        if (current[i] != target[i]) differs++;
+        if (target[i] != 0xFF) dirty++;
+    } /* End for */
+#endif
+
+    return erase ? (ERASE_COST + dirty) : differs;
+}
+
+/* Builds mImage with the fixed blocks as the desired image has them
+ * and each desired header's content on the blocks in masks (0 for the
+ * fixed ones). Blocks nothing lands on keep what the current pack has
+ * there, less any headers. */
+void UpdatePlanner::layout(const std::vector<uint32_t> &masks,
+    const uint32_t fixed)
+{
+    const uint8_t *desired = mDesired.data();
+    uint32_t placed = fixed, x = 0, k = 0, i = 0, from = 0;
+    uint8_t *window = NULL;
+
+    mImage.assign(mCurrent.data(), mCurrent.data() + mCurrent.packSize());
+    for (x = 0; x < mTotalBlocks; x++)
+        if ((fixed >> x) & 0x1)
+            memcpy(&mImage[x * PACK_BLOCK_SIZE], desired + (x * PACK_BLOCK_SIZE),
+                PACK_BLOCK_SIZE);
+
+    for (i = 0; i < masks.size(); i++)
+    {
+        const Pack::Header_t &header = mDesired.header(i);
+
+        if (!masks[i])
+            continue;
+        placed |= masks[i];
+
+        /* Same blocks in the same order, just somewhere else */
+        from = mDesired.blockMask(&header);
+        for (x = 0, k = 0; x < mTotalBlocks; x++)
+        {
+            if ( !((masks[i] >> x) & 0x1) )
+                continue;
+            while ( !((from >> k) & 0x1) )
+                k++;
+            memcpy(&mImage[x * PACK_BLOCK_SIZE], desired + (k * PACK_BLOCK_SIZE),
+                PACK_BLOCK_SIZE);
+            k++;
+        } /* End for */
+
+        window = &mImage[(__builtin_ctz(masks[i]) * PACK_BLOCK_SIZE) +
+            (header.address % PACK_BLOCK_SIZE)];
+        window[0x20] = masks[i] & 0xFF;
+        window[0x21] = (masks[i] >> 8) & 0xFF;
+        window[0x22] = (masks[i] >> 16) & 0xFF;
+        window[0x23] = (masks[i] >> 24) & 0xFF;
+    } /* End for */
+
+    /* Old headers left on unused blocks would claim blocks that now
+     * belong to others. Deleting them only clears bits, so it never
+     * costs an erase. */
+    for (i = 0; i < mCurrent.headerCount(); i++)
+    {
+        const Pack::Header_t &header = mCurrent.header(i);
+
+        if ((placed >> (header.address / PACK_BLOCK_SIZE)) & 0x1)
+            continue;
+
+        window = &mImage[header.address];
+        window[0x20] = window[0x21] = window[0x22] = window[0x23] = 0x00;
+        window[0x2A] = 0x00;
+    } /* End for */
+}
+
+/* Erases and writes that take the current pack to mImage */
+void UpdatePlanner::diff(void)
+{
+    uint32_t x = 0, i = 0, start = 0, last = 0;
+    const uint8_t *current = NULL, *target = NULL;
+    Range_t range;
+    bool erase = false, differs = false;
+
+    mEraseMask = 0;
+    mWrites.clear();
+
+    for (x = 0; x < mTotalBlocks; x++)
+    {
+        current = mCurrent.data() + (x * PACK_BLOCK_SIZE);
+        target = &mImage[x * PACK_BLOCK_SIZE];
+        if (!memcmp(current, target, PACK_BLOCK_SIZE))
+            continue;
+
+        erase = false;
+        for (i = 0; !erase && (i < PACK_BLOCK_SIZE); i++)
+            erase = ((current[i] & target[i]) != target[i]);
+        if (erase)
+            mEraseMask |= (1u << x);
+
+        /* Runs of bytes to program, close ones merged */
+        start = NO_BLOCK;
+        for (i = 0; i < PACK_BLOCK_SIZE; i++)
+        {
+            differs = erase ? (target[i] != 0xFF) : (target[i] != current[i]);
+            if (!differs)
+                continue;
+
+            if ((start != NO_BLOCK) && ((i - last) > MERGE_GAP))
+            {
+                range.address = (x * PACK_BLOCK_SIZE) + start;
+                range.length = last + 1 - start;
+                mWrites.push_back(range);
+                start = NO_BLOCK;
+            }
+            if (start == NO_BLOCK)
+                start = i;
+            last = i;
+        } /* End for */
+
+        if (start != NO_BLOCK)
+        {
+            range.address = (x * PACK_BLOCK_SIZE) + start;
+            range.length = last + 1 - start;
+            mWrites.push_back(range);
+        }
+    } /* End for */
+}
+
+uint64_t UpdatePlanner::bytesWritten(void) const
+{
+    uint64_t total = 0;
+    size_t i = 0;
+
+    for (i = 0; i < mWrites.size(); i++)
+        total += mWrites[i].length;
+    return total;
+}
+
+bool UpdatePlanner::plan(const bool relocate)
+{
+    uint32_t all = 0, fixed = 0, used = 0, mask = 0, count = 0;
+    uint32_t headerBlocks = 0, claimable = 0;
+    uint32_t i = 0, j = 0, k = 0, x = 0, best = 0;
+    uint64_t identityCost = 0, cost = 0;
+    std::vector<uint32_t> masks, order, source;
+    std::vector<uint64_t> table;
+    std::vector<uint8_t> first;
+    uint32_t allocOffset = 0;
+    std::vector<uint32_t> from;
+
+    if (!mCurrent.data() || !mDesired.data())
+    {
+        mErrorMessage = "Both packs must be loaded to plan an update";
+        return false;
+    }
+    if (mCurrent.packSize() != mDesired.packSize())
+    {
+        mErrorMessage = "'" + mCurrent.filename() + "' and '" +
+            mDesired.filename() + "' aren't the same size";
+        return false;
+    }
+
+    /* Reflashing the desired image as it is */
+    mTotalBlocks = mDesired.packSize() / PACK_BLOCK_SIZE;
+    all = (mTotalBlocks == 32) ? 0xFFFFFFFF : ((1u << mTotalBlocks) - 1);
+    mImage.assign(mDesired.data(), mDesired.data() + mDesired.packSize());
+    diff();
+    if (!relocate)
+        return true;
+    identityCost = (__builtin_popcount(mEraseMask) * ERASE_COST) + bytesWritten();
+    headerBlocks = Pack::headerBlocks(mDesired.packSize());
+    claimable = Pack::claimableBlocks(mDesired.packSize());
+
+    /* Contents that share blocks, or whose header isn't in their first
+     * block, stay put along with any data no header claims */
+    fixed = mDesired.allocation().unclaimedUsedMask() & all;
+    masks.assign(mDesired.headerCount(), 0);
+    for (i = 0; i < mDesired.headerCount(); i++)
+    {
+        const Pack::Header_t &header = mDesired.header(i);
+
+        mask = mDesired.blockMask(&header) & all;
+        if ( mask && !(mask & mDesired.allocation().overlapMask()) &&
+            ((header.address / PACK_BLOCK_SIZE) == (uint32_t)__builtin_ctz(mask)) )
+            order.push_back(i);
+        else
+            fixed |= mask;
+    } /* End for */
+
+    /* Biggest first; they have the fewest places to go */
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return __builtin_popcount(mDesired.blockMask(&mDesired.header(a))) >
+            __builtin_popcount(mDesired.blockMask(&mDesired.header(b)));
+    });
+
+    /* Each content's blocks go, in order, on the free blocks where the
+     * current pack makes them cheapest. table[k][x] is the cheapest way
+     * to put blocks 0..k down with block k on x. */
+    used = fixed;
+    for (i = 0; i < order.size(); i++)
+    {
+        mask = mDesired.blockMask(&mDesired.header(order[i])) & all;
+        count = __builtin_popcount(mask);
+        source.clear();
+        for (x = 0; x < mTotalBlocks; x++)
+            if ((mask >> x) & 0x1) source.push_back(x);
+
+        allocOffset = (mDesired.header(order[i]).address % PACK_BLOCK_SIZE) + 0x20;
+        first.assign(mDesired.data() + (source[0] * PACK_BLOCK_SIZE),
+            mDesired.data() + ((source[0] + 1) * PACK_BLOCK_SIZE));
+        table.assign(count * mTotalBlocks, ~(uint64_t)0);
+        from.assign(count * mTotalBlocks, NO_BLOCK);
+        for (k = 0; k < count; k++)
+        {
+            for (x = 0; x < mTotalBlocks; x++)
+            {
+                if ((used >> x) & 0x1)
+                    continue;
+
+                /* Only where packscan would still find the header and
+                 * blockAlloc can claim the block */
+                if ( !((claimable >> x) & 0x1) ||
+                    ((k == 0) && !((headerBlocks >> x) & 0x1)) )
+                    continue;
+
+                /* The header block's blockAlloc gets rewritten for
+                 * wherever it lands; assume it'll match what's there */
+                if (k == 0)
+                {
+                    memcpy(&first[allocOffset], mCurrent.data() +
+                        (x * PACK_BLOCK_SIZE) + allocOffset, 4);
+                    cost = blockCost(x, &first[0]);
+                }
+                else
+                    cost = blockCost(x, mDesired.data() + (source[k] * PACK_BLOCK_SIZE));
+                if (k == 0)
+                {
+                    table[x] = cost;
+                    continue;
+                }
+                for (j = 0; j < x; j++)
+                {
+                    uint64_t before = table[((k - 1) * mTotalBlocks) + j];
+
+                    if ((before != ~(uint64_t)0) &&
+                        ((before + cost) < table[(k * mTotalBlocks) + x]))
+                    {
+                        table[(k * mTotalBlocks) + x] = before + cost;
+                        from[(k * mTotalBlocks) + x] = j;
+                    }
+                } /* End for */
+            } /* End for */
+        } /* End for */
+
+        best = NO_BLOCK;
+        for (x = 0; x < mTotalBlocks; x++)
+            if ( (table[((count - 1) * mTotalBlocks) + x] != ~(uint64_t)0) &&
+                ((best == NO_BLOCK) || (table[((count - 1) * mTotalBlocks) + x] <
+                table[((count - 1) * mTotalBlocks) + best])) )
+                best = x;
+
+        /* Nowhere left to put it; reflash the desired image as is */
+        if (best == NO_BLOCK)
+        {
+            mImage.assign(mDesired.data(), mDesired.data() + mDesired.packSize());
+            diff();
+            return true;
+        }
+
+        mask = 0;
+        for (k = count, x = best; k > 0; k--)
+        {
+            mask |= (1u << x);
+            x = from[((k - 1) * mTotalBlocks) + x];
+        } /* End for */
+        used |= mask;
+        masks[order[i]] = mask;
+    } /* End for */
+
+    /* Only keep the rearranged layout if it actually saves something,
+     * and reads back with every header the desired image has */
+    layout(masks, fixed);
+    diff();
+    Pack check(&mImage[0], mImage.size(), mDesired.filename().c_str());
+    check.findHeaders();
+    if ( (check.headerCount() != mDesired.headerCount()) ||
+        (((__builtin_popcount(mEraseMask) * ERASE_COST) + bytesWritten()) >=
+        identityCost) )
+    {
+        mImage.assign(mDesired.data(), mDesired.data() + mDesired.packSize());
+        diff();
+    }
+
+    /* Done! */
+    return true;
+}
+
+std::string UpdatePlanner::script(const std::string &imageFile) const
+{
+    std::stringstream text;
+    size_t next = 0;
+    uint32_t x = 0;
+
+    text << "# PackScan update plan" << std::endl;
+    text << "# FROM " << mCurrent.filename() << std::endl;
+    text << "# TO   " << mDesired.filename() << std::endl;
+    text << "# " << __builtin_popcount(mEraseMask) << " of " << mTotalBlocks;
+    text << " blocks erased, " << mWrites.size() << " writes, ";
+    text << bytesWritten() << " bytes" << std::endl;
+    text << "IMAGE " << imageFile << std::endl;
+
+    text << std::hex << std::uppercase;
+    for (x = 0; x < mTotalBlocks; x++)
+    {
+        if ((mEraseMask >> x) & 0x1)
+            text << "ERASE 0x" << (x * PACK_BLOCK_SIZE) << std::endl;
+        for (; (next < mWrites.size()) &&
+            ((mWrites[next].address / PACK_BLOCK_SIZE) == x); next++)
+        {
+            text << "WRITE 0x" << mWrites[next].address << " 0x";
+            text << mWrites[next].length << std::endl;
+        } /* End for */
+    } /* End for */
+    text << "END" << std::endl;
+    return text.str();
+}
+
+bool UpdatePlanner::write(const char *scriptFile) const
+{
+    std::string imageFile = std::string(scriptFile) + ".bin";
+    std::string imageName = imageFile;
+    std::string text;
+
+    /* The script names its image relative to itself */
+    if (imageName.rfind('/') != std::string::npos)
+        imageName = imageName.substr(imageName.rfind('/') + 1);
+    text = script(imageName);
+
+    return writeImageFile(imageFile, &mImage[0], mImage.size()) &&
+        writeImageFile(scriptFile, reinterpret_cast<const uint8_t *>(text.data()),
+            text.size());
+}
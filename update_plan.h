@@ -0,0 +1,75 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __UPDATE_PLAN_H__
+#define __UPDATE_PLAN_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "pack.h"
+
+/* Works out how to reflash a pack holding one image so it holds
+ * another, erasing as few 128 KB blocks as possible. Flash programming
+ * can only clear bits, so a block is erased only when some byte needs
+ * a bit set again; everywhere else only the bytes that differ are
+ * programmed.
+ *
+ * With relocation, contents of the desired image may land on other
+ * blocks than they have there (blockAlloc is rewritten to match) when
+ * the current pack already holds their blocks somewhere. Headers left
+ * behind in blocks no content uses any more are marked deleted (maker
+ * 0x00, no blocks) rather than erased, which needs no erase either;
+ * the rest of such blocks keeps its old data. Contents only move to
+ * blocks where packscan would still find their headers (see
+ * Pack::headerBlocks() and Pack::claimableBlocks()). A rearranged
+ * layout is only used when it beats reflashing the desired image as it
+ * is and shows every one of its headers. */
+class UpdatePlanner {
+public:
+    typedef struct {
+        uint32_t address;
+        uint32_t length;
+    } Range_t;
+
+    /* Both packs must be analyzed, and stay around while planning */
+    UpdatePlanner(const Pack &current, const Pack &desired);
+    const std::string &errorMessage(void) const { return mErrorMessage; }
+
+    bool plan(const bool relocate);
+
+    /* What the pack holds once the plan has run */
+    const std::vector<uint8_t> &image(void) const { return mImage; }
+    uint32_t eraseMask(void) const { return mEraseMask; }
+    const std::vector<Range_t> &writes(void) const { return mWrites; }
+    uint64_t bytesWritten(void) const;
+
+    /* Flasher script: ERASE and WRITE lines, with WRITE data taken from
+     * the same address of imageFile (a copy of image()) */
+    std::string script(const std::string &imageFile) const;
+
+    /* The script to scriptFile and the image to scriptFile + ".bin" */
+    bool write(const char *scriptFile) const;
+
+private:
+    void layout(const std::vector<uint32_t> &masks, const uint32_t fixed);
+    void diff(void);
+    uint64_t blockCost(const uint32_t block, const uint8_t *target) const;
+
+    const Pack &mCurrent;
+    const Pack &mDesired;
+    uint32_t mTotalBlocks;
+    std::vector<uint8_t> mImage;
+    uint32_t mEraseMask;
+    std::vector<Range_t> mWrites;
+    std::string mErrorMessage;
+};
+
+#endif /* __UPDATE_PLAN_H__ */
@@ -0,0 +1,180 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int uringSetup(const unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(const int fd, const unsigned int toSubmit,
+    const unsigned int minComplete, const unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+        NULL, 0);
+}
+
+static int uringRegister(const int fd, const unsigned int opcode, void *arg,
+    const unsigned int count)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+Uring::Uring(const unsigned int entries) :
+    mFd(-1), mSqRing(NULL), mSqRingSize(0), mCqRing(NULL), mCqRingSize(0),
+    mSqes(NULL), mSqesSize(0), mSqHead(NULL), mSqTail(NULL), mSqMask(NULL),
+    mSqArray(NULL), mCqHead(NULL), mCqTail(NULL), mCqMask(NULL), mCqes(NULL),
+    mPending(0), mIsLoaded(false)
+{
+    struct io_uring_params params;
+    struct io_uring_probe *probe = NULL;
+    const size_t probeSize = sizeof(struct io_uring_probe) +
+        (256 * sizeof(struct io_uring_probe_op));
+    uint8_t *sq = NULL;
+    uint8_t *cq = NULL;
+    int i = 0;
+
+    memset(mSupported, 0, sizeof(mSupported));
+    memset(&params, 0, sizeof(params));
+
+    /* Not there at all (old kernel, or blocked by seccomp) */
+    mFd = uringSetup(entries, &params);
+    if (mFd == -1)
+        return;
+
+    mSqRingSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    mCqRingSize = params.cq_off.cqes +
+        (params.cq_entries * sizeof(struct io_uring_cqe));
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (mCqRingSize > mSqRingSize) mSqRingSize = mCqRingSize;
+        mCqRingSize = 0;
+    }
+
+    mSqRing = mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED)
+    {
+        mSqRing = NULL;
+        return;
+    }
+
+    if (mCqRingSize)
+    {
+        mCqRing = mmap(NULL, mCqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED)
+        {
+            mCqRing = NULL;
+            return;
+        }
+    }
+    else
+        mCqRing = mSqRing;
+
+    mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    mSqes = static_cast<struct io_uring_sqe *>(mmap(NULL, mSqesSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd,
+        IORING_OFF_SQES));
+    if (mSqes == MAP_FAILED)
+    {
+        mSqes = NULL;
+        return;
+    }
+
+    sq = static_cast<uint8_t *>(mSqRing);
+    cq = static_cast<uint8_t *>(mCqRing);
+    mSqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    mSqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    mSqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    mSqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    mCqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    mCqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    mCqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    mCqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    /* Ask which opcodes this kernel knows about */
+    probe = static_cast<struct io_uring_probe *>(calloc(1, probeSize));
+    if (probe && (uringRegister(mFd, IORING_REGISTER_PROBE, probe, 256) == 0))
+    {
+        for (i = 0; (i < probe->ops_len) && (i < 256); i++)
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+                mSupported[probe->ops[i].op] = 1;
+    }
+    free(probe);
+
+    /* Done! */
+    mIsLoaded = true;
+}
+
+Uring::~Uring()
+{
+    if (mSqes) munmap(mSqes, mSqesSize);
+    if (mCqRing && (mCqRing != mSqRing)) munmap(mCqRing, mCqRingSize);
+    if (mSqRing) munmap(mSqRing, mSqRingSize);
+    if (mFd != -1) close(mFd);
+}
+
+bool Uring::supports(const uint8_t opcode) const
+{
+    return mSupported[opcode] != 0;
+}
+
+struct io_uring_sqe *Uring::getSqe(void)
+{
+    unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *mSqTail + mPending;
+    struct io_uring_sqe *sqe = NULL;
+
+    if ((tail - head) > *mSqMask)
+        return NULL;
+
+    sqe = &mSqes[tail & *mSqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    mSqArray[tail & *mSqMask] = tail & *mSqMask;
+    mPending++;
+    return sqe;
+}
+
+bool Uring::submit(const unsigned int waitFor)
+{
+    int result = 0;
+
+    /* Publish the filled-in SQEs; the kernel reads them on enter */
+    __atomic_store_n(mSqTail, *mSqTail + mPending, __ATOMIC_RELEASE);
+    mPending = 0;
+
+    do
+    {
+        result = uringEnter(mFd, *mSqTail - __atomic_load_n(mSqHead,
+            __ATOMIC_ACQUIRE), waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+    } while ((result == -1) && (errno == EINTR));
+
+    return (result >= 0);
+}
+
+bool Uring::peek(struct io_uring_cqe *cqe)
+{
+    unsigned head = *mCqHead;
+
+    if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *cqe = mCqes[head & *mCqMask];
+    __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,62 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <cstdint>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper over the raw system calls, so we don't
+ * depend on liburing. One thread owns a ring: grab SQEs with getSqe(),
+ * fill them in, then submit() and drain completions with peek(). */
+class Uring {
+public:
+    Uring(const unsigned int entries);
+    ~Uring();
+    bool isLoaded(void) const { return mIsLoaded; }
+
+    /* Every opcode we need, checked with IORING_REGISTER_PROBE */
+    bool supports(const uint8_t opcode) const;
+
+    /* A zeroed SQE to fill in, or NULL if the queue is full */
+    struct io_uring_sqe *getSqe(void);
+
+    /* Submit queued SQEs and wait until at least waitFor completions
+     * are ready */
+    bool submit(const unsigned int waitFor);
+
+    /* Take the next completion, if there is one */
+    bool peek(struct io_uring_cqe *cqe);
+
+private:
+    int mFd;
+    void *mSqRing;
+    size_t mSqRingSize;
+    void *mCqRing;                  /* Same as mSqRing with SINGLE_MMAP */
+    size_t mCqRingSize;
+    struct io_uring_sqe *mSqes;
+    size_t mSqesSize;
+
+    unsigned *mSqHead;
+    unsigned *mSqTail;
+    unsigned *mSqMask;
+    unsigned *mSqArray;
+    unsigned *mCqHead;
+    unsigned *mCqTail;
+    unsigned *mCqMask;
+    struct io_uring_cqe *mCqes;
+
+    unsigned mPending;              /* Filled in, tail not yet moved */
+    uint8_t mSupported[256];        /* Indexed by opcode */
+    bool mIsLoaded;
+};
+
+#endif /* __URING_H__ */
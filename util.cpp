@@ -0,0 +1,66 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include "util.h"
+
+bool parseNumber(const std::string &text, const int base, long *value)
+{
+    char *end = NULL;
+
+    errno = 0;
+    *value = strtol(text.c_str(), &end, base);
+    return (!text.empty() && (*end == '\0') && (errno == 0));
+}
+
+bool writeImageFile(const std::string &filename, const uint8_t *data,
+    const size_t length)
+{
+    std::string tempFile = filename + ".tmp";
+    size_t done = 0;
+    ssize_t bytes = 0;
+    bool ok = true;
+    int fd = -1;
+
+    fd = open(tempFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        std::cout << "Unable to create '" << tempFile << "': ";
+        std::cout << strerror(errno) << std::endl;
+        return false;
+    }
+
+    while (ok && (done < length))
+    {
+        bytes = ::write(fd, data + done, length - done);
+        if ((bytes == -1) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            ok = false;
+        else
+            done += bytes;
+    } /* End while */
+    if (close(fd) == -1) ok = false;
+
+    if (!ok || (rename(tempFile.c_str(), filename.c_str()) == -1))
+    {
+        std::cout << "Unable to write '" << filename << "': ";
+        std::cout << strerror(errno) << std::endl;
+        unlink(tempFile.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __UTIL_H__
+#define __UTIL_H__
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/* The whole of text as a number in base (0 for C-style prefixes),
+ * without overflow */
+extern bool parseNumber(const std::string &text, const int base, long *value);
+
+/* Write a whole file via a temporary one renamed into place, so
+ * nothing ever sees half of it. Problems are printed. */
+extern bool writeImageFile(const std::string &filename, const uint8_t *data,
+    const size_t length);
+
+#endif /* __UTIL_H__ */
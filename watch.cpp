@@ -0,0 +1,202 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <iostream>
+#include "watch.h"
+#include "metrics.h"
+
+/* How long a name must go without new events before it is scanned */
+#define SETTLE_MS 250
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void stopHandler(int signum)
+{
+    (void)signum;
+    stopRequested = 1;
+}
+
+ScanWatcher::ScanWatcher(const ScanConfig_t &config, const unsigned int threads,
+    const size_t queueLimit) :
+    mConfig(config), mPool(threads, queueLimit)
+{
+}
+
+ScanWatcher::~ScanWatcher()
+{
+}
+
+int ScanWatcher::run(const char *directory)
+{
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = NULL;
+    struct sigaction action;
+    struct pollfd watcher;
+    std::map<std::string, Clock_t::time_point>::iterator it;
+    Clock_t::time_point now;
+    int timeout = -1;
+    int wait = 0;
+    ssize_t bytes = 0;
+    ssize_t offset = 0;
+    int inotifyFd = -1;
+
+    mDirectory = directory;
+    if (mDirectory.empty() || (mDirectory[mDirectory.size() - 1] != '/'))
+        mDirectory += '/';
+
+    /* Stop cleanly on SIGINT/SIGTERM */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopHandler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( (inotifyFd == -1) ||
+        (inotify_add_watch(inotifyFd, directory,
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) == -1) )
+    {
+        std::cout << "Unable to watch '" << directory << "': ";
+        std::cout << strerror(errno) << std::endl;
+        if (inotifyFd != -1) close(inotifyFd);
+        return 1;
+    }
+
+    metricsSetQueueDepthSource(std::bind(&WorkerPool::queueDepth, &mPool));
+
+    watcher.fd = inotifyFd;
+    watcher.events = POLLIN;
+    while (!stopRequested)
+    {
+        /* Sleep until there's an event or the next pending name is due */
+        timeout = -1;
+        now = Clock_t::now();
+        for (it = mPending.begin(); it != mPending.end(); ++it)
+        {
+            wait = 0;
+            if (it->second > now)
+                wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    it->second - now).count() + 1;
+            if ((timeout == -1) || (wait < timeout))
+                timeout = wait;
+        } /* End for */
+
+        if (poll(&watcher, 1, timeout) > 0)
+        {
+            while ((bytes = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                for (offset = 0; offset < bytes;
+                    offset += sizeof(struct inotify_event) + event->len)
+                {
+                    event = reinterpret_cast<const struct inotify_event *>(
+                        buffer + offset);
+
+                    /* The kernel dropped events; fall back to a listing */
+                    if (event->mask & IN_Q_OVERFLOW)
+                        rescan();
+                    else if (event->len && !(event->mask & IN_ISDIR))
+                        notice(event->name);
+                } /* End for */
+            } /* End while */
+        }
+
+        dispatch();
+    } /* End while */
+
+    close(inotifyFd);
+    mPool.wait();
+    metricsSetQueueDepthSource(std::function<size_t(void)>());
+    return 0;
+}
+
+void ScanWatcher::notice(const std::string &name)
+{
+    if (name.empty() || (name[0] == '.'))
+        return;
+
+    /* Every new event for a name pushes its scan back */
+    mPending[name] = Clock_t::now() + std::chrono::milliseconds(SETTLE_MS);
+}
+
+void ScanWatcher::rescan(void)
+{
+    struct dirent *entry = NULL;
+    DIR *dir = opendir(mDirectory.c_str());
+
+    if (!dir) return;
+    while ((entry = readdir(dir)) != NULL)
+        if ((entry->d_type == DT_REG) || (entry->d_type == DT_UNKNOWN))
+            notice(entry->d_name);
+    closedir(dir);
+}
+
+void ScanWatcher::dispatch(void)
+{
+    Clock_t::time_point now = Clock_t::now();
+    std::map<std::string, Clock_t::time_point>::iterator it = mPending.begin();
+
+    while (it != mPending.end())
+    {
+        if (it->second > now)
+        {
+            ++it;
+            continue;
+        }
+
+        /* Already waiting for a worker? It'll see the new contents. */
+        {
+            std::lock_guard<std::mutex> guard(mQueuedLock);
+            if (mQueued.count(it->first))
+            {
+                it = mPending.erase(it);
+                continue;
+            }
+            mQueued.insert(it->first);
+        }
+
+        /* Queue full: leave it pending and try again after it settles
+         * once more, rather than blocking the event loop */
+        if (!mPool.trySubmit(std::bind(&ScanWatcher::scanFile, this, it->first)))
+        {
+            std::lock_guard<std::mutex> guard(mQueuedLock);
+            mQueued.erase(it->first);
+            it->second = now + std::chrono::milliseconds(SETTLE_MS);
+            ++it;
+            continue;
+        }
+        it = mPending.erase(it);
+    } /* End while */
+}
+
+void ScanWatcher::scanFile(const std::string &name)
+{
+    std::string path = mDirectory + name;
+    std::string json;
+    Pack *pack = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(mQueuedLock);
+        mQueued.erase(name);
+    }
+
+    pack = ::scanFile(path.c_str(), mConfig);
+    json = pack->generateJSON();
+    delete pack;
+
+    std::lock_guard<std::mutex> guard(mOutputLock);
+    std::cout << json << std::flush;
+}
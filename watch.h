@@ -0,0 +1,53 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <string>
+#include <chrono>
+#include "scan.h"
+#include "worker_pool.h"
+
+/* Scans dumps as they land in a directory. inotify reports files that
+ * were closed after writing or renamed into the directory; repeated
+ * events for the same name are coalesced until it has been quiet for
+ * a short settle time, then the dump is handed to a worker through a
+ * bounded queue. Each result is printed as one JSON line, the same
+ * format as "packscan -j". Names starting with '.' are treated as
+ * in-progress temporaries and ignored. */
+class ScanWatcher {
+public:
+    ScanWatcher(const ScanConfig_t &config, const unsigned int threads,
+        const size_t queueLimit);
+    ~ScanWatcher();
+    int run(const char *directory);
+
+private:
+    typedef std::chrono::steady_clock Clock_t;
+
+    void notice(const std::string &name);
+    void rescan(void);
+    void dispatch(void);
+    void scanFile(const std::string &name);
+
+    ScanConfig_t mConfig;
+    WorkerPool mPool;
+    std::string mDirectory;
+    std::map<std::string, Clock_t::time_point> mPending; /* Name, due time */
+    std::mutex mQueuedLock;
+    std::set<std::string> mQueued;  /* Submitted, not yet started */
+    std::mutex mOutputLock;         /* One result line at a time */
+};
+
+#endif /* __WATCH_H__ */
@@ -0,0 +1,112 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(const unsigned int threads, const size_t queueLimit) :
+    mQueueLimit(queueLimit), mRunning(0), mStopping(false)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < (threads ? threads : 1); i++)
+        mThreads.push_back(std::thread(&WorkerPool::workerMain, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    unsigned int i = 0;
+
+    /* Let the workers drain the queue, then join them */
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStopping = true;
+    }
+    mHaveWork.notify_all();
+
+    for (i = 0; i < mThreads.size(); i++)
+        mThreads[i].join();
+}
+
+unsigned int WorkerPool::defaultThreads(void)
+{
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads ? threads : 1;
+}
+
+void WorkerPool::submit(const std::function<void(void)> &job)
+{
+    std::unique_lock<std::mutex> guard(mLock);
+
+    while (mQueueLimit && (mQueue.size() >= mQueueLimit))
+        mHaveRoom.wait(guard);
+
+    mQueue.push_back(job);
+    guard.unlock();
+    mHaveWork.notify_one();
+}
+
+bool WorkerPool::trySubmit(const std::function<void(void)> &job)
+{
+    std::unique_lock<std::mutex> guard(mLock);
+
+    if (mQueueLimit && (mQueue.size() >= mQueueLimit))
+        return false;
+
+    mQueue.push_back(job);
+    guard.unlock();
+    mHaveWork.notify_one();
+    return true;
+}
+
+void WorkerPool::wait(void)
+{
+    std::unique_lock<std::mutex> guard(mLock);
+
+    while (!mQueue.empty() || mRunning)
+        mIdle.wait(guard);
+}
+
+size_t WorkerPool::queueDepth(void)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    return mQueue.size();
+}
+
+void WorkerPool::workerMain(void)
+{
+    std::function<void(void)> job;
+    std::unique_lock<std::mutex> guard(mLock);
+
+    for (;;)
+    {
+        while (mQueue.empty() && !mStopping)
+            mHaveWork.wait(guard);
+
+        if (mQueue.empty())
+            break; /* Stopping and drained */
+
+        job = std::move(mQueue.front());
+        mQueue.pop_front();
+        mRunning++;
+        guard.unlock();
+        mHaveRoom.notify_one();
+
+        job();
+
+        /* Let go of whatever the job holds (a daemon connection, say)
+         * now, not when this worker gets its next job */
+        job = nullptr;
+
+        guard.lock();
+        mRunning--;
+        if (mQueue.empty() && !mRunning)
+            mIdle.notify_all();
+    } /* End for */
+}
@@ -0,0 +1,51 @@
+/****************************************************************
+ * PackScan: An SFC memory pack dump analysis tool.
+ *
+ * Written by Andrew Henderson (hendersa@icculus.org).
+ *
+ * This code is open source and licensed under the GPLv3. Please
+ * review the LICENSE file for the details if you would like to
+ * use this source code in your own projects.
+ ***************************************************************/
+
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+/* Fixed set of threads pulling jobs from a FIFO queue. With a nonzero
+ * queue limit, submit() blocks while the queue is full, which pushes
+ * back on whoever is producing work. */
+class WorkerPool {
+public:
+    WorkerPool(const unsigned int threads, const size_t queueLimit = 0);
+    ~WorkerPool();
+    void submit(const std::function<void(void)> &job);
+    bool trySubmit(const std::function<void(void)> &job);
+    void wait(void);
+    size_t queueDepth(void);
+    unsigned int threadCount(void) const { return mThreads.size(); }
+
+    static unsigned int defaultThreads(void);
+
+private:
+    void workerMain(void);
+
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void(void)> > mQueue;
+    std::mutex mLock;
+    std::condition_variable mHaveWork;  /* Queue went non-empty */
+    std::condition_variable mHaveRoom;  /* Queue went below its limit */
+    std::condition_variable mIdle;      /* Queue empty, nothing running */
+    size_t mQueueLimit;
+    size_t mRunning;
+    bool mStopping;
+};
+
+#endif /* __WORKER_POOL_H__ */